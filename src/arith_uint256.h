@@ -0,0 +1,329 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_ARITH_UINT256_H
+#define BITCOIN_ARITH_UINT256_H
+
+#include "uint256.h"
+
+#include <string.h>
+#include <string>
+
+/** Unsigned 256-bit integer for proof-of-work and chain work arithmetic.
+ *
+ * Unlike CBigNum this lives entirely on the stack, so difficulty and work
+ * calculations do not allocate. Arithmetic wraps modulo 2^256 without any
+ * indication, so callers whose values may not fit must check for overflow
+ * themselves, e.g. through MulDiv. The word layout is the same as uint256,
+ * so conversion in both directions is a plain copy.
+ */
+class arith_uint256
+{
+private:
+    enum { WIDTH = 8 };
+    uint32_t pn[WIDTH];
+
+public:
+    arith_uint256()
+    {
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] = 0;
+    }
+
+    arith_uint256(uint64 b)
+    {
+        pn[0] = (uint32_t)b;
+        pn[1] = (uint32_t)(b >> 32);
+        for (int i = 2; i < WIDTH; i++)
+            pn[i] = 0;
+    }
+
+    explicit arith_uint256(const uint256& b)
+    {
+        memcpy(pn, b.begin(), sizeof(pn));
+    }
+
+    uint256 getuint256() const
+    {
+        uint256 ret;
+        memcpy(ret.begin(), pn, sizeof(pn));
+        return ret;
+    }
+
+    uint64 GetLow64() const
+    {
+        return pn[0] | (uint64)pn[1] << 32;
+    }
+
+    bool operator!() const
+    {
+        for (int i = 0; i < WIDTH; i++)
+            if (pn[i] != 0)
+                return false;
+        return true;
+    }
+
+    const arith_uint256 operator~() const
+    {
+        arith_uint256 ret;
+        for (int i = 0; i < WIDTH; i++)
+            ret.pn[i] = ~pn[i];
+        return ret;
+    }
+
+    int CompareTo(const arith_uint256& b) const
+    {
+        for (int i = WIDTH - 1; i >= 0; i--)
+        {
+            if (pn[i] < b.pn[i])
+                return -1;
+            if (pn[i] > b.pn[i])
+                return 1;
+        }
+        return 0;
+    }
+
+    arith_uint256& operator+=(const arith_uint256& b)
+    {
+        uint64 carry = 0;
+        for (int i = 0; i < WIDTH; i++)
+        {
+            uint64 n = carry + pn[i] + b.pn[i];
+            pn[i] = (uint32_t)n;
+            carry = n >> 32;
+        }
+        return *this;
+    }
+
+    arith_uint256& operator-=(const arith_uint256& b)
+    {
+        uint64 borrow = 0;
+        for (int i = 0; i < WIDTH; i++)
+        {
+            uint64 n = (uint64)pn[i] - b.pn[i] - borrow;
+            pn[i] = (uint32_t)n;
+            borrow = (n >> 32) ? 1 : 0;
+        }
+        return *this;
+    }
+
+    arith_uint256& operator<<=(unsigned int shift)
+    {
+        arith_uint256 a(*this);
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] = 0;
+        int k = shift / 32;
+        shift = shift % 32;
+        for (int i = 0; i < WIDTH; i++)
+        {
+            if (i + k + 1 < WIDTH && shift != 0)
+                pn[i + k + 1] |= (a.pn[i] >> (32 - shift));
+            if (i + k < WIDTH)
+                pn[i + k] |= (a.pn[i] << shift);
+        }
+        return *this;
+    }
+
+    arith_uint256& operator>>=(unsigned int shift)
+    {
+        arith_uint256 a(*this);
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] = 0;
+        int k = shift / 32;
+        shift = shift % 32;
+        for (int i = 0; i < WIDTH; i++)
+        {
+            if (i - k - 1 >= 0 && shift != 0)
+                pn[i - k - 1] |= (a.pn[i] << (32 - shift));
+            if (i - k >= 0)
+                pn[i - k] |= (a.pn[i] >> shift);
+        }
+        return *this;
+    }
+
+    arith_uint256& operator*=(uint64 b)
+    {
+        // Schoolbook multiplication by the two 32-bit halves of b
+        uint32_t b0 = (uint32_t)b, b1 = (uint32_t)(b >> 32);
+        arith_uint256 a(*this);
+        uint64 carry = 0;
+        for (int i = 0; i < WIDTH; i++)
+        {
+            uint64 n = carry + (uint64)b0 * a.pn[i];
+            pn[i] = (uint32_t)n;
+            carry = n >> 32;
+        }
+        if (b1 != 0)
+        {
+            carry = 0;
+            for (int i = 0; i + 1 < WIDTH; i++)
+            {
+                uint64 n = carry + pn[i + 1] + (uint64)b1 * a.pn[i];
+                pn[i + 1] = (uint32_t)n;
+                carry = n >> 32;
+            }
+        }
+        return *this;
+    }
+
+    arith_uint256& operator/=(const arith_uint256& b)
+    {
+        arith_uint256 div = b;
+        arith_uint256 num = *this;
+        *this = 0;
+        int num_bits = num.bits();
+        int div_bits = div.bits();
+        if (div_bits == 0 || div_bits > num_bits)
+            return *this; // division by zero or result is zero
+        int shift = num_bits - div_bits;
+        div <<= shift;
+        while (shift >= 0)
+        {
+            if (num.CompareTo(div) >= 0)
+            {
+                num -= div;
+                pn[shift / 32] |= (1U << (shift & 31));
+            }
+            div >>= 1;
+            shift--;
+        }
+        return *this;
+    }
+
+    arith_uint256& operator/=(uint64 b)
+    {
+        return *this /= arith_uint256(b);
+    }
+
+    /** Multiply by nMul and divide by nDiv, rounding down, without losing the
+     *  high bits of the intermediate product. This is what CBigNum gives for
+     *  x * nMul / nDiv. If the result itself does not fit in 256 bits,
+     *  *pfOverflow is set and the value is not meaningful.
+     */
+    arith_uint256& MulDiv(uint64 nMul, uint64 nDiv, bool *pfOverflow = NULL)
+    {
+        // x = q * nDiv + r with r < nDiv, so x * nMul / nDiv is
+        // q * nMul + r * nMul / nDiv, and r * nMul needs at most 128 bits
+        arith_uint256 q(*this);
+        q /= nDiv;
+        arith_uint256 qd(q);
+        qd *= nDiv;
+        arith_uint256 frac(*this);
+        frac -= qd;
+        frac *= nMul;
+        frac /= nDiv;
+        arith_uint256 qmax(~arith_uint256());
+        qmax /= nMul;
+        bool fOverflow = nMul != 0 && q > qmax;
+        *this = q;
+        *this *= nMul;
+        *this += frac;
+        if (*this < frac)
+            fOverflow = true;
+        if (pfOverflow)
+            *pfOverflow = fOverflow;
+        return *this;
+    }
+
+    /** Number of significant bits, i.e. the position of the highest set bit plus one */
+    unsigned int bits() const
+    {
+        for (int pos = WIDTH - 1; pos >= 0; pos--)
+        {
+            if (pn[pos])
+            {
+                for (int nbits = 31; nbits > 0; nbits--)
+                    if (pn[pos] & (1U << nbits))
+                        return 32 * pos + nbits + 1;
+                return 32 * pos + 1;
+            }
+        }
+        return 0;
+    }
+
+    double getdouble() const
+    {
+        double ret = 0.0;
+        double fact = 1.0;
+        for (int i = 0; i < WIDTH; i++)
+        {
+            ret += fact * pn[i];
+            fact *= 4294967296.0;
+        }
+        return ret;
+    }
+
+    /** Decode the "compact" nBits representation used in block headers.
+     *  The format is the same as CBigNum::SetCompact: one size byte followed
+     *  by a 23-bit mantissa and a sign bit. A 256-bit unsigned value cannot
+     *  hold negative or oversized numbers, so those are reported through the
+     *  optional flags instead; the value itself is then not meaningful.
+     */
+    arith_uint256& SetCompact(unsigned int nCompact, bool *pfNegative = NULL, bool *pfOverflow = NULL)
+    {
+        unsigned int nSize = nCompact >> 24;
+        uint32_t nWord = nCompact & 0x007fffff;
+        if (nSize <= 3)
+        {
+            nWord >>= 8 * (3 - nSize);
+            *this = nWord;
+        }
+        else
+        {
+            *this = nWord;
+            *this <<= 8 * (nSize - 3);
+        }
+        if (pfNegative)
+            *pfNegative = nWord != 0 && (nCompact & 0x00800000) != 0;
+        if (pfOverflow)
+            *pfOverflow = nWord != 0 && ((nSize > 34) ||
+                                         (nWord > 0xff && nSize > 33) ||
+                                         (nWord > 0xffff && nSize > 32));
+        return *this;
+    }
+
+    unsigned int GetCompact(bool fNegative = false) const
+    {
+        unsigned int nSize = (bits() + 7) / 8;
+        uint32_t nCompact = 0;
+        if (nSize <= 3)
+            nCompact = (uint32_t)GetLow64() << 8 * (3 - nSize);
+        else
+        {
+            arith_uint256 bn = *this;
+            bn >>= 8 * (nSize - 3);
+            nCompact = (uint32_t)bn.GetLow64();
+        }
+        // The 0x00800000 bit denotes the sign.
+        // Thus, if it is already set, divide the mantissa by 256 and increase the exponent.
+        if (nCompact & 0x00800000)
+        {
+            nCompact >>= 8;
+            nSize++;
+        }
+        nCompact |= nSize << 24;
+        nCompact |= (fNegative && (nCompact & 0x007fffff) ? 0x00800000 : 0);
+        return nCompact;
+    }
+
+    std::string GetHex() const { return getuint256().GetHex(); }
+    std::string ToString() const { return GetHex(); }
+
+    friend inline bool operator==(const arith_uint256& a, const arith_uint256& b) { return memcmp(a.pn, b.pn, sizeof(a.pn)) == 0; }
+    friend inline bool operator!=(const arith_uint256& a, const arith_uint256& b) { return memcmp(a.pn, b.pn, sizeof(a.pn)) != 0; }
+    friend inline bool operator<(const arith_uint256& a, const arith_uint256& b)  { return a.CompareTo(b) < 0; }
+    friend inline bool operator<=(const arith_uint256& a, const arith_uint256& b) { return a.CompareTo(b) <= 0; }
+    friend inline bool operator>(const arith_uint256& a, const arith_uint256& b)  { return a.CompareTo(b) > 0; }
+    friend inline bool operator>=(const arith_uint256& a, const arith_uint256& b) { return a.CompareTo(b) >= 0; }
+};
+
+inline const arith_uint256 operator+(const arith_uint256& a, const arith_uint256& b) { return arith_uint256(a) += b; }
+inline const arith_uint256 operator-(const arith_uint256& a, const arith_uint256& b) { return arith_uint256(a) -= b; }
+inline const arith_uint256 operator*(const arith_uint256& a, uint64 b)               { return arith_uint256(a) *= b; }
+inline const arith_uint256 operator/(const arith_uint256& a, const arith_uint256& b) { return arith_uint256(a) /= b; }
+inline const arith_uint256 operator/(const arith_uint256& a, uint64 b)               { return arith_uint256(a) /= b; }
+inline const arith_uint256 operator<<(const arith_uint256& a, unsigned int shift)    { return arith_uint256(a) <<= shift; }
+inline const arith_uint256 operator>>(const arith_uint256& a, unsigned int shift)    { return arith_uint256(a) >>= shift; }
+
+#endif
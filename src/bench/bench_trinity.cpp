@@ -0,0 +1,379 @@
+// Copyright (c) 2013 The Trinity developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Throughput and latency benchmarks for the hashing primitives used by the
+// three proof-of-work algorithms and by block validation.
+//
+// Usage: bench_trinity [-filter=<substring>] [-time=<ms per benchmark>]
+//
+// Results are written to stdout as one JSON object. Benchmarks are always
+// listed in the same order and with the same fields, so the output can be
+// diffed and tracked across releases.
+
+#include "main.h"
+#include "hash.h"
+#include "keystore.h"
+#include "hashgroestl.h"
+#include "hashqubit.h"
+#include "hashskein.h"
+#include "powhash.h"
+#include "scrypt.h"
+#include "sha256.h"
+#include "util.h"
+#include "wallet.h"
+#include "ui_interface.h"
+#include "chainparams.h"
+#include "clientversion.h"
+
+#include "json/json_spirit_writer_template.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+using namespace json_spirit;
+
+// Symbols normally provided by init.cpp
+CWallet* pwalletMain = NULL;
+CClientUIInterface uiInterface;
+
+void StartShutdown()
+{
+    exit(0);
+}
+
+/** Shared state handed to each benchmark body */
+struct CBenchContext
+{
+    unsigned char header[80];
+    std::vector<unsigned char> vch1k;
+    CBlock block;
+    std::vector<char> vchScratchpad;
+    uint32_t midstate[8];
+    uint32_t data[32];
+    uint32_t nNonce;
+    uint256 hashSink; // keeps the optimizer from dropping the work
+    CTransaction txP2PKH;       // spends scriptP2PKH
+    CScript scriptP2PKH;
+    CTransaction txP2SHMultisig; // spends scriptP2SHMultisig with 2 of 3 signatures
+    CScript scriptP2SHMultisig;
+};
+
+typedef void (*BenchFunction)(CBenchContext& ctx);
+
+struct CBenchmark
+{
+    const char* pszName;
+    BenchFunction fn;        // NULL if not compiled into this build
+    unsigned int nBatch;     // operations timed together
+    unsigned int nBytesPerOp; // for MB/s, 0 if not meaningful
+};
+
+static void BenchSHA256d80(CBenchContext& ctx)
+{
+    ctx.hashSink = Hash(BEGIN(ctx.header), END(ctx.header));
+    ctx.header[0] = ctx.hashSink.begin()[0];
+}
+
+static void BenchSHA256d1k(CBenchContext& ctx)
+{
+    ctx.hashSink = Hash(ctx.vch1k.begin(), ctx.vch1k.end());
+    ctx.vch1k[0] = ctx.hashSink.begin()[0];
+}
+
+static void BenchHashWriterHeader(CBenchContext& ctx)
+{
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << ctx.block.GetBlockHeader();
+    ctx.hashSink = ss.GetHash();
+    ctx.block.nNonce++;
+}
+
+static void BenchSHA256dScan(CBenchContext& ctx)
+{
+    uint32_t hash[8];
+    sha256d_scan(ctx.midstate, ctx.data + 16, ctx.nNonce, hash);
+    ctx.nNonce += sha256d_scan_lanes;
+}
+
+static void BenchGroestl80(CBenchContext& ctx)
+{
+    ctx.hashSink = HashGroestl(BEGIN(ctx.header), END(ctx.header));
+    ctx.header[0] = ctx.hashSink.begin()[0];
+}
+
+static void BenchQubit80(CBenchContext& ctx)
+{
+    ctx.hashSink = HashQubit(BEGIN(ctx.header), END(ctx.header));
+    ctx.header[0] = ctx.hashSink.begin()[0];
+}
+
+static void BenchSkein80(CBenchContext& ctx)
+{
+    ctx.hashSink = HashSkein(BEGIN(ctx.header), END(ctx.header));
+    ctx.header[0] = ctx.hashSink.begin()[0];
+}
+
+static void BenchScryptGeneric(CBenchContext& ctx)
+{
+    scrypt_1024_1_1_256_sp_generic((const char*)ctx.header, BEGIN(ctx.hashSink), &ctx.vchScratchpad[0]);
+    ctx.header[0] = ctx.hashSink.begin()[0];
+}
+
+#if defined(USE_SSE2)
+static void BenchScryptSSE2(CBenchContext& ctx)
+{
+    scrypt_1024_1_1_256_sp_sse2((const char*)ctx.header, BEGIN(ctx.hashSink), &ctx.vchScratchpad[0]);
+    ctx.header[0] = ctx.hashSink.begin()[0];
+}
+#else
+static const BenchFunction BenchScryptSSE2 = NULL;
+#endif
+
+static void BenchScryptMulti(CBenchContext& ctx)
+{
+    // One operation is one hash; hash a full group of inputs per call
+    static char input[80 * SCRYPT_MAX_WAYS];
+    static char output[32 * SCRYPT_MAX_WAYS];
+    for (int i = 0; i < scrypt_multi_ways; i++)
+        memcpy(&input[80 * i], ctx.header, 80);
+    scrypt_1024_1_1_256_multi_sp(input, output, scrypt_multi_ways, &ctx.vchScratchpad[0]);
+    ctx.header[0] = output[0];
+}
+
+static void BenchPoWHash(CBenchContext& ctx, int algo)
+{
+    ctx.hashSink = ctx.block.GetPoWHash(algo);
+    ctx.block.nNonce++;
+}
+
+static void BenchPoWSHA256d(CBenchContext& ctx) { BenchPoWHash(ctx, ALGO_SHA256D); }
+static void BenchPoWScrypt(CBenchContext& ctx) { BenchPoWHash(ctx, ALGO_SCRYPT); }
+static void BenchPoWGroestl(CBenchContext& ctx) { BenchPoWHash(ctx, ALGO_GROESTL); }
+
+// Nonce scanning as the miner does it, with the header prefix hashed once
+template<int algo>
+static void BenchPoWHasher(CBenchContext& ctx)
+{
+    static CPoWHasher<algo> hasher(ctx.block);
+    ctx.hashSink = hasher.Hash(ctx.nNonce++);
+}
+
+static void BenchMurmurHash3(CBenchContext& ctx)
+{
+    ctx.nNonce = MurmurHash3(ctx.nNonce, ctx.vch1k);
+}
+
+static void BenchMerkleRoot(CBenchContext& ctx)
+{
+    ctx.block.vMerkleTree.clear();
+    ctx.hashSink = ctx.block.BuildMerkleTree();
+}
+
+static void BenchCheckProofOfWork(CBenchContext& ctx)
+{
+    // A passing check, so nothing is logged
+    ctx.nNonce += CheckProofOfWork(0, ctx.block.nBits, ALGO_SHA256D);
+}
+
+// Per-input script verification as CScriptCheck does it. The signatures are
+// in the signature cache after the warm-up, so this measures the interpreter,
+// the signature hash and the cache lookup rather than ECDSA.
+static void BenchVerifyScript(CBenchContext& ctx, const CTransaction& tx, const CScript& scriptPubKey)
+{
+    ctx.nNonce += VerifyScript(tx.vin[0].scriptSig, scriptPubKey, tx, 0, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC, 0);
+}
+
+static void BenchVerifyP2PKH(CBenchContext& ctx) { BenchVerifyScript(ctx, ctx.txP2PKH, ctx.scriptP2PKH); }
+static void BenchVerifyP2SHMultisig(CBenchContext& ctx) { BenchVerifyScript(ctx, ctx.txP2SHMultisig, ctx.scriptP2SHMultisig); }
+
+static const CBenchmark benchmarks[] =
+{
+    { "sha256d_80b",        BenchSHA256d80,        1000, 80 },
+    { "sha256d_1kb",        BenchSHA256d1k,         100, 1024 },
+    { "hashwriter_header",  BenchHashWriterHeader, 1000, 80 },
+    { "sha256d_scan",       BenchSHA256dScan,      1000, 0 },
+    { "groestl_80b",        BenchGroestl80,         100, 80 },
+    { "qubit_80b",          BenchQubit80,           100, 80 },
+    { "skein_80b",          BenchSkein80,           100, 80 },
+    { "scrypt_generic",     BenchScryptGeneric,       4, 80 },
+    { "scrypt_sse2",        BenchScryptSSE2,          4, 80 },
+    { "scrypt_multi",       BenchScryptMulti,         1, 0 },
+    { "pow_sha256d",        BenchPoWSHA256d,       1000, 80 },
+    { "pow_scrypt",         BenchPoWScrypt,           4, 80 },
+    { "pow_groestl",        BenchPoWGroestl,        100, 80 },
+    { "powhasher_sha256d",  BenchPoWHasher<ALGO_SHA256D>, 1000, 80 },
+    { "powhasher_groestl",  BenchPoWHasher<ALGO_GROESTL>,  100, 80 },
+    { "murmurhash3_1kb",    BenchMurmurHash3,       100, 1024 },
+    { "merkle_root_2000tx", BenchMerkleRoot,          1, 0 },
+    { "checkproofofwork",   BenchCheckProofOfWork, 1000, 0 },
+    { "verifyscript_p2pkh", BenchVerifyP2PKH,       100, 0 },
+    { "verifyscript_p2sh_multisig", BenchVerifyP2SHMultisig, 100, 0 },
+};
+
+static void SetupContext(CBenchContext& ctx)
+{
+    for (int i = 0; i < 80; i++)
+        ctx.header[i] = (unsigned char)(i * 7 + 3);
+    ctx.vch1k.resize(1024);
+    for (unsigned int i = 0; i < ctx.vch1k.size(); i++)
+        ctx.vch1k[i] = (unsigned char)(i * 13 + 1);
+
+    ctx.block.nVersion = 2;
+    ctx.block.nTime = 1386000000;
+    ctx.block.nBits = 0x1e0fffff;
+    ctx.block.nNonce = 0;
+    for (int i = 0; i < 2000; i++)
+    {
+        CTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.n = i;
+        tx.vout.resize(1);
+        tx.vout[0].nValue = i;
+        ctx.block.vtx.push_back(tx);
+    }
+    ctx.block.hashMerkleRoot = ctx.block.BuildMerkleTree();
+
+    // Inputs spending standard scripts, signed with fresh keys. Only the last
+    // two multisig keys can sign: CHECKMULTISIG tries keys from the last one,
+    // so any other pair would cost a failed, uncacheable ECDSA check per input.
+    CBasicKeyStore keystore;
+    std::vector<CPubKey> vPubKeys;
+    for (int i = 0; i < 3; i++)
+    {
+        CKey key;
+        key.MakeNewKey(true);
+        if (i > 0)
+            keystore.AddKey(key);
+        vPubKeys.push_back(key.GetPubKey());
+    }
+    CScript scriptMultisig;
+    scriptMultisig.SetMultisig(2, vPubKeys);
+    keystore.AddCScript(scriptMultisig);
+    ctx.scriptP2PKH.SetDestination(vPubKeys[1].GetID());
+    ctx.scriptP2SHMultisig.SetDestination(scriptMultisig.GetID());
+
+    CTransaction txSpend;
+    txSpend.vin.resize(1);
+    txSpend.vin[0].prevout.hash = ctx.block.vtx[0].GetHash();
+    txSpend.vout.resize(1);
+    txSpend.vout[0].nValue = COIN;
+    txSpend.vout[0].scriptPubKey = ctx.scriptP2PKH;
+    ctx.txP2PKH = txSpend;
+    SignSignature(keystore, ctx.scriptP2PKH, ctx.txP2PKH, 0);
+    ctx.txP2SHMultisig = txSpend;
+    SignSignature(keystore, ctx.scriptP2SHMultisig, ctx.txP2SHMultisig, 0);
+
+    ctx.vchScratchpad.resize(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+
+    // Same layout as FormatHashBuffers
+    unsigned char buf[128];
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, ctx.header, 80);
+    buf[80] = 0x80;
+    buf[126] = 0x02;
+    buf[127] = 0x80;
+    for (int i = 0; i < 32; i++)
+        ctx.data[i] = ByteReverse(((uint32_t*)buf)[i]);
+    memcpy(ctx.midstate, sha256_init_state, sizeof(ctx.midstate));
+    sha256_transform(ctx.midstate, ctx.data);
+    ctx.nNonce = 0;
+}
+
+static Object RunBenchmark(const CBenchmark& bench, CBenchContext& ctx, int64 nTimeMicros)
+{
+    Object result;
+    result.push_back(Pair("name", bench.pszName));
+    if (bench.fn == NULL)
+    {
+        // Same fields as a measured benchmark, so every build has the same output
+        result.push_back(Pair("skipped", true));
+        result.push_back(Pair("iterations", Value()));
+        result.push_back(Pair("ns_per_op_min", Value()));
+        result.push_back(Pair("ns_per_op_median", Value()));
+        result.push_back(Pair("ns_per_op_max", Value()));
+        result.push_back(Pair("ops_per_sec", Value()));
+        result.push_back(Pair("mb_per_sec", Value()));
+        return result;
+    }
+
+    // Warm up caches and lazily initialized state
+    for (unsigned int i = 0; i < bench.nBatch; i++)
+        bench.fn(ctx);
+
+    std::vector<double> vBatchNs;
+    uint64 nOps = 0;
+    int64 nStart = GetTimeMicros();
+    int64 nElapsed = 0;
+    while (nElapsed < nTimeMicros || vBatchNs.size() < 5)
+    {
+        int64 nBatchStart = GetTimeMicros();
+        for (unsigned int i = 0; i < bench.nBatch; i++)
+            bench.fn(ctx);
+        int64 nNow = GetTimeMicros();
+        vBatchNs.push_back((nNow - nBatchStart) * 1000.0 / bench.nBatch);
+        nOps += bench.nBatch;
+        nElapsed = nNow - nStart;
+    }
+
+    // scrypt_multi does scrypt_multi_ways hashes per call
+    unsigned int nHashesPerOp = (bench.fn == BenchScryptMulti) ? scrypt_multi_ways : 1;
+    if (bench.fn == BenchSHA256dScan)
+        nHashesPerOp = sha256d_scan_lanes;
+
+    std::sort(vBatchNs.begin(), vBatchNs.end());
+    double dSeconds = nElapsed / 1000000.0;
+    double dOpsPerSec = nOps * nHashesPerOp / dSeconds;
+
+    result.push_back(Pair("skipped", false));
+    result.push_back(Pair("iterations", (boost::int64_t)(nOps * nHashesPerOp)));
+    result.push_back(Pair("ns_per_op_min", vBatchNs.front() / nHashesPerOp));
+    result.push_back(Pair("ns_per_op_median", vBatchNs[vBatchNs.size() / 2] / nHashesPerOp));
+    result.push_back(Pair("ns_per_op_max", vBatchNs.back() / nHashesPerOp));
+    result.push_back(Pair("ops_per_sec", dOpsPerSec));
+    result.push_back(Pair("mb_per_sec", bench.nBytesPerOp ? dOpsPerSec * bench.nBytesPerOp / 1000000.0 : 0.0));
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    ParseParameters(argc, argv);
+    if (!SelectParamsFromCommandLine())
+    {
+        fprintf(stderr, "Error: Invalid combination of -regtest and -testnet.\n");
+        return 1;
+    }
+    // Keep the log out of stdout and don't create a debug.log
+    fPrintToConsole = false;
+    fPrintToDebugLog = false;
+
+    sha256_detect();
+    scrypt_detect();
+
+    std::string strFilter = GetArg("-filter", "");
+    int64 nTimeMicros = GetArg("-time", 500) * 1000;
+
+    CBenchContext ctx;
+    SetupContext(ctx);
+
+    Array results;
+    for (unsigned int i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+    {
+        if (!strFilter.empty() && std::string(benchmarks[i].pszName).find(strFilter) == std::string::npos)
+            continue;
+        results.push_back(RunBenchmark(benchmarks[i], ctx, nTimeMicros));
+    }
+
+    Object info;
+    info.push_back(Pair("version", FormatFullVersion()));
+    info.push_back(Pair("sha256d_scan_lanes", (int)sha256d_scan_lanes));
+    info.push_back(Pair("scrypt_multi_ways", scrypt_multi_ways));
+    info.push_back(Pair("time_per_benchmark_ms", (boost::int64_t)(nTimeMicros / 1000)));
+
+    Object output;
+    output.push_back(Pair("info", info));
+    output.push_back(Pair("benchmarks", results));
+    // printf is redirected to the debug log by util.h
+    fprintf(stdout, "%s\n", write_string(Value(output), true).c_str());
+    return 0;
+}
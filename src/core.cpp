@@ -4,8 +4,11 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "core.h"
+#include "powhash.h"
 #include "util.h"
 
+#include <boost/thread/tss.hpp>
+
 std::string COutPoint::ToString() const
 {
     return strprintf("COutPoint(%s, %u)", hash.ToString().substr(0,10).c_str(), n);
@@ -230,6 +233,52 @@ uint256 CBlockHeader::GetHash() const
     return Hash(BEGIN(nVersion), END(nNonce));
 }
 
+uint256 CBlockHeader::GetPoWHash(int algo) const
+{
+    switch (algo)
+    {
+        case ALGO_SHA256D:
+            return GetHash();
+        case ALGO_SCRYPT:
+            return CPoWHasher<ALGO_SCRYPT>(*this).Hash(nNonce);
+        case ALGO_GROESTL:
+            return CPoWHasher<ALGO_GROESTL>(*this).Hash(nNonce);
+    }
+    return GetHash();
+}
+
+// One scrypt scratchpad slab per thread that verifies headers
+static boost::thread_specific_ptr<std::vector<char> > scryptScratchpad;
+
+void GetPoWHashes(const std::vector<const CBlockHeader*>& vpheaders, std::vector<uint256>& vhashes)
+{
+    vhashes.resize(vpheaders.size());
+
+    std::vector<unsigned int> vScrypt;
+    for (unsigned int i = 0; i < vpheaders.size(); i++)
+    {
+        int algo = vpheaders[i]->GetAlgo();
+        if (algo == ALGO_SCRYPT)
+            vScrypt.push_back(i);
+        else
+            vhashes[i] = vpheaders[i]->GetPoWHash(algo);
+    }
+    if (vScrypt.empty())
+        return;
+
+    if (scryptScratchpad.get() == NULL)
+        scryptScratchpad.reset(new std::vector<char>(SCRYPT_MULTI_SCRATCHPAD_SIZE));
+
+    // Caution: scrypt_1024_1_1_256 assumes fixed length of 80 bytes
+    std::vector<char> vchInput(80 * vScrypt.size());
+    std::vector<char> vchOutput(32 * vScrypt.size());
+    for (unsigned int i = 0; i < vScrypt.size(); i++)
+        memcpy(&vchInput[80 * i], BEGIN(vpheaders[vScrypt[i]]->nVersion), 80);
+    scrypt_1024_1_1_256_multi_sp(&vchInput[0], &vchOutput[0], vScrypt.size(), &(*scryptScratchpad)[0]);
+    for (unsigned int i = 0; i < vScrypt.size(); i++)
+        memcpy(vhashes[vScrypt[i]].begin(), &vchOutput[32 * i], 32);
+}
+
 uint256 CBlock::BuildMerkleTree() const
 {
     vMerkleTree.clear();
@@ -10,6 +10,7 @@
 #include "script.h"
 #include "scrypt.h"
 #include "hashgroestl.h"
+#include "memusage.h"
 
 #include <stdio.h>
 
@@ -449,6 +450,14 @@ public:
             std::vector<CTxOut>().swap(vout);
     }
 
+    // heap memory held by the outputs and their scripts
+    size_t DynamicMemoryUsage() const {
+        size_t ret = memusage::DynamicUsage(vout);
+        for (unsigned int i = 0; i < vout.size(); i++)
+            ret += memusage::DynamicUsage(vout[i].scriptPubKey);
+        return ret;
+    }
+
     void swap(CCoins &to) {
         std::swap(to.fCoinBase, fCoinBase);
         to.vout.swap(vout);
@@ -637,31 +646,18 @@ public:
 
     // Note: we use explicitly provided algo instead of the one returned by GetAlgo(), because this can be a block
     // from foreign chain (parent block in merged mining) which does not encode algo in its nVersion field.
-    uint256 GetPoWHash(int algo) const
-    {
-        switch (algo)
-        {
-            case ALGO_SHA256D:
-                return GetHash();
-            case ALGO_SCRYPT:
-            {
-                uint256 thash;
-                // Caution: scrypt_1024_1_1_256 assumes fixed length of 80 bytes
-                scrypt_1024_1_1_256(BEGIN(nVersion), BEGIN(thash));
-                return thash;
-            }
-            case ALGO_GROESTL:
-                return HashGroestl(BEGIN(nVersion), END(nNonce));
-        }
-        return GetHash();
-    }
-    
+    uint256 GetPoWHash(int algo) const;
+
     int64 GetBlockTime() const
     {
         return (int64)nTime;
     }
 };
 
+/** Compute the proof-of-work hash of each header, using its own algo.
+ * Scrypt headers are batched through the interleaved scrypt kernel. */
+void GetPoWHashes(const std::vector<const CBlockHeader*>& vpheaders, std::vector<uint256>& vhashes);
+
 
 class CBlock : public CBlockHeader
 {
@@ -14,6 +14,8 @@
 #include "util.h"
 #include "ui_interface.h"
 #include "checkpoints.h"
+#include "scrypt.h"
+#include "sha256.h"
 
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -91,8 +93,6 @@ bool ShutdownRequested()
     return fRequestShutdown;
 }
 
-static CCoinsViewDB *pcoinsdbview;
-
 void Shutdown()
 {
     static CCriticalSection cs_Shutdown;
@@ -110,11 +110,14 @@ void Shutdown()
         LOCK(cs_main);
         if (pwalletMain)
             pwalletMain->SetBestChain(CBlockLocator(pindexBest));
+        // Block data first: the coin database must not point past it
+        FlushBlockFile();
         if (pblocktree)
-            pblocktree->Flush();
+            pblocktree->Sync();
         if (pcoinsTip)
             pcoinsTip->Flush();
         delete pcoinsTip; pcoinsTip = NULL;
+        delete pcoinsflush; pcoinsflush = NULL; // waits for the last write
         delete pcoinsdbview; pcoinsdbview = NULL;
         delete pblocktree; pblocktree = NULL;
     }
@@ -172,6 +175,11 @@ std::string HelpMessage()
     strUsage += "  -datadir=<dir>         " + _("Specify data directory") + "\n";
     strUsage += "  -wallet=<file>         " + _("Specify wallet file (within data directory)") + "\n";
     strUsage += "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 25)") + "\n";
+    strUsage += "  -coindb<opt>=<n>       " + _("Tune the coin database (chainstate/); <opt> is blockcache or writebuffer (in megabytes), blocksize (in kilobytes), bloombits, maxfiles or compression") + "\n";
+    strUsage += "  -blockdb<opt>=<n>      " + _("Tune the block index database (blocks/index/) the same way") + "\n";
+    strUsage += "  -mapblockfiles=<n>     " + _("Keep up to <n> finished block files memory-mapped for reading blocks (0 = disable, default: 16 on 64-bit systems, otherwise 0)") + "\n";
+    strUsage += "  -blockcache=<n>        " + _("Keep up to <n> megabytes of recently accepted or served blocks in memory (default: 16)") + "\n";
+    strUsage += "  -syncinterval=<n>      " + _("Once synced, commit new blocks and the coin database to disk at most every <n> seconds (default: 10)") + "\n";
     strUsage += "  -timeout=<n>           " + _("Specify connection timeout in milliseconds (default: 5000)") + "\n";
     strUsage += "  -proxy=<ip:port>       " + _("Connect through socks proxy") + "\n";
     strUsage += "  -socks=<n>             " + _("Select the version of socks proxy to use (4-5, default: 5)") + "\n";
@@ -237,7 +245,8 @@ std::string HelpMessage()
     strUsage += "  -txindex               " + _("Maintain a full transaction index (default: 0)") + "\n";
     strUsage += "  -loadblock=<file>      " + _("Imports blocks from external blk000??.dat file") + "\n";
     strUsage += "  -reindex               " + _("Rebuild block chain index from current blk000??.dat files") + "\n";
-    strUsage += "  -par=<n>               " + _("Set the number of script verification threads (up to 16, 0 = auto, <0 = leave that many cores free, default: 0)") + "\n";
+    strUsage += "  -par=<n>               " + _("Set the number of script and proof-of-work verification threads (up to 16, 0 = auto, <0 = leave that many cores free, default: 0)") + "\n";
+    strUsage += "  -dbprefetch=<n>        " + _("Set the number of threads reading block inputs from the coin database ahead of validation (up to 16, 0 = disable, default: 4)") + "\n";
     strUsage += "  -algo=<algo>           " + _("Mining algorithm: sha256d, scrypt, groestl") + "\n";
     strUsage += "\n" + _("Block creation options:") + "\n";
     strUsage += "  -blockminsize=<n>      "   + _("Set minimum block size in bytes (default: 0)") + "\n";
@@ -445,6 +454,17 @@ bool AppInit2(boost::thread_group& threadGroup)
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    nMappedBlockFiles = std::max((int)GetArg("-mapblockfiles", nMappedBlockFiles), 0);
+    nBlockCacheSize = std::max(GetArg("-blockcache", nBlockCacheSize >> 20), (int64)0) << 20;
+    nSyncInterval = std::max(GetArg("-syncinterval", nSyncInterval), (int64)0);
+
+    // The validating thread takes part in the lookups, so 1 is no concurrency either
+    nCoinsFetchThreads = GetArg("-dbprefetch", 4);
+    if (nCoinsFetchThreads <= 1)
+        nCoinsFetchThreads = 0;
+    else if (nCoinsFetchThreads > MAX_COINSFETCH_THREADS)
+        nCoinsFetchThreads = MAX_COINSFETCH_THREADS;
+
     // -debug implies fDebug*
     if (fDebug)
         fDebugNet = true;
@@ -535,6 +555,8 @@ bool AppInit2(boost::thread_group& threadGroup)
     printf("Default data directory %s\n", GetDefaultDataDir().string().c_str());
     printf("Using data directory %s\n", strDataDir.c_str());
     printf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
+    sha256_detect();
+    scrypt_detect();
     std::ostringstream strErrors;
 
     if (fDaemon)
@@ -544,6 +566,14 @@ bool AppInit2(boost::thread_group& threadGroup)
         printf("Using %u threads for script verification\n", nScriptCheckThreads);
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadPoWCheck);
+    }
+
+    if (nCoinsFetchThreads) {
+        printf("Using %u threads for coin database prefetch\n", nCoinsFetchThreads);
+        for (int i=0; i<nCoinsFetchThreads-1; i++)
+            threadGroup.create_thread(&ThreadCoinsFetch);
     }
 
     int64 nStart;
@@ -735,7 +765,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     nTotalCache -= nBlockTreeDBCache;
     size_t nCoinDBCache = nTotalCache / 2; // use half of the remaining cache for coindb cache
     nTotalCache -= nCoinDBCache;
-    nCoinCacheSize = nTotalCache / 300; // coins in memory require around 300 bytes
+    nCoinCacheUsage = nTotalCache; // the rest is for the in-memory coins cache
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -749,12 +779,14 @@ bool AppInit2(boost::thread_group& threadGroup)
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
+                delete pcoinsflush;
                 delete pcoinsdbview;
                 delete pblocktree;
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
-                pcoinsTip = new CCoinsViewCache(*pcoinsdbview);
+                pcoinsflush = new CCoinsViewAsyncFlush(*pcoinsdbview);
+                pcoinsTip = new CCoinsViewCache(*pcoinsflush);
 
                 if (fReindex)
                     pblocktree->WriteReindexing(true);
@@ -834,7 +866,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     {
         string strMatch = mapArgs["-printblock"];
         int nFound = 0;
-        for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+        for (BlockMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
         {
             uint256 hash = (*mi).first;
             if (strncmp(hash.ToString().c_str(), strMatch.c_str(), strMatch.size()) == 0)
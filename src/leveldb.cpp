@@ -11,6 +11,7 @@
 #include <memenv/memenv.h>
 
 #include <boost/filesystem.hpp>
+#include <boost/thread/tss.hpp>
 
 void HandleError(const leveldb::Status &status) throw(leveldb_error) {
     if (status.ok())
@@ -24,23 +25,73 @@ void HandleError(const leveldb::Status &status) throw(leveldb_error) {
     throw leveldb_error("Unknown database error");
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize) {
+static boost::thread_specific_ptr<CLevelDBReadBuffer> readBuffer;
+
+CLevelDBReadBuffer &GetLevelDBReadBuffer() {
+    if (readBuffer.get() == NULL)
+        readBuffer.reset(new CLevelDBReadBuffer());
+    return *readBuffer;
+}
+
+CLevelDBOptions CLevelDBOptions::Chainstate(size_t nCacheSize) {
+    CLevelDBOptions dbopts;
+    dbopts.nBlockCache = nCacheSize / 2;
+    dbopts.nWriteBuffer = nCacheSize / 4;
+    dbopts.nBloomBits = 10;
+    dbopts.nBlockSize = 4096;
+    dbopts.nMaxOpenFiles = 64;
+    dbopts.fCompression = false;
+    return dbopts;
+}
+
+CLevelDBOptions CLevelDBOptions::BlockIndex(size_t nCacheSize) {
+    CLevelDBOptions dbopts;
+    dbopts.nBlockCache = nCacheSize / 4;
+    dbopts.nWriteBuffer = nCacheSize * 3 / 8;
+    dbopts.nBloomBits = 10;
+    dbopts.nBlockSize = 16384;
+    dbopts.nMaxOpenFiles = 64;
+    dbopts.fCompression = false;
+    return dbopts;
+}
+
+void CLevelDBOptions::ApplyArgs(const std::string &strPrefix) {
+    std::string strArg = "-" + strPrefix;
+    if (mapArgs.count(strArg + "blockcache"))
+        nBlockCache = std::max(GetArg(strArg + "blockcache", 0), (int64)0) << 20;
+    if (mapArgs.count(strArg + "writebuffer"))
+        nWriteBuffer = std::max(GetArg(strArg + "writebuffer", 0), (int64)1) << 20;
+    if (mapArgs.count(strArg + "blocksize"))
+        nBlockSize = std::max(GetArg(strArg + "blocksize", 0), (int64)1) << 10;
+    nBloomBits = GetArg(strArg + "bloombits", nBloomBits);
+    nMaxOpenFiles = GetArg(strArg + "maxfiles", nMaxOpenFiles);
+    fCompression = GetBoolArg(strArg + "compression", fCompression);
+}
+
+std::string CLevelDBOptions::ToString() const {
+    return strprintf("block cache %.1fMiB, write buffer %.1fMiB, %d bloom bits, %ukiB blocks, %d files, %s",
+                     nBlockCache / 1048576.0, nWriteBuffer / 1048576.0, nBloomBits, (unsigned int)(nBlockSize >> 10),
+                     nMaxOpenFiles, fCompression ? "compressed" : "uncompressed");
+}
+
+static leveldb::Options GetOptions(const CLevelDBOptions &dbopts) {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.block_cache = leveldb::NewLRUCache(dbopts.nBlockCache);
+    options.write_buffer_size = dbopts.nWriteBuffer;
+    options.filter_policy = dbopts.nBloomBits > 0 ? leveldb::NewBloomFilterPolicy(dbopts.nBloomBits) : NULL;
+    options.block_size = dbopts.nBlockSize;
+    options.compression = dbopts.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.max_open_files = dbopts.nMaxOpenFiles;
     return options;
 }
 
-CLevelDB::CLevelDB(const boost::filesystem::path &path, size_t nCacheSize, bool fMemory, bool fWipe) {
+CLevelDB::CLevelDB(const boost::filesystem::path &path, const CLevelDBOptions &dboptsIn, bool fMemory, bool fWipe) : dbopts(dboptsIn) {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(dbopts);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -51,7 +102,7 @@ CLevelDB::CLevelDB(const boost::filesystem::path &path, size_t nCacheSize, bool
             leveldb::DestroyDB(path.string(), options);
         }
         boost::filesystem::create_directory(path);
-        printf("Opening LevelDB in %s\n", path.string().c_str());
+        printf("Opening LevelDB in %s (%s)\n", path.string().c_str(), dbopts.ToString().c_str());
     }
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     if (!status.ok())
@@ -19,6 +19,33 @@ public:
 
 void HandleError(const leveldb::Status &status) throw(leveldb_error);
 
+/** Tuning of a CLevelDB for the way it is accessed */
+struct CLevelDBOptions
+{
+    size_t nBlockCache;  // bytes of table blocks kept in memory
+    size_t nWriteBuffer; // memtable size; up to two may be in memory at once
+    int nBloomBits;      // bloom filter bits per key, 0 for none
+    size_t nBlockSize;   // approximate bytes of keys and values per table block
+    int nMaxOpenFiles;
+    bool fCompression;   // snappy, if LevelDB was built with it
+
+    // chainstate/: random point reads of single coins. Most of the cache
+    // goes to table blocks, kept small so a read fetches little else.
+    static CLevelDBOptions Chainstate(size_t nCacheSize);
+
+    // blocks/index/: appended to as blocks arrive and read in full once at
+    // startup. Larger write buffers and blocks; point reads are rare
+    // unless -txindex is on.
+    static CLevelDBOptions BlockIndex(size_t nCacheSize);
+
+    // Overrides from -<prefix>blockcache, -<prefix>writebuffer (MiB),
+    // -<prefix>bloombits, -<prefix>blocksize (KiB), -<prefix>maxfiles and
+    // -<prefix>compression
+    void ApplyArgs(const std::string &strPrefix);
+
+    std::string ToString() const;
+};
+
 // Batch of changes queued to be written to a CLevelDB
 class CLevelDBBatch
 {
@@ -27,34 +54,49 @@ class CLevelDBBatch
 private:
     leveldb::WriteBatch batch;
 
+    // serialization buffers reused for every record of the batch
+    std::vector<char> vchKey;
+    std::vector<char> vchValue;
+
 public:
     template<typename K, typename V> void Write(const K& key, const V& value) {
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        ssKey.reserve(ssKey.GetSerializeSize(key));
+        CBufferWriter ssKey(vchKey, SER_DISK, CLIENT_VERSION);
         ssKey << key;
-        leveldb::Slice slKey(&ssKey[0], ssKey.size());
+        leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
-        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-        ssValue.reserve(ssValue.GetSerializeSize(value));
+        CBufferWriter ssValue(vchValue, SER_DISK, CLIENT_VERSION);
         ssValue << value;
-        leveldb::Slice slValue(&ssValue[0], ssValue.size());
+        leveldb::Slice slValue(ssValue.data(), ssValue.size());
 
+        // the batch keeps its own copy of both
         batch.Put(slKey, slValue);
     }
 
     template<typename K> void Erase(const K& key) {
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        ssKey.reserve(ssKey.GetSerializeSize(key));
+        CBufferWriter ssKey(vchKey, SER_DISK, CLIENT_VERSION);
         ssKey << key;
-        leveldb::Slice slKey(&ssKey[0], ssKey.size());
+        leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
         batch.Delete(slKey);
     }
 };
 
+// Serialization buffers for reads. Reads may come from several threads at
+// once, so each thread gets its own set.
+struct CLevelDBReadBuffer
+{
+    std::vector<char> vchKey;
+    std::string strValue;
+};
+
+CLevelDBReadBuffer &GetLevelDBReadBuffer();
+
 class CLevelDB
 {
 private:
+    // tuning this database was opened with
+    CLevelDBOptions dbopts;
+
     // custom environment this database is using (may be NULL in case of default environment)
     leveldb::Env *penv;
 
@@ -77,17 +119,36 @@ private:
     leveldb::DB *pdb;
 
 public:
-    CLevelDB(const boost::filesystem::path &path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CLevelDB(const boost::filesystem::path &path, const CLevelDBOptions &dboptsIn, bool fMemory = false, bool fWipe = false);
     ~CLevelDB();
 
-    template<typename K, typename V> bool Read(const K& key, V& value) throw(leveldb_error) {
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        ssKey.reserve(ssKey.GetSerializeSize(key));
+    const CLevelDBOptions &GetDBOptions() const {
+        return dbopts;
+    }
+
+    // LevelDB internals such as "leveldb.stats", see leveldb::DB::GetProperty
+    bool GetProperty(const std::string &strName, std::string &strValue) {
+        return pdb->GetProperty(strName, &strValue);
+    }
+
+    // approximate bytes on disk used by the keys in [strBegin, strEnd)
+    uint64 GetApproximateSize(const std::string &strBegin, const std::string &strEnd) {
+        leveldb::Range range(strBegin, strEnd);
+        uint64_t nSize = 0;
+        pdb->GetApproximateSizes(&range, 1, &nSize);
+        return nSize;
+    }
+
+    // reads the current state, or the given snapshot if not NULL
+    template<typename K, typename V> bool Read(const K& key, V& value, const leveldb::Snapshot *snapshot = NULL) throw(leveldb_error) {
+        CLevelDBReadBuffer &buf = GetLevelDBReadBuffer();
+        CBufferWriter ssKey(buf.vchKey, SER_DISK, CLIENT_VERSION);
         ssKey << key;
-        leveldb::Slice slKey(&ssKey[0], ssKey.size());
+        leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
-        std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        leveldb::ReadOptions options = readoptions;
+        options.snapshot = snapshot;
+        leveldb::Status status = pdb->Get(options, slKey, &buf.strValue);
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
@@ -95,7 +156,7 @@ public:
             HandleError(status);
         }
         try {
-            CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+            CBufferReader ssValue(buf.strValue.data(), buf.strValue.data() + buf.strValue.size(), SER_DISK, CLIENT_VERSION);
             ssValue >> value;
         } catch(std::exception &e) {
             return false;
@@ -110,13 +171,12 @@ public:
     }
 
     template<typename K> bool Exists(const K& key) throw(leveldb_error) {
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        ssKey.reserve(ssKey.GetSerializeSize(key));
+        CLevelDBReadBuffer &buf = GetLevelDBReadBuffer();
+        CBufferWriter ssKey(buf.vchKey, SER_DISK, CLIENT_VERSION);
         ssKey << key;
-        leveldb::Slice slKey(&ssKey[0], ssKey.size());
+        leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
-        std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        leveldb::Status status = pdb->Get(readoptions, slKey, &buf.strValue);
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
@@ -145,8 +205,20 @@ public:
     }
 
     // not exactly clean encapsulation, but it's easiest for now
-    leveldb::Iterator *NewIterator() {
-        return pdb->NewIterator(iteroptions);
+    leveldb::Iterator *NewIterator(const leveldb::Snapshot *snapshot = NULL) {
+        leveldb::ReadOptions options = iteroptions;
+        options.snapshot = snapshot;
+        return pdb->NewIterator(options);
+    }
+
+    // consistent read-only view of the database as it is now, unaffected by
+    // later writes; must be released with ReleaseSnapshot
+    const leveldb::Snapshot *GetSnapshot() {
+        return pdb->GetSnapshot();
+    }
+
+    void ReleaseSnapshot(const leveldb::Snapshot *snapshot) {
+        pdb->ReleaseSnapshot(snapshot);
     }
 };
 
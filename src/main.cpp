@@ -15,12 +15,16 @@
 #include "ui_interface.h"
 #include "checkqueue.h"
 #include "chainparams.h"
+#include "arith_uint256.h"
+#include "powhash.h"
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/random/mersenne_twister.hpp>
 #include <boost/random/uniform_int_distribution.hpp>
 #include "scrypt.h"
+#include "sha256.h"
 
 using namespace std;
 using namespace boost;
@@ -37,7 +41,8 @@ CCriticalSection cs_main;
 CTxMemPool mempool;
 unsigned int nTransactionsUpdated = 0;
 
-map<uint256, CBlockIndex*> mapBlockIndex;
+BlockMap mapBlockIndex;
+static CBlockIndexArena blockIndexArena;
 std::vector<CBlockIndex*> vBlockIndexByHeight;
 CBlockIndex* pindexGenesisBlock = NULL;
 int nBestHeight = -1;
@@ -48,11 +53,12 @@ CBlockIndex* pindexBest = NULL;
 set<CBlockIndex*, CBlockIndexWorkComparator> setBlockIndexValid; // may contain all CBlockIndex*'s that have validness >=BLOCK_VALID_TRANSACTIONS, and must contain those who aren't failed
 int64 nTimeBestReceived = 0;
 int nScriptCheckThreads = 0;
+int nCoinsFetchThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fBenchmark = false;
 bool fTxIndex = false;
-unsigned int nCoinCacheSize = 5000;
+size_t nCoinCacheUsage = 5000 * 300;
 bool fHaveGUI = false;
 
 /** Fees smaller than this (in satoshi) are considered zero fee (for transaction creation) */
@@ -203,7 +209,7 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals)
 
 CBlockLocator::CBlockLocator(uint256 hashBlock)
 {
-    std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi != mapBlockIndex.end())
         Set((*mi).second);
 }
@@ -215,14 +221,16 @@ void CBlockLocator::Set(const CBlockIndex* pindex)
     while (pindex)
     {
         vHave.push_back(pindex->GetBlockHash());
+        if (pindex->nHeight == 0)
+            break;
 
         // Exponentially larger steps back
-        for (int i = 0; pindex && i < nStep; i++)
-            pindex = pindex->pprev;
+        pindex = pindex->GetAncestor(std::max(pindex->nHeight - nStep, 0));
         if (vHave.size() > 10)
             nStep *= 2;
     }
-    vHave.push_back(Params().HashGenesisBlock());
+    if (vHave.empty() || vHave.back() != Params().HashGenesisBlock())
+        vHave.push_back(Params().HashGenesisBlock());
 }
 
 int CBlockLocator::GetDistanceBack()
@@ -232,7 +240,7 @@ int CBlockLocator::GetDistanceBack()
     int nStep = 1;
     BOOST_FOREACH(const uint256& hash, vHave)
     {
-        std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
         if (mi != mapBlockIndex.end())
         {
             CBlockIndex* pindex = (*mi).second;
@@ -251,7 +259,7 @@ CBlockIndex *CBlockLocator::GetBlockIndex()
     // Find the first block the caller has in the main chain
     BOOST_FOREACH(const uint256& hash, vHave)
     {
-        std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
         if (mi != mapBlockIndex.end())
         {
             CBlockIndex* pindex = (*mi).second;
@@ -267,7 +275,7 @@ uint256 CBlockLocator::GetBlockHash()
     // Find the first block the caller has in the main chain
     BOOST_FOREACH(const uint256& hash, vHave)
     {
-        std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
         if (mi != mapBlockIndex.end())
         {
             CBlockIndex* pindex = (*mi).second;
@@ -296,7 +304,7 @@ bool CCoinsView::SetCoins(const uint256 &txid, const CCoins &coins) { return fal
 bool CCoinsView::HaveCoins(const uint256 &txid) { return false; }
 CBlockIndex *CCoinsView::GetBestBlock() { return NULL; }
 bool CCoinsView::SetBestBlock(CBlockIndex *pindex) { return false; }
-bool CCoinsView::BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex) { return false; }
+bool CCoinsView::BatchWrite(const CCoinsMap &mapCoins, CBlockIndex *pindex) { return false; }
 bool CCoinsView::GetStats(CCoinsStats &stats) { return false; }
 
 
@@ -307,43 +315,105 @@ bool CCoinsViewBacked::HaveCoins(const uint256 &txid) { return base->HaveCoins(t
 CBlockIndex *CCoinsViewBacked::GetBestBlock() { return base->GetBestBlock(); }
 bool CCoinsViewBacked::SetBestBlock(CBlockIndex *pindex) { return base->SetBestBlock(pindex); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
-bool CCoinsViewBacked::BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex) { return base->BatchWrite(mapCoins, pindex); }
+bool CCoinsViewBacked::BatchWrite(const CCoinsMap &mapCoins, CBlockIndex *pindex) { return base->BatchWrite(mapCoins, pindex); }
 bool CCoinsViewBacked::GetStats(CCoinsStats &stats) { return base->GetStats(stats); }
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView &baseIn, bool fDummy) : CCoinsViewBacked(baseIn), pindexTip(NULL) { }
+CCoinsKeyHasher::CCoinsKeyHasher()
+{
+    k0 = GetRand(std::numeric_limits<uint64>::max());
+    k1 = GetRand(std::numeric_limits<uint64>::max());
+}
+
+CCoinsViewCache::CCoinsViewCache(CCoinsView &baseIn, bool fDummy) : CCoinsViewBacked(baseIn), pindexTip(NULL), fHasModifier(false), nCachedCoinsUsage(0), nHits(0), nMisses(0), nFlushes(0) { }
+
+CCoinsViewCache::~CCoinsViewCache() {
+    assert(!fHasModifier);
+}
+
+size_t CCoinsViewCache::DynamicMemoryUsage() const {
+    return memusage::DynamicUsage(cacheCoins) + nCachedCoinsUsage;
+}
 
 bool CCoinsViewCache::GetCoins(const uint256 &txid, CCoins &coins) {
-    if (cacheCoins.count(txid)) {
-        coins = cacheCoins[txid];
-        return true;
-    }
-    if (base->GetCoins(txid, coins)) {
-        cacheCoins[txid] = coins;
-        return true;
-    }
-    return false;
+    CCoinsMap::iterator it = FetchCoins(txid);
+    if (it == cacheCoins.end())
+        return false;
+    coins = it->second.coins;
+    return true;
 }
 
-std::map<uint256,CCoins>::iterator CCoinsViewCache::FetchCoins(const uint256 &txid) {
-    std::map<uint256,CCoins>::iterator it = cacheCoins.lower_bound(txid);
-    if (it != cacheCoins.end() && it->first == txid)
+CCoinsMap::iterator CCoinsViewCache::FetchCoins(const uint256 &txid) {
+    CCoinsMap::iterator it = cacheCoins.find(txid);
+    if (it != cacheCoins.end()) {
+        nHits++;
         return it;
+    }
+    nMisses++;
     CCoins tmp;
     if (!base->GetCoins(txid,tmp))
         return cacheCoins.end();
-    std::map<uint256,CCoins>::iterator ret = cacheCoins.insert(it, std::make_pair(txid, CCoins()));
-    tmp.swap(ret->second);
+    CCoinsMap::iterator ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry())).first;
+    tmp.swap(ret->second.coins);
+    if (ret->second.coins.IsPruned()) {
+        // The parent only has an empty entry for this txid; we can consider
+        // our version as fresh.
+        ret->second.flags = CCoinsCacheEntry::FRESH;
+    }
+    nCachedCoinsUsage += ret->second.coins.DynamicMemoryUsage();
     return ret;
 }
 
-CCoins &CCoinsViewCache::GetCoins(const uint256 &txid) {
-    std::map<uint256,CCoins>::iterator it = FetchCoins(txid);
+const CCoins &CCoinsViewCache::GetCoins(const uint256 &txid) {
+    CCoinsMap::iterator it = FetchCoins(txid);
     assert(it != cacheCoins.end());
-    return it->second;
+    return it->second.coins;
+}
+
+CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
+    assert(!fHasModifier);
+    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
+    size_t nUsage = 0;
+    if (ret.second) {
+        nMisses++;
+        if (!base->GetCoins(txid, ret.first->second.coins)) {
+            // The parent view does not have this entry; mark it as fresh.
+            ret.first->second.coins = CCoins();
+            ret.first->second.flags = CCoinsCacheEntry::FRESH;
+        } else if (ret.first->second.coins.IsPruned()) {
+            // The parent view only has a pruned entry for this; mark it as fresh.
+            ret.first->second.flags = CCoinsCacheEntry::FRESH;
+        }
+    } else {
+        nHits++;
+        nUsage = ret.first->second.coins.DynamicMemoryUsage();
+    }
+    // Assume that whenever ModifyCoins is called, the entry will be modified.
+    ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
+    return CCoinsModifier(*this, ret.first, nUsage);
+}
+
+CCoinsModifier CCoinsViewCache::ModifyNewCoins(const uint256 &txid) {
+    assert(!fHasModifier);
+    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
+    size_t nUsage = 0;
+    if (ret.second) {
+        // The base has at most a pruned entry, which this one can replace
+        // without being written if it is spent again in this view.
+        ret.first->second.flags = CCoinsCacheEntry::FRESH;
+    } else {
+        nUsage = ret.first->second.coins.DynamicMemoryUsage();
+    }
+    ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
+    return CCoinsModifier(*this, ret.first, nUsage);
 }
 
 bool CCoinsViewCache::SetCoins(const uint256 &txid, const CCoins &coins) {
-    cacheCoins[txid] = coins;
+    assert(!fHasModifier);
+    CCoinsCacheEntry &entry = cacheCoins[txid];
+    nCachedCoinsUsage -= entry.coins.DynamicMemoryUsage();
+    entry.coins = coins;
+    entry.flags |= CCoinsCacheEntry::DIRTY;
+    nCachedCoinsUsage += entry.coins.DynamicMemoryUsage();
     return true;
 }
 
@@ -362,24 +432,95 @@ bool CCoinsViewCache::SetBestBlock(CBlockIndex *pindex) {
     return true;
 }
 
-bool CCoinsViewCache::BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex) {
-    for (std::map<uint256, CCoins>::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++)
-        cacheCoins[it->first] = it->second;
+bool CCoinsViewCache::BatchWrite(const CCoinsMap &mapCoins, CBlockIndex *pindex) {
+    assert(!fHasModifier);
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY))
+            continue; // Ignore non-dirty entries (optimization).
+        CCoinsMap::iterator itUs = cacheCoins.find(it->first);
+        if (itUs == cacheCoins.end()) {
+            // The child's entry was created and spent without ever existing
+            // in this view; there is nothing to record.
+            if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned())
+                continue;
+            CCoinsCacheEntry &entry = cacheCoins[it->first];
+            entry.coins = it->second.coins;
+            entry.flags = CCoinsCacheEntry::DIRTY | (it->second.flags & CCoinsCacheEntry::FRESH);
+            nCachedCoinsUsage += entry.coins.DynamicMemoryUsage();
+        } else if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
+            // Our base does not have it either, so forget it entirely.
+            nCachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
+            cacheCoins.erase(itUs);
+        } else {
+            nCachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
+            itUs->second.coins = it->second.coins;
+            itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+            nCachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
+        }
+    }
     pindexTip = pindex;
     return true;
 }
 
 bool CCoinsViewCache::Flush() {
+    assert(!fHasModifier);
     bool fOk = base->BatchWrite(cacheCoins, pindexTip);
-    if (fOk)
-        cacheCoins.clear();
-    return fOk;
+    if (!fOk)
+        return false;
+    nFlushes++;
+    // Everything left now matches the base: keep the unspent entries as a
+    // read cache and drop the spent ones.
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); ) {
+        if (it->second.coins.IsPruned()) {
+            nCachedCoinsUsage -= it->second.coins.DynamicMemoryUsage();
+            it = cacheCoins.erase(it);
+        } else {
+            it->second.flags = 0;
+            it++;
+        }
+    }
+    return true;
+}
+
+void CCoinsViewCache::Trim(size_t nMaxUsage) {
+    assert(!fHasModifier);
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end() && DynamicMemoryUsage() > nMaxUsage; ) {
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
+            nCachedCoinsUsage -= it->second.coins.DynamicMemoryUsage();
+            it = cacheCoins.erase(it);
+        } else
+            it++;
+    }
 }
 
 unsigned int CCoinsViewCache::GetCacheSize() {
     return cacheCoins.size();
 }
 
+CCoinsModifier::CCoinsModifier(CCoinsViewCache& cacheIn, CCoinsMap::iterator itIn, size_t nUsage) : cache(cacheIn), it(itIn), nUsageBefore(nUsage), fActive(true) {
+    assert(!cache.fHasModifier);
+    cache.fHasModifier = true;
+}
+
+CCoinsModifier::CCoinsModifier(const CCoinsModifier& other) : cache(other.cache), it(other.it), nUsageBefore(other.nUsageBefore), fActive(other.fActive) {
+    other.fActive = false;
+}
+
+CCoinsModifier::~CCoinsModifier() {
+    if (!fActive)
+        return;
+    assert(cache.fHasModifier);
+    cache.fHasModifier = false;
+    it->second.coins.Cleanup();
+    cache.nCachedCoinsUsage -= nUsageBefore;
+    if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
+        // Created and spent within this view; the parent never needs to know.
+        cache.cacheCoins.erase(it);
+    } else {
+        cache.nCachedCoinsUsage += it->second.coins.DynamicMemoryUsage();
+    }
+}
+
 /** CCoinsView that brings transactions from a memorypool into view.
     It does not check for spendings by memory pool transactions. */
 CCoinsViewMemPool::CCoinsViewMemPool(CCoinsView &baseIn, CTxMemPool &mempoolIn) : CCoinsViewBacked(baseIn), mempool(mempoolIn) { }
@@ -399,8 +540,147 @@ bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) {
     return mempool.exists(txid) || base->HaveCoins(txid);
 }
 
+CCoinsViewAsyncFlush::CCoinsViewAsyncFlush(CCoinsView &baseIn) : CCoinsViewBacked(baseIn), pindexPending(NULL), nPendingUsage(0), fPending(false), fFailed(false), fStop(false),
+    threadWriter(boost::bind(&CCoinsViewAsyncFlush::ThreadWriter, this)) { }
+
+CCoinsViewAsyncFlush::~CCoinsViewAsyncFlush() {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+        cond.notify_all();
+    }
+    // The writer finishes the batch in flight before it exits
+    threadWriter.join();
+}
+
+void CCoinsViewAsyncFlush::ThreadWriter() {
+    RenameThread("bitcoin-coinsflush");
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!fPending && !fStop)
+                cond.wait(lock);
+            if (!fPending)
+                return;
+        }
+        // mapPending is not modified while fPending is set, so it can be
+        // read here and by GetCoins without holding the lock
+        int64 nStart = GetTimeMicros();
+        bool fOk = base->BatchWrite(mapPending, pindexPending);
+        if (fBenchmark)
+            printf("- Background coins write of %u entries: %.2fms\n", (unsigned int)mapPending.size(), 0.001 * (GetTimeMicros() - nStart));
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            mapPending.clear();
+            nPendingUsage = 0;
+            fPending = false;
+            if (!fOk)
+                fFailed = true;
+            cond.notify_all();
+        }
+        if (!fOk)
+            AbortNode(_("Failed to write to coin database"));
+    }
+}
+
+bool CCoinsViewAsyncFlush::Sync() {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (fPending)
+        cond.wait(lock);
+    return !fFailed;
+}
+
+bool CCoinsViewAsyncFlush::GetCoins(const uint256 &txid, CCoins &coins) {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (fPending) {
+            CCoinsMap::const_iterator it = mapPending.find(txid);
+            if (it != mapPending.end()) {
+                // A pruned entry is about to be erased from the base
+                if (it->second.coins.IsPruned())
+                    return false;
+                coins = it->second.coins;
+                return true;
+            }
+        }
+    }
+    // Not part of the batch in flight, so the base is up to date for it
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewAsyncFlush::HaveCoins(const uint256 &txid) {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (fPending) {
+            CCoinsMap::const_iterator it = mapPending.find(txid);
+            if (it != mapPending.end())
+                return !it->second.coins.IsPruned();
+        }
+    }
+    return base->HaveCoins(txid);
+}
+
+CBlockIndex *CCoinsViewAsyncFlush::GetBestBlock() {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (fPending && pindexPending)
+            return pindexPending;
+    }
+    return base->GetBestBlock();
+}
+
+bool CCoinsViewAsyncFlush::SetBestBlock(CBlockIndex *pindex) {
+    if (!Sync())
+        return false;
+    return base->SetBestBlock(pindex);
+}
+
+bool CCoinsViewAsyncFlush::BatchWrite(const CCoinsMap &mapCoins, CBlockIndex *pindex) {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    // Only one batch can be in flight; wait for the previous one
+    while (fPending)
+        cond.wait(lock);
+    if (fFailed)
+        return false;
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY))
+            continue;
+        // Created and spent since the last flush: the base never had it
+        if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned())
+            continue;
+        mapPending.insert(*it);
+        nPendingUsage += it->second.coins.DynamicMemoryUsage();
+    }
+    nPendingUsage += memusage::DynamicUsage(mapPending);
+    pindexPending = pindex;
+    fPending = true;
+    cond.notify_all();
+    return true;
+}
+
+size_t CCoinsViewAsyncFlush::DynamicMemoryUsage() {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return nPendingUsage;
+}
+
+bool CCoinsViewAsyncFlush::GetStats(CCoinsStats &stats) {
+    if (!Sync())
+        return false;
+    return base->GetStats(stats);
+}
+
 CCoinsViewCache *pcoinsTip = NULL;
 CBlockTreeDB *pblocktree = NULL;
+CCoinsViewDB *pcoinsdbview = NULL;
+CCoinsViewAsyncFlush *pcoinsflush = NULL;
+
+size_t GetCoinsCacheUsage()
+{
+    size_t nUsage = pcoinsTip->DynamicMemoryUsage();
+    if (pcoinsflush)
+        nUsage += pcoinsflush->DynamicMemoryUsage();
+    return nUsage;
+}
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -692,7 +972,7 @@ int CMerkleTx::SetMerkleBranch(const CBlock* pblock)
     }
 
     // Is the tx in a block that's in the main chain
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -1048,7 +1328,7 @@ int CMerkleTx::GetDepthInMainChain(CBlockIndex* &pindexRet) const
         return 0;
 
     // Find the block it claims to be in
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -1185,36 +1465,233 @@ CBlockIndex* FindBlockByHeight(int nHeight)
     return vBlockIndexByHeight[nHeight];
 }
 
-bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos)
+/** Turn the lowest '1' bit in the binary representation of a number into a '0'. */
+int static inline InvertLowestOne(int n) { return n & (n - 1); }
+
+/** Compute what height to jump back to with the CBlockIndex::pskip pointer. */
+int static inline GetSkipHeight(int height) {
+    if (height < 2)
+        return 0;
+
+    // Determine which height to jump back to. Any number strictly lower than height is acceptable,
+    // but the following expression seems to perform well in simulations (max 110 steps to go back
+    // up to 2**18 blocks).
+    return (height & 1) ? InvertLowestOne(InvertLowestOne(height - 1)) + 1 : InvertLowestOne(height);
+}
+
+CBlockIndex* CBlockIndex::GetAncestor(int height)
+{
+    if (height > nHeight || height < 0)
+        return NULL;
+
+    CBlockIndex* pindexWalk = this;
+    int heightWalk = nHeight;
+    while (heightWalk > height) {
+        int heightSkip = GetSkipHeight(heightWalk);
+        int heightSkipPrev = GetSkipHeight(heightWalk - 1);
+        if (pindexWalk->pskip != NULL &&
+            (heightSkip == height ||
+             (heightSkip > height && !(heightSkipPrev < heightSkip - 2 &&
+                                       heightSkipPrev >= height)))) {
+            // Only follow pskip if pprev->pskip isn't better than pskip->pprev.
+            pindexWalk = pindexWalk->pskip;
+            heightWalk = heightSkip;
+        } else {
+            pindexWalk = pindexWalk->pprev;
+            heightWalk--;
+        }
+    }
+    return pindexWalk;
+}
+
+const CBlockIndex* CBlockIndex::GetAncestor(int height) const
 {
-    // Open history file to append
-    CAutoFile fileout = CAutoFile(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
-    if (!fileout)
-        return error("WriteBlockToDisk() : OpenBlockFile failed");
+    return const_cast<CBlockIndex*>(this)->GetAncestor(height);
+}
 
-    // Write index header
-    unsigned int nSize = fileout.GetSerializeSize(block);
-    fileout << FLATDATA(Params().MessageStart()) << nSize;
+void CBlockIndex::BuildSkip()
+{
+    if (pprev)
+        pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
+}
 
-    // Write block
-    long fileOutPos = ftell(fileout);
-    if (fileOutPos < 0)
-        return error("WriteBlockToDisk() : ftell failed");
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
+CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb)
+{
+    if (pa->nHeight > pb->nHeight)
+        pa = pa->GetAncestor(pb->nHeight);
+    else if (pb->nHeight > pa->nHeight)
+        pb = pb->GetAncestor(pa->nHeight);
 
-    // Flush stdio buffers and commit to disk before returning
-    fflush(fileout);
-    if (!IsInitialBlockDownload())
-        FileCommit(fileout);
+    while (pa != pb && pa && pb) {
+        pa = pa->pprev;
+        pb = pb->pprev;
+    }
 
+    // Eventually all chain branches meet at the genesis block.
+    assert(pa == pb);
+    return pa;
+}
+
+/** Keeps the block or undo file being appended to open. Each record is
+ *  serialized into a reused buffer and handed to the OS in one write, so it
+ *  is visible to readers and survives a crash of this process, but nothing
+ *  is synced until Commit. One fsync then covers every block written since
+ *  the last one. Protected by cs_LastBlockFile. */
+class CBlockFileWriter
+{
+private:
+    FILE* (*pOpenFile)(const CDiskBlockPos &pos, bool fReadOnly);
+    FILE *file;
+    int nFile;
+    unsigned int nPos; // where the next write goes without seeking
+    bool fDirty;       // written to since the last commit
+    std::vector<char> vchBuf;
+
+    bool Open(const CDiskBlockPos &pos) {
+        if (file != NULL && nFile == pos.nFile) {
+            if (nPos != pos.nPos && fseek(file, pos.nPos, SEEK_SET))
+                return false;
+        } else {
+            Close();
+            file = pOpenFile(pos, false);
+            if (file == NULL)
+                return false;
+            nFile = pos.nFile;
+        }
+        nPos = pos.nPos;
+        return true;
+    }
+
+    void Close() {
+        if (file == NULL)
+            return;
+        Commit();
+        fclose(file);
+        file = NULL;
+    }
+
+public:
+    CBlockFileWriter(FILE* (*pOpenFileIn)(const CDiskBlockPos &pos, bool fReadOnly)) :
+        pOpenFile(pOpenFileIn), file(NULL), nFile(-1), nPos(0), fDirty(false) {}
+    ~CBlockFileWriter() { Close(); }
+
+    // Appends the network magic, the size of obj, obj and, if given, a
+    // checksum at pos. Moves pos.nPos past the magic and size, to where
+    // obj starts.
+    template<typename T>
+    bool WriteRecord(CDiskBlockPos &pos, const T &obj, const uint256 *phashChecksum = NULL) {
+        CBufferWriter ss(vchBuf, SER_DISK, CLIENT_VERSION);
+        unsigned int nSize = ::GetSerializeSize(obj, SER_DISK, CLIENT_VERSION);
+        ss << FLATDATA(Params().MessageStart()) << nSize << obj;
+        if (phashChecksum)
+            ss << *phashChecksum;
+        if (!Open(pos))
+            return false;
+        if (fwrite(ss.data(), 1, ss.size(), file) != ss.size() || fflush(file) != 0) {
+            nPos = (unsigned int)-1;
+            return false;
+        }
+        nPos += ss.size();
+        fDirty = true;
+        pos.nPos += sizeof(Params().MessageStart()) + sizeof(nSize);
+        return true;
+    }
+
+    // Reserves nLength bytes on disk from pos on, through the open file
+    void Allocate(const CDiskBlockPos &pos, unsigned int nLength) {
+        if (!Open(pos))
+            return;
+        AllocateFileRange(file, pos.nPos, nLength);
+        nPos = (unsigned int)-1; // some implementations write or seek
+    }
+
+    void Commit() {
+        if (file != NULL && fDirty)
+            FileCommit(file);
+        fDirty = false;
+    }
+};
+
+static CBlockFileWriter blockfilewriter(&OpenBlockFile);
+static CBlockFileWriter undofilewriter(&OpenUndoFile);
+
+bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos)
+{
+    LOCK(cs_LastBlockFile);
+    if (!blockfilewriter.WriteRecord(pos, block))
+        return error("WriteBlockToDisk() : write to blk%05u.dat failed", pos.nFile);
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+bool CBlockUndo::WriteToDisk(CDiskBlockPos &pos, const uint256 &hashBlock)
+{
+    // calculate checksum
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    hasher << hashBlock;
+    hasher << *this;
+    uint256 hashChecksum = hasher.GetHash();
+
+    LOCK(cs_LastBlockFile);
+    if (!undofilewriter.WriteRecord(pos, *this, &hashChecksum))
+        return error("CBlockUndo::WriteToDisk() : write to rev%05u.dat failed", pos.nFile);
+    return true;
+}
+
+// Mappings address a whole file, up to MAX_BLOCKFILE_SIZE each
+int nMappedBlockFiles = sizeof(void*) >= 8 ? 16 : 0;
+
+// Most recently used mappings first. Readers hold a reference, so a mapping
+// evicted while a block is being read from it is only unmapped afterwards.
+static CCriticalSection cs_MappedBlockFiles;
+static std::list<std::pair<int, boost::shared_ptr<CMappedFile> > > listMappedBlockFiles;
+
+static boost::shared_ptr<CMappedFile> GetMappedBlockFile(int nFile)
+{
+    {
+        // Only files that are no longer appended to; FindBlockPos finalizes
+        // a file before moving on to the next
+        LOCK(cs_LastBlockFile);
+        if (nFile >= nLastBlockFile)
+            return boost::shared_ptr<CMappedFile>();
+    }
+
+    LOCK(cs_MappedBlockFiles);
+    for (std::list<std::pair<int, boost::shared_ptr<CMappedFile> > >::iterator it = listMappedBlockFiles.begin(); it != listMappedBlockFiles.end(); it++) {
+        if (it->first == nFile) {
+            listMappedBlockFiles.splice(listMappedBlockFiles.begin(), listMappedBlockFiles, it);
+            return it->second;
+        }
+    }
+    boost::shared_ptr<CMappedFile> pfile(new CMappedFile(GetDataDir() / "blocks" / strprintf("blk%05u.dat", nFile)));
+    if (!pfile->IsValid())
+        return boost::shared_ptr<CMappedFile>();
+    listMappedBlockFiles.push_front(std::make_pair(nFile, pfile));
+    while (listMappedBlockFiles.size() > (size_t)nMappedBlockFiles)
+        listMappedBlockFiles.pop_back();
+    return pfile;
+}
+
+static bool ReadBlockDataFromDisk(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
+    // Finalized files are deserialized straight from the mapping
+    boost::shared_ptr<CMappedFile> pfile;
+    if (nMappedBlockFiles > 0 && !pos.IsNull())
+        pfile = GetMappedBlockFile(pos.nFile);
+    if (pfile) {
+        if (pos.nPos >= pfile->size())
+            return error("ReadBlockFromDisk(CBlock&, CDiskBlockPos&) : position %u past the end of block file %d", pos.nPos, pos.nFile);
+        try {
+            CBufferReader ss(pfile->data() + pos.nPos, pfile->data() + pfile->size(), SER_DISK, CLIENT_VERSION);
+            ss >> block;
+        }
+        catch (std::exception &e) {
+            return error("%s() : deserialize error", __PRETTY_FUNCTION__);
+        }
+        return true;
+    }
+
     // Open history file to read
     CAutoFile filein = CAutoFile(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
     if (!filein)
@@ -1228,6 +1705,89 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
         return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
     }
 
+    return true;
+}
+
+size_t nBlockCacheSize = 16 << 20;
+int64 nSyncInterval = 10;
+
+/** Deserialized blocks with their merkle trees, most recently used first,
+ *  bounded by their serialized size */
+class CBlockCache
+{
+private:
+    typedef std::list<std::pair<uint256, boost::shared_ptr<const CBlock> > > BlockList;
+
+    CCriticalSection cs;
+    BlockList listBlocks;
+    std::map<uint256, BlockList::iterator> mapBlocks;
+    size_t nSize;
+
+    static size_t BlockSize(const CBlock &block) {
+        return ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION) + block.vMerkleTree.size() * sizeof(uint256);
+    }
+
+public:
+    CBlockCache() : nSize(0) {}
+
+    boost::shared_ptr<const CBlock> Get(const uint256 &hash) {
+        LOCK(cs);
+        std::map<uint256, BlockList::iterator>::iterator mi = mapBlocks.find(hash);
+        if (mi == mapBlocks.end())
+            return boost::shared_ptr<const CBlock>();
+        listBlocks.splice(listBlocks.begin(), listBlocks, mi->second);
+        return mi->second->second;
+    }
+
+    void Add(const uint256 &hash, const boost::shared_ptr<const CBlock> &pblock) {
+        size_t nBlockSize = BlockSize(*pblock);
+        LOCK(cs);
+        if (nBlockSize > nBlockCacheSize || mapBlocks.count(hash))
+            return;
+        listBlocks.push_front(std::make_pair(hash, pblock));
+        mapBlocks[hash] = listBlocks.begin();
+        nSize += nBlockSize;
+        while (nSize > nBlockCacheSize) {
+            nSize -= BlockSize(*listBlocks.back().second);
+            mapBlocks.erase(listBlocks.back().first);
+            listBlocks.pop_back();
+        }
+    }
+};
+
+static CBlockCache blockcache;
+
+// Takes a copy of a block that was just accepted, for peers that will ask for it
+static void AddBlockToCache(const CBlock &block)
+{
+    if (nBlockCacheSize == 0)
+        return;
+    boost::shared_ptr<CBlock> pblock(new CBlock(block));
+    if (pblock->vMerkleTree.empty())
+        pblock->BuildMerkleTree();
+    blockcache.Add(pblock->GetHash(), pblock);
+}
+
+static CCriticalSection cs_nPoWChecksSkipped;
+static uint64 nPoWChecksSkipped = 0;
+
+static void PoWCheckSkipped()
+{
+    LOCK(cs_nPoWChecksSkipped);
+    nPoWChecksSkipped++;
+}
+
+uint64 GetPoWChecksSkipped()
+{
+    LOCK(cs_nPoWChecksSkipped);
+    return nPoWChecksSkipped;
+}
+
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+{
+    if (!ReadBlockDataFromDisk(block, pos))
+        return false;
+
     // Check the header
     if (!CheckProofOfWork(block.GetPoWHash(block.GetAlgo()), block.nBits, block.GetAlgo()))
         return error("ReadBlockFromDisk(CBlock&, CDiskBlockPos&) : errors in block header");
@@ -1237,13 +1797,41 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
 
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
+    boost::shared_ptr<const CBlock> pblock = blockcache.Get(pindex->GetBlockHash());
+    if (pblock) {
+        block = *pblock;
+        return true;
+    }
+
+    if (!ReadBlockDataFromDisk(block, pindex->GetBlockPos()))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*) : GetHash() doesn't match index");
+
+    // The header hash commits to every field the PoW hash covers, so a header
+    // matching an index entry whose PoW was already verified needs no rehash
+    if (pindex->nStatus & BLOCK_POW_CHECKED)
+        PoWCheckSkipped();
+    else if (!CheckProofOfWork(block.GetPoWHash(block.GetAlgo()), block.nBits, block.GetAlgo()))
+        return error("ReadBlockFromDisk(CBlock&, CBlockIndex*) : errors in block header");
     return true;
 }
 
+boost::shared_ptr<const CBlock> ReadBlockFromDiskCached(const CBlockIndex* pindex)
+{
+    boost::shared_ptr<const CBlock> pblockCached = blockcache.Get(pindex->GetBlockHash());
+    if (pblockCached)
+        return pblockCached;
+
+    boost::shared_ptr<CBlock> pblock(new CBlock());
+    if (!ReadBlockFromDisk(*pblock, pindex))
+        return boost::shared_ptr<const CBlock>();
+    pblock->BuildMerkleTree();
+    if (nBlockCacheSize > 0)
+        blockcache.Add(pindex->GetBlockHash(), pblock);
+    return pblock;
+}
+
 uint256 static GetOrphanRoot(const CBlockHeader* pblock)
 {
     // Work back to the first block in the orphan chain
@@ -1261,14 +1849,13 @@ const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, int algo)
 
 const CBlockIndex* GetLastBlockIndexForAlgo(const CBlockIndex* pindex, int algo)
 {
-    for (;;)
-    {
-        if (!pindex)
-            return NULL;
-        if (pindex->GetAlgo() == algo)
-            return pindex;
-        pindex = pindex->pprev;
-    }
+    if (!pindex)
+        return NULL;
+    if (pindex->GetAlgo() == algo)
+        return pindex;
+    if (algo < 0 || algo >= NUM_ALGOS)
+        return NULL;
+    return pindex->pprevAlgo[algo];
 }
 
 int static generateMTRandom(unsigned int s, int range)
@@ -1352,13 +1939,13 @@ static const int64 nTargetTimespanAdjDown = nTargetTimespan * (100 + nMaxAdjustD
 unsigned int ComputeMinWork(unsigned int nBase, int64 nTime)
 {
     /*
-    const CBigNum &bnLimit = Params().ProofOfWorkLimit();
+    const arith_uint256 &bnLimit = Params().ProofOfWorkLimit(ALGO_SHA256D);
     // Testnet has min-difficulty blocks
     // after nTargetSpacing*2 time between blocks:
     if (TestNet() && nTime > nTargetSpacing*2)
         return bnLimit.GetCompact();
 
-    CBigNum bnResult;
+    arith_uint256 bnResult;
     bnResult.SetCompact(nBase);
     while (nTime > 0 && bnResult < bnLimit)
     {
@@ -1433,35 +2020,39 @@ unsigned int static GetNextWorkRequired(const CBlockIndex* pindexLast, const CBl
     if (nActualTimespan > nMaxActualTimespan)
         nActualTimespan = nMaxActualTimespan;
 
-    // Retarget
-    CBigNum bnNew;
+    // Retarget. With a limit close to 2^256, as on regtest, the target times
+    // the timespan needs more than 256 bits, so the product must not wrap.
+    // A result that does not fit is above any limit.
+    arith_uint256 bnNew;
+    bool fOverflow;
     bnNew.SetCompact(pindexPrev->nBits);
-    bnNew *= nActualTimespan;
-    bnNew /= nAveragingTargetTimespan;
+    bnNew.MulDiv(nActualTimespan, nAveragingTargetTimespan, &fOverflow);
 
-    if (bnNew > Params().ProofOfWorkLimit(algo))
+    if (fOverflow || bnNew > Params().ProofOfWorkLimit(algo))
         bnNew = Params().ProofOfWorkLimit(algo);
 
     /// debug print
     printf("GetNextWorkRequired RETARGET\n");
     printf("nTargetTimespan = %"PRI64d"    nActualTimespan = %"PRI64d"\n", nAveragingTargetTimespan, nActualTimespan);
-    printf("Before: %08x  %s\n", pindexPrev->nBits, CBigNum().SetCompact(pindexPrev->nBits).getuint256().ToString().c_str());
-    printf("After:  %08x  %s\n", bnNew.GetCompact(), bnNew.getuint256().ToString().c_str());
+    printf("Before: %08x  %s\n", pindexPrev->nBits, arith_uint256().SetCompact(pindexPrev->nBits).ToString().c_str());
+    printf("After:  %08x  %s\n", bnNew.GetCompact(), bnNew.ToString().c_str());
 
     return bnNew.GetCompact();
 }
 
 bool CheckProofOfWork(uint256 hash, unsigned int nBits, int algo)
 {
-    CBigNum bnTarget;
-    bnTarget.SetCompact(nBits);
+    bool fNegative;
+    bool fOverflow;
+    arith_uint256 bnTarget;
+    bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
 
     // Check range
-    if (bnTarget <= 0 || bnTarget > Params().ProofOfWorkLimit(algo))
+    if (fNegative || !bnTarget || fOverflow || bnTarget > Params().ProofOfWorkLimit(algo))
         return error("CheckProofOfWork(algo=%d) : nBits below minimum work", algo);
 
     // Check proof of work matches claimed amount
-    if (hash > bnTarget.getuint256())
+    if (arith_uint256(hash) > bnTarget)
         return error("CheckProofOfWork(algo=%d) : hash doesn't match nBits", algo);
 
     return true;
@@ -1613,15 +2204,17 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
     // mark inputs spent
     if (!tx.IsCoinBase()) {
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            CCoins &coins = inputs.GetCoins(txin.prevout.hash);
+            CCoinsModifier coins = inputs.ModifyCoins(txin.prevout.hash);
             CTxInUndo undo;
-            assert(coins.Spend(txin.prevout, undo));
+            assert(coins->Spend(txin.prevout, undo));
             txundo.vprevout.push_back(undo);
         }
     }
 
-    // add outputs
-    assert(inputs.SetCoins(txhash, CCoins(tx, nHeight)));
+    // add outputs; ConnectBlock has already checked that no unspent
+    // transaction with this hash exists, and block templates are never
+    // flushed
+    *inputs.ModifyNewCoins(txhash) = CCoins(tx, nHeight);
 }
 
 bool CCoinsViewCache::HaveInputs(const CTransaction& tx)
@@ -1647,7 +2240,7 @@ bool CCoinsViewCache::HaveInputs(const CTransaction& tx)
 
 bool CScriptCheck::operator()() const {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
-    if (!VerifyScript(scriptSig, scriptPubKey, *ptxTo, nIn, nFlags, nHashType))
+    if (!VerifyScript(scriptSig, scriptPubKey, *ptxTo, nIn, nFlags, nHashType, pcontext.get()))
         return error("CScriptCheck() : %s VerifySignature failed", ptxTo->GetHash().ToString().c_str());
     return true;
 }
@@ -1711,12 +2304,18 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, CCoinsViewCach
         // before the last block chain checkpoint. This is safe because block merkle hashes are
         // still computed and checked, and any change will be caught at the next checkpoint.
         if (fScriptChecks) {
+            // With several inputs, serialize the parts of the signature hash
+            // they have in common only once
+            boost::shared_ptr<const CSigHashContext> pcontext;
+            if (tx.vin.size() > 1)
+                pcontext.reset(new CSigHashContext(tx));
+
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
                 const CCoins &coins = inputs.GetCoins(prevout.hash);
 
                 // Verify signature
-                CScriptCheck check(coins, tx, i, flags, 0);
+                CScriptCheck check(coins, tx, i, flags, 0, pcontext);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1724,7 +2323,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, CCoinsViewCach
                     if (flags & SCRIPT_VERIFY_STRICTENC) {
                         // For now, check whether the failure was caused by non-canonical
                         // encodings or not; if so, don't trigger DoS protection.
-                        CScriptCheck check(coins, tx, i, flags & (~SCRIPT_VERIFY_STRICTENC), 0);
+                        CScriptCheck check(coins, tx, i, flags & (~SCRIPT_VERIFY_STRICTENC), 0, pcontext);
                         if (check())
                             return state.Invalid();
                     }
@@ -1764,18 +2363,18 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         uint256 hash = tx.GetHash();
 
         // check that all outputs are available
-        if (!view.HaveCoins(hash)) {
+        if (!view.HaveCoins(hash))
             fClean = fClean && error("DisconnectBlock() : outputs still spent? database corrupted");
-            view.SetCoins(hash, CCoins());
-        }
-        CCoins &outs = view.GetCoins(hash);
+        {
+            CCoinsModifier outs = view.ModifyCoins(hash);
 
-        CCoins outsBlock = CCoins(tx, pindex->nHeight);
-        if (outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock() : added transaction mismatch? database corrupted");
+            CCoins outsBlock = CCoins(tx, pindex->nHeight);
+            if (*outs != outsBlock)
+                fClean = fClean && error("DisconnectBlock() : added transaction mismatch? database corrupted");
 
-        // remove outputs
-        outs = CCoins();
+            // remove outputs
+            *outs = CCoins();
+        }
 
         // restore inputs
         if (i > 0) { // not coinbases
@@ -1821,24 +2420,29 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
     }
 }
 
-void static FlushBlockFile(bool fFinalize = false)
+void FlushBlockFile(bool fFinalize)
 {
     LOCK(cs_LastBlockFile);
 
+    // Group commit of everything written since the last flush
+    blockfilewriter.Commit();
+    undofilewriter.Commit();
+
+    if (!fFinalize)
+        return;
+
     CDiskBlockPos posOld(nLastBlockFile, 0);
 
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
-        if (fFinalize)
-            TruncateFile(fileOld, infoLastBlockFile.nSize);
+        TruncateFile(fileOld, infoLastBlockFile.nSize);
         FileCommit(fileOld);
         fclose(fileOld);
     }
 
     fileOld = OpenUndoFile(posOld);
     if (fileOld) {
-        if (fFinalize)
-            TruncateFile(fileOld, infoLastBlockFile.nUndoSize);
+        TruncateFile(fileOld, infoLastBlockFile.nUndoSize);
         FileCommit(fileOld);
         fclose(fileOld);
     }
@@ -1853,10 +2457,195 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+static CCheckQueue<CPoWCheck> powcheckqueue(1);
+
+void ThreadPoWCheck() {
+    RenameThread("bitcoin-powcheck");
+    powcheckqueue.Thread();
+}
+
+// Lookups are disk bound, so hand them out in small batches
+static CCheckQueue<CCoinsFetch> coinsfetchqueue(4);
+
+void ThreadCoinsFetch() {
+    RenameThread("bitcoin-coinsfetch");
+    coinsfetchqueue.Thread();
+}
+
+bool CCoinsFetch::operator()() const {
+    try {
+        *pfFound = pview->GetCoins(txid, *pcoins);
+    } catch (std::exception &e) {
+        // Leave it to the validating thread, which reads it again and reports the error
+        *pfFound = false;
+    }
+    return true;
+}
+
+void CCoinsViewCache::Prefetch(const std::vector<uint256> &vTxid) {
+    assert(!fHasModifier);
+    std::vector<uint256> vMissing;
+    std::set<uint256> setSeen;
+    BOOST_FOREACH(const uint256 &txid, vTxid) {
+        if (cacheCoins.count(txid) || !setSeen.insert(txid).second)
+            continue;
+        vMissing.push_back(txid);
+    }
+    // A single lookup gains nothing from being done on another thread
+    if (nCoinsFetchThreads == 0 || vMissing.size() < 2)
+        return;
+
+    std::vector<CCoins> vCoins(vMissing.size());
+    std::vector<char> vFound(vMissing.size(), 0);
+    std::vector<CCoinsFetch> vFetch;
+    vFetch.reserve(vMissing.size());
+    for (unsigned int i = 0; i < vMissing.size(); i++)
+        vFetch.push_back(CCoinsFetch(*base, vMissing[i], vCoins[i], vFound[i]));
+    CCheckQueueControl<CCoinsFetch> control(&coinsfetchqueue);
+    control.Add(vFetch);
+    control.Wait();
+
+    for (unsigned int i = 0; i < vMissing.size(); i++) {
+        nMisses++;
+        if (!vFound[i])
+            continue;
+        CCoinsMap::iterator it = cacheCoins.insert(std::make_pair(vMissing[i], CCoinsCacheEntry())).first;
+        vCoins[i].swap(it->second.coins);
+        if (it->second.coins.IsPruned())
+            it->second.flags = CCoinsCacheEntry::FRESH;
+        nCachedCoinsUsage += it->second.coins.DynamicMemoryUsage();
+    }
+}
+
+// Read the coins spent by a block into pcoinsTip in parallel, so connecting
+// it does not wait on one database read after the other
+static void PrefetchBlockInputs(const CBlock& block)
+{
+    if (nCoinsFetchThreads == 0 || pcoinsTip == NULL)
+        return;
+    std::set<uint256> setBlockTx;
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+        setBlockTx.insert(block.GetTxHash(i));
+    std::vector<uint256> vTxid;
+    for (unsigned int i = 1; i < block.vtx.size(); i++) {
+        BOOST_FOREACH(const CTxIn &txin, block.vtx[i].vin) {
+            // Outputs created earlier in the same block are not in the database
+            if (!setBlockTx.count(txin.prevout.hash))
+                vTxid.push_back(txin.prevout.hash);
+        }
+    }
+    pcoinsTip->Prefetch(vTxid);
+}
+
+bool CPoWCheck::operator()() const
+{
+    std::vector<const CBlockHeader*> vpheaders;
+    vpheaders.reserve(vHeaders.size());
+    for (unsigned int i = 0; i < vHeaders.size(); i++)
+        vpheaders.push_back(&vHeaders[i]);
+    std::vector<uint256> vhashes;
+    GetPoWHashes(vpheaders, vhashes);
+    for (unsigned int i = 0; i < vHeaders.size(); i++)
+        pfValid[i] = CheckProofOfWork(vhashes[i], vHeaders[i].nBits, vHeaders[i].GetAlgo());
+    // Always succeed, so the queue keeps evaluating the remaining groups
+    return true;
+}
+
+// Hashes of blocks whose proof-of-work was verified ahead of ProcessBlock
+static mruset<uint256> setPoWVerified(2000);
+static CCriticalSection cs_setPoWVerified;
+
+static bool IsPoWVerified(const uint256& hash)
+{
+    LOCK(cs_setPoWVerified);
+    return setPoWVerified.count(hash) > 0;
+}
+
+// Verify the proof-of-work of all complete "block" messages waiting in a
+// node's receive queue on the PoW check threads. The blocks themselves are
+// still processed one at a time and in order by ProcessMessages; this only
+// lets ProcessBlock skip the expensive hash for headers that passed here.
+static void PreVerifyQueuedBlocks(CNode* pfrom)
+{
+    if (!nScriptCheckThreads || fImporting || fReindex)
+        return;
+
+    std::vector<CBlockHeader> vHeaders;
+    std::vector<uint256> vHashes;
+    BOOST_FOREACH(CNetMessage& msg, pfrom->vRecvMsg)
+    {
+        if (!msg.complete())
+            break;
+        if (!msg.hdr.IsValid() || msg.hdr.GetCommand() != "block" || msg.hdr.nMessageSize < 80)
+            continue;
+
+        CBlockHeader header;
+        try {
+            CDataStream ss(msg.vRecv.begin(), msg.vRecv.begin() + 80, SER_NETWORK, PROTOCOL_VERSION);
+            ss >> header;
+        } catch (std::exception &e) {
+            continue;
+        }
+        uint256 hash = header.GetHash();
+        if (IsPoWVerified(hash))
+            continue;
+        vHeaders.push_back(header);
+        vHashes.push_back(hash);
+    }
+    if (vHeaders.size() < 2)
+        return;
+
+    {
+        // Don't spend time on blocks we already have
+        TRY_LOCK(cs_main, lockMain);
+        if (lockMain)
+        {
+            unsigned int j = 0;
+            for (unsigned int i = 0; i < vHeaders.size(); i++)
+            {
+                if (mapBlockIndex.count(vHashes[i]) || mapOrphanBlocks.count(vHashes[i]))
+                    continue;
+                vHeaders[j] = vHeaders[i];
+                vHashes[j] = vHashes[i];
+                j++;
+            }
+            vHeaders.resize(j);
+            vHashes.resize(j);
+        }
+    }
+    if (vHeaders.size() < 2)
+        return;
+
+    // Spread the headers over the threads, but keep groups of up to
+    // scrypt_multi_ways headers together for the interleaved scrypt kernel.
+    unsigned int nGroup = (vHeaders.size() + nScriptCheckThreads - 1) / nScriptCheckThreads;
+    nGroup = std::max(1U, std::min(nGroup, (unsigned int)scrypt_multi_ways));
+
+    std::vector<char> vfValid(vHeaders.size(), 0);
+    std::vector<CPoWCheck> vChecks;
+    for (unsigned int i = 0; i < vHeaders.size(); i += nGroup)
+    {
+        std::vector<CBlockHeader> vGroup(vHeaders.begin() + i, vHeaders.begin() + std::min(i + nGroup, (unsigned int)vHeaders.size()));
+        vChecks.push_back(CPoWCheck(vGroup, &vfValid[i]));
+    }
+
+    CCheckQueueControl<CPoWCheck> control(&powcheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+
+    LOCK(cs_setPoWVerified);
+    for (unsigned int i = 0; i < vHeaders.size(); i++)
+        if (vfValid[i])
+            setPoWVerified.insert(vHashes[i]);
+}
+
 bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck)
 {
     // Check it again in case a previous version let a bad block in
-    if (!CheckBlock(block, state, !fJustCheck, !fJustCheck))
+    bool fCheckPOW = !fJustCheck && !(pindex->nStatus & BLOCK_POW_CHECKED);
+    if (!fJustCheck && !fCheckPOW)
+        PoWCheckSkipped();
+    if (!CheckBlock(block, state, fCheckPOW, !fJustCheck))
         return false;
 
     // verify that the view's current state corresponds to the previous block
@@ -1872,6 +2661,11 @@ bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, C
 
     bool fScriptChecks = pindex->nHeight >= Checkpoints::GetTotalBlocksEstimate();
 
+    int64 nPrefetchStart = GetTimeMicros();
+    PrefetchBlockInputs(block);
+    if (fBenchmark && nCoinsFetchThreads)
+        printf("- Prefetch inputs: %.2fms\n", 0.001 * (GetTimeMicros() - nPrefetchStart));
+
     // Do not allow blocks that contain transactions which 'overwrite' older transactions,
     // unless those are already completely spent.
     // If such overwrites are allowed, coinbases and transactions depending upon those
@@ -1986,7 +2780,7 @@ bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, C
             pindex->nStatus |= BLOCK_HAVE_UNDO;
         }
 
-        pindex->nStatus = (pindex->nStatus & ~BLOCK_VALID_MASK) | BLOCK_VALID_SCRIPTS;
+        pindex->nStatus = (pindex->nStatus & ~BLOCK_VALID_MASK) | BLOCK_VALID_SCRIPTS | BLOCK_POW_CHECKED;
 
         CDiskBlockIndex blockindex(pindex);
         if (!pblocktree->WriteBlockIndex(blockindex))
@@ -2015,16 +2809,9 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
 
     // Find the fork (typically, there is none)
     CBlockIndex* pfork = view.GetBestBlock();
-    CBlockIndex* plonger = pindexNew;
-    while (pfork && pfork != plonger)
+    if (pfork)
     {
-        while (plonger->nHeight > pfork->nHeight) {
-            plonger = plonger->pprev;
-            assert(plonger != NULL);
-        }
-        if (pfork == plonger)
-            break;
-        pfork = pfork->pprev;
+        pfork = LastCommonAncestor(pfork, pindexNew);
         assert(pfork != NULL);
     }
 
@@ -2094,9 +2881,13 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
     if (fBenchmark)
         printf("- Flush %i transactions: %.2fms (%.4fms/tx)\n", nModified, 0.001 * nTime, 0.001 * nTime / nModified);
 
-    // Make sure it's successfully written to disk before changing memory structure
+    // Make sure it's successfully written to disk before changing memory structure.
+    // Outside initial download this happens every nSyncInterval seconds, so
+    // blocks arriving in quick succession share one set of fsyncs.
     bool fIsInitialDownload = IsInitialBlockDownload();
-    if (!fIsInitialDownload || pcoinsTip->GetCacheSize() > nCoinCacheSize) {
+    static int64 nLastSync = 0;
+    if ((!fIsInitialDownload && GetTime() - nLastSync >= nSyncInterval) || GetCoinsCacheUsage() > nCoinCacheUsage) {
+        nLastSync = GetTime();
         // Typical CCoins structures on disk are around 100 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
@@ -2106,11 +2897,22 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
             return state.Error();
         FlushBlockFile();
         pblocktree->Sync();
+        // The coins themselves are written by a background thread (see
+        // CCoinsViewAsyncFlush), together with the best block marker. Block
+        // data is synced above, so that marker never points past the disk.
         if (!pcoinsTip->Flush())
             return state.Abort(_("Failed to write to coin database"));
+        // Flushed entries stay cached; only make room once over the limit.
+        // The copy handed to the writer counts against the limit as well
+        // until it is written, so the cache gets whatever it leaves.
+        if (GetCoinsCacheUsage() > nCoinCacheUsage) {
+            size_t nPending = pcoinsflush ? pcoinsflush->DynamicMemoryUsage() : 0;
+            size_t nFree = nPending < nCoinCacheUsage ? nCoinCacheUsage - nPending : 0;
+            pcoinsTip->Trim(std::min(nCoinCacheUsage / 2, nFree));
+        }
     }
 
-    // At this point, all changes have been done to the database.
+    // At this point, all changes have been handed to the database.
     // Proceed by updating the memory structures.
 
     // Register new best chain
@@ -2146,11 +2948,11 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
     nBestChainWork = pindexNew->nChainWork;
     nTimeBestReceived = GetTime();
     nTransactionsUpdated++;
-    printf("SetBestChain: new best=%s  height=%d  pow_algo=%d  block_work=%s  log2_work=%.8g  tx=%lu  date=%s progress=%f\n",
+    printf("SetBestChain: new best=%s  height=%d  pow_algo=%d  block_work=%.8g  log2_work=%.8g  tx=%lu  date=%s progress=%f\n",
       hashBestChain.ToString().c_str(), 
       nBestHeight, 
       pindexNew->GetAlgo(),
-      pindexNew->GetBlockWorkAdjusted().ToString().c_str(),
+      pindexNew->GetBlockWorkAdjusted().getdouble(),
       log(nBestChainWork.getdouble())/log(2.0), 
       (unsigned long)pindexNew->nChainTx,
       DateTimeStrFormat("%Y-%m-%d %H:%M:%S", pindexBest->GetBlockTime()).c_str(),
@@ -2196,23 +2998,25 @@ bool AddToBlockIndex(CBlock& block, CValidationState& state, const CDiskBlockPos
         return state.Invalid(error("AddToBlockIndex() : %s already exists", hash.ToString().c_str()));
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
+    CBlockIndex* pindexNew = new (blockIndexArena.Allocate()) CBlockIndex(block);
+    BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
-    map<uint256, CBlockIndex*>::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
+    BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
     if (miPrev != mapBlockIndex.end())
     {
         pindexNew->pprev = (*miPrev).second;
         pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
     }
+    pindexNew->BuildSkip();
+    pindexNew->BuildAlgoLinks();
     pindexNew->nTx = block.vtx.size();
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + pindexNew->GetBlockWorkAdjusted().getuint256();
     pindexNew->nChainTx = (pindexNew->pprev ? pindexNew->pprev->nChainTx : 0) + pindexNew->nTx;
     pindexNew->nFile = pos.nFile;
     pindexNew->nDataPos = pos.nPos;
     pindexNew->nUndoPos = 0;
-    pindexNew->nStatus = BLOCK_VALID_TRANSACTIONS | BLOCK_HAVE_DATA;
+    // ProcessBlock only gets here after CheckBlock verified the PoW
+    pindexNew->nStatus = BLOCK_VALID_TRANSACTIONS | BLOCK_HAVE_DATA | BLOCK_POW_CHECKED;
     setBlockIndexValid.insert(pindexNew);
 
     if (!pblocktree->WriteBlockIndex(CDiskBlockIndex(pindexNew)))
@@ -2272,12 +3076,8 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
         unsigned int nNewChunks = (infoLastBlockFile.nSize + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
         if (nNewChunks > nOldChunks) {
             if (CheckDiskSpace(nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos)) {
-                FILE *file = OpenBlockFile(pos);
-                if (file) {
-                    printf("Pre-allocating up to position 0x%x in blk%05u.dat\n", nNewChunks * BLOCKFILE_CHUNK_SIZE, pos.nFile);
-                    AllocateFileRange(file, pos.nPos, nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos);
-                    fclose(file);
-                }
+                printf("Pre-allocating up to position 0x%x in blk%05u.dat\n", nNewChunks * BLOCKFILE_CHUNK_SIZE, pos.nFile);
+                blockfilewriter.Allocate(pos, nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos);
             }
             else
                 return state.Error();
@@ -2318,12 +3118,8 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     unsigned int nNewChunks = (nNewSize + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
     if (nNewChunks > nOldChunks) {
         if (CheckDiskSpace(nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos)) {
-            FILE *file = OpenUndoFile(pos);
-            if (file) {
-                printf("Pre-allocating up to position 0x%x in rev%05u.dat\n", nNewChunks * UNDOFILE_CHUNK_SIZE, pos.nFile);
-                AllocateFileRange(file, pos.nPos, nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos);
-                fclose(file);
-            }
+            printf("Pre-allocating up to position 0x%x in rev%05u.dat\n", nNewChunks * UNDOFILE_CHUNK_SIZE, pos.nFile);
+            undofilewriter.Allocate(pos, nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos);
         }
         else
             return state.Error();
@@ -2402,7 +3198,7 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CDiskBlockPos* dbp)
     CBlockIndex* pindexPrev = NULL;
     int nHeight = 0;
     if (hash != Params().HashGenesisBlock()) {
-        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+        BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
         if (mi == mapBlockIndex.end())
             return state.DoS(10, error("AcceptBlock() : prev block not found"));
         pindexPrev = (*mi).second;
@@ -2460,9 +3256,11 @@ if (pindexPrev->nHeight < 915235 || 955000 < pindexPrev->nHeight) {
             blockPos = *dbp;
         if (!FindBlockPos(state, blockPos, nBlockSize+8, nHeight, block.nTime, dbp != NULL))
             return error("AcceptBlock() : FindBlockPos failed");
-        if (dbp == NULL)
+        if (dbp == NULL) {
             if (!WriteBlockToDisk(block, blockPos))
                 return state.Abort(_("Failed to write block"));
+            AddBlockToCache(block);
+        }
         if (!AddToBlockIndex(block, state, blockPos))
             return error("AcceptBlock() : AddToBlockIndex failed");
     } catch(std::runtime_error &e) {
@@ -2517,10 +3315,10 @@ bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBl
         return state.Invalid(error("ProcessBlock() : already have block (orphan) %s", hash.ToString().c_str()));
 
     // Preliminary checks
-    if (!CheckBlock(*pblock, state))
+    if (!CheckBlock(*pblock, state, !IsPoWVerified(hash)))
         return error("ProcessBlock() : CheckBlock FAILED");
 
-    CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint(mapBlockIndex);
+    CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint();
     if (pcheckpoint && pblock->hashPrevBlock != hashBestChain)
     {
         // Extra checks to prevent "fill up memory by spamming with bogus blocks"
@@ -2529,9 +3327,9 @@ bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBl
         {
             return state.DoS(100, error("ProcessBlock() : block with timestamp before last checkpoint"));
         }
-        CBigNum bnNewBlock;
+        arith_uint256 bnNewBlock;
         bnNewBlock.SetCompact(pblock->nBits);
-        CBigNum bnRequired;
+        arith_uint256 bnRequired;
         bnRequired.SetCompact(ComputeMinWork(pcheckpoint->nBits, deltaTime));
         if (bnNewBlock > bnRequired)
         {
@@ -2806,14 +3604,12 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
         return NULL;
 
     // Return existing
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+    BlockMap::iterator mi = mapBlockIndex.find(hash);
     if (mi != mapBlockIndex.end())
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
+    CBlockIndex* pindexNew = new (blockIndexArena.Allocate()) CBlockIndex();
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
@@ -2827,7 +3623,7 @@ bool static LoadBlockIndexDB()
 
     boost::this_thread::interruption_point();
 
-    // Calculate nChainWork
+    // Calculate nChainWork, the skiplist and the per-algo links
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
     BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
@@ -2839,6 +3635,8 @@ bool static LoadBlockIndexDB()
     BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
     {
         CBlockIndex* pindex = item.second;
+        pindex->BuildSkip();
+        pindex->BuildAlgoLinks();
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + pindex->GetBlockWorkAdjusted().getuint256();
         pindex->nChainTx = (pindex->pprev ? pindex->pprev->nChainTx : 0) + pindex->nTx;
         if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS && !(pindex->nStatus & BLOCK_FAILED_MASK))
@@ -2914,7 +3712,7 @@ bool VerifyDB(int nCheckLevel, int nCheckDepth)
         if (!ReadBlockFromDisk(block, pindex))
             return error("VerifyDB() : *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString().c_str());
         // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state))
+        if (nCheckLevel >= 1 && !CheckBlock(block, state, !(pindex->nStatus & BLOCK_POW_CHECKED)))
             return error("VerifyDB() : *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString().c_str());
         // check level 2: verify undo validity
         if (nCheckLevel >= 2 && pindex) {
@@ -2926,7 +3724,7 @@ bool VerifyDB(int nCheckLevel, int nCheckDepth)
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= 2*nCoinCacheSize + 32000) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + GetCoinsCacheUsage()) <= 2*nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString().c_str());
@@ -3002,7 +3800,7 @@ bool InitBlockIndex() {
             printf("Searching for genesis block...\n");
             // This will figure out a valid hash and Nonce if you're
             // creating a different genesis block:
-            uint256 hashTarget = CBigNum().SetCompact(block.nBits).getuint256();
+            uint256 hashTarget = arith_uint256().SetCompact(block.nBits).getuint256();
             uint256 thash;
             char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
 
@@ -3055,7 +3853,7 @@ void PrintBlockTree()
 {
     // pre-compute tree structure
     map<CBlockIndex*, vector<CBlockIndex*> > mapNext;
-    for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+    for (BlockMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
     {
         CBlockIndex* pindex = (*mi).second;
         mapNext[pindex->pprev].push_back(pindex);
@@ -3315,11 +4113,13 @@ void static ProcessGetData(CNode* pfrom)
             if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
             {
                 // Send block from disk
-                map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
+                BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
+                boost::shared_ptr<const CBlock> pblock;
                 if (mi != mapBlockIndex.end())
+                    pblock = ReadBlockFromDiskCached((*mi).second);
+                if (pblock)
                 {
-                    CBlock block;
-                    ReadBlockFromDisk(block, (*mi).second);
+                    const CBlock &block = *pblock;
                     if (inv.type == MSG_BLOCK)
                         pfrom->PushMessage("block", block);
                     else // MSG_FILTERED_BLOCK)
@@ -3716,7 +4516,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         if (locator.IsNull())
         {
             // If locator is null, return the hashStop block
-            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashStop);
+            BlockMap::iterator mi = mapBlockIndex.find(hashStop);
             if (mi == mapBlockIndex.end())
                 return true;
             pindex = (*mi).second;
@@ -4006,6 +4806,8 @@ bool ProcessMessages(CNode* pfrom)
     if (!pfrom->vRecvGetData.empty())
         ProcessGetData(pfrom);
 
+    PreVerifyQueuedBlocks(pfrom);
+
     std::deque<CNetMessage>::iterator it = pfrom->vRecvMsg.begin();
     while (!pfrom->fDisconnect && it != pfrom->vRecvMsg.end()) {
         // Don't bother if send buffer is too full to respond anyway
@@ -4308,25 +5110,13 @@ int static FormatHashBlocks(void* pbuffer, unsigned int len)
     return blocks;
 }
 
-static const unsigned int pSHA256InitState[8] =
-{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
-
 void SHA256Transform(void* pstate, void* pinput, const void* pinit)
 {
-    SHA256_CTX ctx;
-    unsigned char data[64];
-
-    SHA256_Init(&ctx);
-
-    for (int i = 0; i < 16; i++)
-        ((uint32_t*)data)[i] = ByteReverse(((uint32_t*)pinput)[i]);
-
-    for (int i = 0; i < 8; i++)
-        ctx.h[i] = ((uint32_t*)pinit)[i];
-
-    SHA256_Update(&ctx, data, sizeof(data));
-    for (int i = 0; i < 8; i++)
-        ((uint32_t*)pstate)[i] = ctx.h[i];
+    // pinput is already in the word order produced by FormatHashBuffers
+    uint32_t state[8];
+    memcpy(state, pinit, sizeof(state));
+    sha256_transform(state, (const uint32_t*)pinput);
+    memcpy(pstate, state, sizeof(state));
 }
 
 //
@@ -4335,31 +5125,34 @@ void SHA256Transform(void* pstate, void* pinput, const void* pinit)
 // All input buffers are 16-byte aligned.  nNonce is usually preserved
 // between calls, but periodically or if nNonce is 0xffff0000 or above,
 // the block is rebuilt and nNonce starts over at zero.
+// The midstate of the first 64 bytes is reused for every nonce, and
+// sha256d_scan hashes sha256d_scan_lanes nonces per call.
 //
-unsigned int static ScanHash_CryptoPP(char* pmidstate, char* pdata, char* phash1, char* phash, unsigned int& nHashesDone)
+unsigned int static ScanHash_SHA256d(const char* pmidstate, char* pdata, char* phash, unsigned int& nHashesDone)
 {
     unsigned int& nNonce = *(unsigned int*)(pdata + 12);
+    const unsigned int nLanes = sha256d_scan_lanes;
     for (;;)
     {
-        // Crypto++ SHA256
-        // Hash pdata using pmidstate as the starting state into
-        // pre-formatted buffer phash1, then hash phash1 into phash
-        nNonce++;
-        SHA256Transform(phash1, pdata, pmidstate);
-        SHA256Transform(phash, phash1, pSHA256InitState);
+        // Hash nNonce+1 .. nNonce+nLanes into phash
+        unsigned int nFirst = nNonce + 1;
+        int nLane = sha256d_scan((const uint32_t*)pmidstate, (const uint32_t*)pdata, nFirst, (uint32_t*)phash);
 
         // Return the nonce if the hash has at least some zero bits,
         // caller will check if it has enough to reach the target
-        if (((unsigned short*)phash)[14] == 0)
+        if (nLane >= 0)
+        {
+            nNonce = nFirst + nLane;
+            nHashesDone += nLane + 1;
             return nNonce;
+        }
+        nNonce += nLanes;
+        nHashesDone += nLanes;
 
         // If nothing found after trying for a while, return -1
-        if ((nNonce & 0xffff) == 0)
-        {
-            nHashesDone = 0xffff+1;
+        if ((nNonce & 0xffff) < nLanes)
             return (unsigned int) -1;
-        }
-        if ((nNonce & 0xfff) == 0)
+        if ((nNonce & 0xfff) < nLanes)
             boost::this_thread::interruption_point();
     }
 }
@@ -4666,6 +5459,8 @@ CBlockTemplate* CreateNewBlock(CReserveKey& reservekey, int algo)
         CBlockIndex indexDummy(*pblock);
         indexDummy.pprev = pindexPrev;
         indexDummy.nHeight = pindexPrev->nHeight + 1;
+        indexDummy.BuildSkip();
+        indexDummy.BuildAlgoLinks();
         CCoinsViewCache viewNew(*pcoinsTip, true);
         CValidationState state;
         if (!ConnectBlock(*pblock, state, &indexDummy, viewNew, true))
@@ -4733,7 +5528,7 @@ void FormatHashBuffers(CBlock* pblock, char* pmidstate, char* pdata, char* phash
         ((unsigned int*)&tmp)[i] = ByteReverse(((unsigned int*)&tmp)[i]);
 
     // Precalc the first half of the first hash, which stays constant
-    SHA256Transform(pmidstate, &tmp.block, pSHA256InitState);
+    SHA256Transform(pmidstate, &tmp.block, sha256_init_state);
 
     memcpy(pdata, &tmp.block, 128);
     memcpy(phash1, &tmp.hash1, 64);
@@ -4746,7 +5541,7 @@ bool CheckWork(CBlock* pblock, CWallet& wallet, CReserveKey& reservekey)
     int algo = pblock->GetAlgo();
     //printf("Algo=%d\n", algo);
     uint256 hashPoW = pblock->GetPoWHash(algo);
-    uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+    uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits).getuint256();
     //printf("pow-hash: %s\n  target: %s\n", 
     //    hashPoW.GetHex().c_str(), 
     //    hashTarget.GetHex().c_str());
@@ -4846,7 +5641,7 @@ void static BitcoinMiner(CWallet *pwallet)
         // Search
         //
         int64 nStart = GetTime();
-        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+        uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits).getuint256();
         uint256 hashbuf[2];
         uint256& hash = *alignup<16>(hashbuf);
        while (true)
@@ -4854,9 +5649,7 @@ void static BitcoinMiner(CWallet *pwallet)
             unsigned int nHashesDone = 0;
             unsigned int nNonceFound;
 
-            // Crypto++ SHA256
-            nNonceFound = ScanHash_CryptoPP(pmidstate, pdata + 64, phash1,
-                                            (char*)&hash, nHashesDone);
+            nNonceFound = ScanHash_SHA256d(pmidstate, pdata + 64, (char*)&hash, nHashesDone);
 
             // Check if something found
             if (nNonceFound != (unsigned int) -1)
@@ -4930,7 +5723,7 @@ void static BitcoinMiner(CWallet *pwallet)
             {
                 // Changing pblock->nTime can change work required on testnet:
                 nBlockBits = ByteReverse(pblock->nBits);
-                hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+                hashTarget = arith_uint256().SetCompact(pblock->nBits).getuint256();
             }
         }
     } 
@@ -4942,6 +5735,11 @@ void static ScryptMiner(CWallet *pwallet)
     CReserveKey reservekey(pwallet);
     unsigned int nExtraNonce = 0;
 
+    // ... and its own scrypt scratchpad slab and header batch
+    std::vector<char> vchScratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+    std::vector<char> vchInput(80 * SCRYPT_MAX_WAYS);
+    uint256 vhash[SCRYPT_MAX_WAYS];
+
     while (true)
     {
         MinerWaitOnline();
@@ -4977,40 +5775,38 @@ void static ScryptMiner(CWallet *pwallet)
         // Search
         //
         int64 nStart = GetTime();
-        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+        uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits).getuint256();
         while (true)
         {
             unsigned int nHashesDone = 0;
-            uint256 thash;
-            char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
             while (true)
             {
-#if defined(USE_SSE2)
-                // Detection would work, but in cases where we KNOW it always has SSE2,
-                // it is faster to use directly than to use a function pointer or conditional.
-#if defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64) || (defined(MAC_OSX) && defined(__i386__))
-                // Always SSE2: x86_64 or Intel MacOS X
-                scrypt_1024_1_1_256_sp_sse2(BEGIN(pblock->nVersion), BEGIN(thash), scratchpad);
-#else
-                // Detect SSE2: 32bit x86 Linux or Windows
-                scrypt_1024_1_1_256_sp(BEGIN(pblock->nVersion), BEGIN(thash), scratchpad);
-#endif
-#else
-                // Generic scrypt
-                scrypt_1024_1_1_256_sp_generic(BEGIN(pblock->nVersion), BEGIN(thash), scratchpad);
-#endif
-
-                if (thash <= hashTarget)
+                // Hash nWays consecutive nonces per pass
+                const int nWays = scrypt_multi_ways;
+                for (int i = 0; i < nWays; i++)
+                {
+                    unsigned int nNonce = pblock->nNonce + i;
+                    memcpy(&vchInput[80 * i], BEGIN(pblock->nVersion), 76);
+                    memcpy(&vchInput[80 * i + 76], &nNonce, 4);
+                }
+                scrypt_1024_1_1_256_multi_sp(&vchInput[0], BEGIN(vhash[0]), nWays, &vchScratchpad[0]);
+                nHashesDone += nWays;
+
+                int nFound = -1;
+                for (int i = 0; i < nWays && nFound < 0; i++)
+                    if (vhash[i] <= hashTarget)
+                        nFound = i;
+                if (nFound >= 0)
                 {
                     // Found a solution
+                    pblock->nNonce += nFound;
                     SetThreadPriority(THREAD_PRIORITY_NORMAL);
                     CheckWork(pblock, *pwalletMain, reservekey);
                     SetThreadPriority(THREAD_PRIORITY_LOWEST);
                     break;
                 }
-                pblock->nNonce += 1;
-                nHashesDone += 1;
-                if ((pblock->nNonce & 0xFF) == 0)
+                pblock->nNonce += nWays;
+                if ((pblock->nNonce & 0xFF) < (unsigned int)nWays)
                     break;
             }
 
@@ -5061,14 +5857,17 @@ void static ScryptMiner(CWallet *pwallet)
             {
                 // Changing pblock->nTime can change work required on testnet:
                 nBlockBits = ByteReverse(pblock->nBits);
-                hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+                hashTarget = arith_uint256().SetCompact(pblock->nBits).getuint256();
             }
             
         }
     }
 }
 
-void static GenericMiner(CWallet *pwallet, int algo)
+// Miner for algos without a dedicated scanner. The header prefix is hashed
+// once per template and time update, each nonce only costs the tail.
+template<int algo>
+void static GenericMiner(CWallet *pwallet)
 {
     // Each thread has its own key and counter
     CReserveKey reservekey(pwallet);
@@ -5098,24 +5897,35 @@ void static GenericMiner(CWallet *pwallet, int algo)
         //
         // Search
         //
-        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+        uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits).getuint256();
         int64 nStart = GetTime();
-        uint256 hash;
         while (true)
         {
-            hash = pblock->GetPoWHash(algo);
-            if (hash <= hashTarget){
-                SetThreadPriority(THREAD_PRIORITY_NORMAL);
+            unsigned int nHashesDone = 0;
+            bool fFound = false;
+            CPoWHasher<algo> hasher(*pblock);
+            while (true)
+            {
+                uint256 hash = hasher.Hash(pblock->nNonce);
+                nHashesDone++;
+                if (hash <= hashTarget)
+                {
+                    SetThreadPriority(THREAD_PRIORITY_NORMAL);
 
-                printf("proof-of-work found  \n  hash: %s  \ntarget: %s\n", hash.GetHex().c_str(), hashTarget.GetHex().c_str());
-                pblock->print();
+                    printf("proof-of-work found  \n  hash: %s  \ntarget: %s\n", hash.GetHex().c_str(), hashTarget.GetHex().c_str());
+                    pblock->print();
 
-                CheckWork(pblock, *pwalletMain, reservekey);
-                SetThreadPriority(THREAD_PRIORITY_LOWEST);
-                break;
+                    CheckWork(pblock, *pwalletMain, reservekey);
+                    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+                    fFound = true;
+                    break;
+                }
+                if ((++pblock->nNonce & 0xff) == 0)
+                    break;
             }
-            ++pblock->nNonce;
-            
+            if (fFound)
+                break;
+
             // Meter hashes/sec
             static int64 nHashCounter;
             if (nHPSTimerStart == 0)
@@ -5124,7 +5934,7 @@ void static GenericMiner(CWallet *pwallet, int algo)
                 nHashCounter = 0;
             }
             else
-                nHashCounter += 1;
+                nHashCounter += nHashesDone;
             if (GetTimeMillis() - nHPSTimerStart > 4000)
             {
                 static CCriticalSection cs;
@@ -5149,21 +5959,19 @@ void static GenericMiner(CWallet *pwallet, int algo)
             boost::this_thread::interruption_point();
             if (vNodes.empty() && Params().NetworkID() != CChainParams::REGTEST)
                 break;
-            if (++pblock->nNonce >= 0xffff0000)
+            if (pblock->nNonce >= 0xffff0000)
                 break;
             if (nTransactionsUpdated != nTransactionsUpdatedLast && GetTime() - nStart > 60)
                 break;
             if (pindexPrev != pindexBest)
                 break;
 
-            // Update nTime every few seconds
+            // Update nTime every few seconds; the hasher is rebuilt above
             UpdateTime(*pblock, pindexPrev);
-            // nBlockTime = ByteReverse(pblock->nTime);
             if (TestNet())
             {
                 // Changing pblock->nTime can change work required on testnet:
-                // nBlockBits = ByteReverse(pblock->nBits);
-                // hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+                hashTarget = arith_uint256().SetCompact(pblock->nBits).getuint256();
             }
         }
     } 
@@ -5186,7 +5994,7 @@ void static ThreadBitcoinMiner(CWallet *pwallet)
                 ScryptMiner(pwallet);
                 break;
             case ALGO_GROESTL:
-                GenericMiner(pwallet, ALGO_GROESTL);
+                GenericMiner<ALGO_GROESTL>(pwallet);
                 break;
         }
     }
@@ -5232,10 +6040,8 @@ public:
     CMainCleanup() {}
     ~CMainCleanup() {
         // block headers
-        std::map<uint256, CBlockIndex*>::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
+        blockIndexArena.Clear();
 
         // orphan blocks
         std::map<uint256, CBlock*>::iterator it2 = mapOrphanBlocks.begin();
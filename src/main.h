@@ -7,12 +7,16 @@
 
 #include "core.h"
 #include "bignum.h"
+#include "arith_uint256.h"
 #include "sync.h"
 #include "net.h"
 #include "script.h"
 
 #include <list>
 
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
 class CWallet;
 class CBlock;
 class CBlockIndex;
@@ -52,6 +56,8 @@ static const int COINBASE_MATURITY = 100;
 static const unsigned int LOCKTIME_THRESHOLD = 500000000; // Tue Nov  5 00:53:20 1985 UTC
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
+/** Maximum number of threads reading block inputs from the coin database ahead of validation */
+static const int MAX_COINSFETCH_THREADS = 16;
 /** Default amount of block size reserved for high-priority transactions (in bytes) */
 static const int DEFAULT_BLOCK_PRIORITY_SIZE = 27000;
 #ifdef USE_UPNP
@@ -68,7 +74,15 @@ extern int miningAlgo;
 
 
 extern CCriticalSection cs_main;
-extern std::map<uint256, CBlockIndex*> mapBlockIndex;
+struct BlockHasher
+{
+    // Block hashes are the result of proof-of-work, so their low bits are
+    // already well distributed
+    size_t operator()(const uint256& hash) const { return (size_t)hash.Get64(); }
+};
+typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
+
+extern BlockMap mapBlockIndex;
 extern std::vector<CBlockIndex*> vBlockIndexByHeight;
 extern std::set<CBlockIndex*, CBlockIndexWorkComparator> setBlockIndexValid;
 extern CBlockIndex* pindexGenesisBlock;
@@ -90,8 +104,9 @@ extern bool fImporting;
 extern bool fReindex;
 extern bool fBenchmark;
 extern int nScriptCheckThreads;
+extern int nCoinsFetchThreads;
 extern bool fTxIndex;
-extern unsigned int nCoinCacheSize;
+extern size_t nCoinCacheUsage;
 extern bool fHaveGUI;
 
 // Settings
@@ -104,12 +119,15 @@ static const uint64 nMinDiskSpace = 52428800;
 class CReserveKey;
 class CCoinsDB;
 class CBlockTreeDB;
+class CCoinsViewDB;
 struct CDiskBlockPos;
 class CCoins;
 class CTxUndo;
 class CCoinsView;
 class CCoinsViewCache;
 class CScriptCheck;
+class CPoWCheck;
+class CCoinsFetch;
 class CValidationState;
 
 struct CBlockTemplate;
@@ -150,6 +168,8 @@ void UnloadBlockIndex();
 bool VerifyDB(int nCheckLevel, int nCheckDepth);
 /** Print the loaded block tree */
 void PrintBlockTree();
+/** Find the last common ancestor of two blocks, which may be on different branches */
+CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb);
 /** Find a block by height in the currently-connected chain */
 CBlockIndex* FindBlockByHeight(int nHeight);
 /** Process protocol messages received from a given node */
@@ -158,6 +178,10 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the proof-of-work checking thread */
+void ThreadPoWCheck();
+/** Run an instance of the coins prefetching thread */
+void ThreadCoinsFetch();
 /** Run the miner threads */
 void GenerateBitcoins(bool fGenerate, CWallet* pwallet);
 /** Generate a new block, without valid proof-of-work */
@@ -342,37 +366,7 @@ public:
         READWRITE(vtxundo);
     )
 
-    bool WriteToDisk(CDiskBlockPos &pos, const uint256 &hashBlock)
-    {
-        // Open history file to append
-        CAutoFile fileout = CAutoFile(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
-        if (!fileout)
-            return error("CBlockUndo::WriteToDisk() : OpenUndoFile failed");
-
-        // Write index header
-        unsigned int nSize = fileout.GetSerializeSize(*this);
-        fileout << FLATDATA(Params().MessageStart()) << nSize;
-
-        // Write undo data
-        long fileOutPos = ftell(fileout);
-        if (fileOutPos < 0)
-            return error("CBlockUndo::WriteToDisk() : ftell failed");
-        pos.nPos = (unsigned int)fileOutPos;
-        fileout << *this;
-
-        // calculate & write checksum
-        CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
-        hasher << hashBlock;
-        hasher << *this;
-        fileout << hasher.GetHash();
-
-        // Flush stdio buffers and commit to disk before returning
-        fflush(fileout);
-        if (!IsInitialBlockDownload())
-            FileCommit(fileout);
-
-        return true;
-    }
+    bool WriteToDisk(CDiskBlockPos &pos, const uint256 &hashBlock);
 
     bool ReadFromDisk(const CDiskBlockPos &pos, const uint256 &hashBlock)
     {
@@ -413,12 +407,14 @@ private:
     unsigned int nIn;
     unsigned int nFlags;
     int nHashType;
+    boost::shared_ptr<const CSigHashContext> pcontext; // shared by all inputs of ptxTo, may be empty
 
 public:
     CScriptCheck() {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, int nHashTypeIn) :
+    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, int nHashTypeIn,
+                 const boost::shared_ptr<const CSigHashContext> &pcontextIn = boost::shared_ptr<const CSigHashContext>()) :
         scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
-        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), nHashType(nHashTypeIn) { }
+        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), nHashType(nHashTypeIn), pcontext(pcontextIn) { }
 
     bool operator()() const;
 
@@ -428,6 +424,54 @@ public:
         std::swap(nIn, check.nIn);
         std::swap(nFlags, check.nFlags);
         std::swap(nHashType, check.nHashType);
+        pcontext.swap(check.pcontext);
+    }
+};
+
+/** Closure representing the proof-of-work verification of a group of block
+ *  headers. The result for each header is stored in a caller-owned array, so
+ *  one bad header does not hide the results of the others. */
+class CPoWCheck
+{
+private:
+    std::vector<CBlockHeader> vHeaders;
+    char *pfValid;
+
+public:
+    CPoWCheck() : pfValid(NULL) {}
+    CPoWCheck(const std::vector<CBlockHeader>& vHeadersIn, char *pfValidIn) :
+        vHeaders(vHeadersIn), pfValid(pfValidIn) { }
+
+    bool operator()() const;
+
+    void swap(CPoWCheck &check) {
+        vHeaders.swap(check.vHeaders);
+        std::swap(pfValid, check.pfValid);
+    }
+};
+
+/** Closure representing one coin database lookup, so the inputs of a block
+ *  can be read on several threads before it is connected. */
+class CCoinsFetch
+{
+private:
+    CCoinsView *pview;
+    uint256 txid;
+    CCoins *pcoins;
+    char *pfFound;
+
+public:
+    CCoinsFetch() : pview(NULL), pcoins(NULL), pfFound(NULL) {}
+    CCoinsFetch(CCoinsView &viewIn, const uint256 &txidIn, CCoins &coinsOut, char &fFoundOut) :
+        pview(&viewIn), txid(txidIn), pcoins(&coinsOut), pfFound(&fFoundOut) { }
+
+    bool operator()() const;
+
+    void swap(CCoinsFetch &check) {
+        std::swap(pview, check.pview);
+        std::swap(txid, check.txid);
+        std::swap(pcoins, check.pcoins);
+        std::swap(pfFound, check.pfFound);
     }
 };
 
@@ -583,8 +627,18 @@ public:
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
+/** Commit block and undo data written so far to disk, and truncate the
+ *  current files to their used size if fFinalize */
+void FlushBlockFile(bool fFinalize = false);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** Read a block through the cache of recent blocks, adding it if it was not
+ *  there yet. Returns NULL if it cannot be read. The plain ReadBlockFromDisk
+ *  also uses cached copies, but does not add to the cache, so scans over
+ *  old blocks do not push out recent ones. */
+boost::shared_ptr<const CBlock> ReadBlockFromDiskCached(const CBlockIndex* pindex);
+/** Number of PoW hash computations skipped thanks to BLOCK_POW_CHECKED */
+uint64 GetPoWChecksSkipped();
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -669,6 +723,13 @@ extern CCriticalSection cs_LastBlockFile;
 extern CBlockFileInfo infoLastBlockFile;
 extern int nLastBlockFile;
 
+/** Number of finalized block files kept memory-mapped for reading blocks */
+extern int nMappedBlockFiles;
+/** Bytes of recently accepted or served blocks kept deserialized in memory */
+extern size_t nBlockCacheSize;
+/** Seconds between commits of block files and the coin database outside initial download */
+extern int64 nSyncInterval;
+
 enum BlockStatus {
     BLOCK_VALID_UNKNOWN      =    0,
     BLOCK_VALID_HEADER       =    1, // parsed, version ok, hash satisfies claimed PoW, 1 <= vtx count <= max, timestamp not in future
@@ -684,7 +745,9 @@ enum BlockStatus {
 
     BLOCK_FAILED_VALID       =   32, // stage after last reached validness failed
     BLOCK_FAILED_CHILD       =   64, // descends from failed block
-    BLOCK_FAILED_MASK        =   96
+    BLOCK_FAILED_MASK        =   96,
+
+    BLOCK_POW_CHECKED        =  128  // PoW hash of this header verified, disk reads matching the hash skip it
 };
 
 const int64 nBlockAlgoWorkWeightStart = 142000; // block where algo work weighting starts
@@ -703,6 +766,13 @@ public:
     // pointer to the index of the predecessor of this block
     CBlockIndex* pprev;
 
+    // pointer to the index of some further predecessor of this block. See BuildSkip()
+    CBlockIndex* pskip;
+
+    // (memory only) pointers to the most recent ancestor mined with each algo,
+    // so per-algo lookups don't have to walk pprev. See BuildAlgoLinks()
+    CBlockIndex* pprevAlgo[NUM_ALGOS];
+
     // height of the entry in the chain. The genesis block has height 0
     int nHeight;
 
@@ -740,6 +810,9 @@ public:
     {
         phashBlock = NULL;
         pprev = NULL;
+        pskip = NULL;
+        for (int i = 0; i < NUM_ALGOS; i++)
+            pprevAlgo[i] = NULL;
         nHeight = 0;
         nFile = 0;
         nDataPos = 0;
@@ -760,6 +833,9 @@ public:
     {
         phashBlock = NULL;
         pprev = NULL;
+        pskip = NULL;
+        for (int i = 0; i < NUM_ALGOS; i++)
+            pprevAlgo[i] = NULL;
         nHeight = 0;
         nFile = 0;
         nDataPos = 0;
@@ -777,7 +853,28 @@ public:
     }
     
     int GetAlgo() const { return ::GetAlgo(nVersion); }
-    
+
+    // Fill pprevAlgo from pprev, which must have its own links set already
+    void BuildAlgoLinks()
+    {
+        for (int i = 0; i < NUM_ALGOS; i++)
+        {
+            if (pprev == NULL)
+                pprevAlgo[i] = NULL;
+            else if (pprev->GetAlgo() == i)
+                pprevAlgo[i] = pprev;
+            else
+                pprevAlgo[i] = pprev->pprevAlgo[i];
+        }
+    }
+
+    // Build the skiplist pointer for this entry; pprev must be set already
+    void BuildSkip();
+
+    // Efficiently find an ancestor of this block on its own branch
+    CBlockIndex* GetAncestor(int height);
+    const CBlockIndex* GetAncestor(int height) const;
+
     CDiskBlockPos GetBlockPos() const {
         CDiskBlockPos ret;
         if (nStatus & BLOCK_HAVE_DATA) {
@@ -819,13 +916,19 @@ public:
         return (int64)nTime;
     }
 
-    CBigNum GetBlockWork() const
+    arith_uint256 GetBlockWork() const
     {
-        CBigNum bnTarget;
-        bnTarget.SetCompact(nBits);
-        if (bnTarget <= 0)
+        bool fNegative;
+        bool fOverflow;
+        arith_uint256 bnTarget;
+        bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
+        if (fNegative || fOverflow || !bnTarget)
             return 0;
-        return (CBigNum(1)<<256) / (bnTarget+1);
+        // We need to compute 2**256 / (bnTarget+1), but we can't represent 2**256
+        // as it's too large for a arith_uint256. However, as 2**256 is at least as large
+        // as bnTarget+1, it is equal to ((2**256 - bnTarget - 1) / (bnTarget+1)) + 1,
+        // or ~bnTarget / (bnTarget+1) + 1.
+        return (~bnTarget / (bnTarget + 1)) + 1;
     }
 
     int GetAlgoWorkFactor() const 
@@ -852,11 +955,9 @@ public:
         }
     }
 
-    CBigNum GetBlockWorkAdjusted() const
+    arith_uint256 GetBlockWorkAdjusted() const
     {
-        CBigNum bnRes;
-        bnRes = GetBlockWork() * GetAlgoWorkFactor();
-        return bnRes;
+        return GetBlockWork() * GetAlgoWorkFactor();
     }
     
     bool IsInMainChain() const
@@ -946,6 +1047,53 @@ const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, int algo);
 const CBlockIndex* GetLastBlockIndexForAlgo(const CBlockIndex* pindex, int algo);
 
 
+/** Slab allocator for CBlockIndex entries.
+ *  Block index entries live until shutdown, so instead of a heap allocation
+ *  per block they are carved out of large contiguous slabs, which saves the
+ *  per-allocation overhead and keeps neighbouring entries close in memory.
+ */
+class CBlockIndexArena
+{
+private:
+    static const unsigned int SLAB_ENTRIES = 16384;
+
+    std::vector<CBlockIndex*> vSlabs;
+    unsigned int nUsed; // entries handed out from the last slab
+
+public:
+    CBlockIndexArena() : nUsed(SLAB_ENTRIES) {}
+    ~CBlockIndexArena() { Clear(); }
+
+    /** Return uninitialized storage for one CBlockIndex, to be used with placement new */
+    void* Allocate()
+    {
+        if (nUsed == SLAB_ENTRIES)
+        {
+            vSlabs.push_back(static_cast<CBlockIndex*>(::operator new(sizeof(CBlockIndex) * SLAB_ENTRIES)));
+            nUsed = 0;
+        }
+        return vSlabs.back() + nUsed++;
+    }
+
+    /** Destroy all entries and release the slabs */
+    void Clear()
+    {
+        for (unsigned int i = 0; i < vSlabs.size(); i++)
+        {
+            unsigned int nEntries = (i + 1 == vSlabs.size()) ? nUsed : SLAB_ENTRIES;
+            for (unsigned int j = 0; j < nEntries; j++)
+                vSlabs[i][j].~CBlockIndex();
+            ::operator delete(vSlabs[i]);
+        }
+        vSlabs.clear();
+        nUsed = SLAB_ENTRIES;
+    }
+
+    size_t size() const { return vSlabs.empty() ? 0 : (vSlabs.size() - 1) * SLAB_ENTRIES + nUsed; }
+};
+
+
+
 /** Used to marshal pointers into hashes for db storage. */
 class CDiskBlockIndex : public CBlockIndex
 {
@@ -1169,9 +1317,52 @@ struct CCoinsStats
     uint256 hashSerialized;
     int64 nTotalAmount;
 
-    CCoinsStats() : nHeight(0), hashBlock(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), hashSerialized(0), nTotalAmount(0) {}
+    // Set by the caller to request hashSerialized. Computing it needs a
+    // single sequential pass over the coins, so leave it unset for a faster
+    // parallel scan. Stays set if the result includes the hash.
+    bool fHashSerialized;
+
+    CCoinsStats() : nHeight(0), hashBlock(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), hashSerialized(0), nTotalAmount(0), fHashSerialized(true) {}
+};
+
+/** Hasher for the coins cache. The key is mixed with a per-instance random
+ *  salt, so transaction ids cannot be ground to land in the same bucket. */
+class CCoinsKeyHasher
+{
+private:
+    uint64 k0, k1;
+
+public:
+    CCoinsKeyHasher();
+
+    size_t operator()(const uint256& key) const
+    {
+        uint64 h = k0;
+        for (int i = 0; i < 4; i++)
+        {
+            h = (h ^ key.Get64(i)) * 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+        }
+        h = (h ^ k1) * 0xc4ceb9fe1a85ec53ULL;
+        return (size_t)(h ^ (h >> 33));
+    }
 };
 
+struct CCoinsCacheEntry
+{
+    CCoins coins;
+    unsigned char flags;
+
+    enum Flags {
+        DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
+        FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
+    };
+
+    CCoinsCacheEntry() : coins(), flags(0) {}
+};
+
+typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
+
 /** Abstract view on the open txout dataset. */
 class CCoinsView
 {
@@ -1192,8 +1383,9 @@ public:
     // Modify the currently active block index
     virtual bool SetBestBlock(CBlockIndex *pindex);
 
-    // Do a bulk modification (multiple SetCoins + one SetBestBlock)
-    virtual bool BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex);
+    // Do a bulk modification (multiple SetCoins + one SetBestBlock).
+    // Only entries flagged DIRTY are written.
+    virtual bool BatchWrite(const CCoinsMap &mapCoins, CBlockIndex *pindex);
 
     // Calculate statistics about the unspent transaction output set
     virtual bool GetStats(CCoinsStats &stats);
@@ -1216,19 +1408,55 @@ public:
     CBlockIndex *GetBestBlock();
     bool SetBestBlock(CBlockIndex *pindex);
     void SetBackend(CCoinsView &viewIn);
-    bool BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex);
+    bool BatchWrite(const CCoinsMap &mapCoins, CBlockIndex *pindex);
     bool GetStats(CCoinsStats &stats);
 };
 
+/** A reference to a mutable cache entry, returned by CCoinsViewCache::ModifyCoins.
+ *  When it goes out of scope the entry is cleaned up and the memory usage of
+ *  the cache is updated. Only one may exist per cache at a time, and the
+ *  cache must not be used otherwise while it does. Copying transfers the
+ *  reference, so returning it by value is safe. */
+class CCoinsModifier
+{
+private:
+    CCoinsViewCache& cache;
+    CCoinsMap::iterator it;
+    size_t nUsageBefore; // memory usage of the CCoins before modification
+    mutable bool fActive;
+
+    CCoinsModifier(CCoinsViewCache& cacheIn, CCoinsMap::iterator itIn, size_t nUsage);
+    CCoinsModifier& operator=(const CCoinsModifier&);
+
+public:
+    CCoinsModifier(const CCoinsModifier& other);
+    ~CCoinsModifier();
+    CCoins* operator->() { return &it->second.coins; }
+    CCoins& operator*() { return it->second.coins; }
+
+    friend class CCoinsViewCache;
+};
+
 /** CCoinsView that adds a memory cache for transactions to another CCoinsView */
 class CCoinsViewCache : public CCoinsViewBacked
 {
 protected:
     CBlockIndex *pindexTip;
-    std::map<uint256,CCoins> cacheCoins;
+    CCoinsMap cacheCoins;
+    bool fHasModifier;
+
+    // Memory held by the CCoins objects in cacheCoins; the map itself is
+    // accounted for in DynamicMemoryUsage()
+    size_t nCachedCoinsUsage;
+
+    // Statistics for getcoinscacheinfo
+    uint64 nHits;
+    uint64 nMisses;
+    uint64 nFlushes;
 
 public:
     CCoinsViewCache(CCoinsView &baseIn, bool fDummy = false);
+    ~CCoinsViewCache();
 
     // Standard CCoinsView methods
     bool GetCoins(const uint256 &txid, CCoins &coins);
@@ -1236,20 +1464,46 @@ public:
     bool HaveCoins(const uint256 &txid);
     CBlockIndex *GetBestBlock();
     bool SetBestBlock(CBlockIndex *pindex);
-    bool BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex);
+    bool BatchWrite(const CCoinsMap &mapCoins, CBlockIndex *pindex);
+
+    // Return a reference to a CCoins without copying it. Check HaveCoins first.
+    // Many methods explicitly require a CCoinsViewCache because of this method.
+    const CCoins &GetCoins(const uint256 &txid);
 
-    // Return a modifiable reference to a CCoins. Check HaveCoins first.
-    // Many methods explicitly require a CCoinsViewCache because of this method, to reduce
-    // copying.
-    CCoins &GetCoins(const uint256 &txid);
+    // Return a modifier for a CCoins, creating an empty (pruned) one if needed.
+    // The entry is marked dirty, so only use this to change it.
+    CCoinsModifier ModifyCoins(const uint256 &txid);
+
+    // Like ModifyCoins, but for the outputs of a transaction being added, which
+    // the caller knows have no unspent entry in the base (see BIP30 in
+    // ConnectBlock). The base is not read, and the entry is marked fresh.
+    CCoinsModifier ModifyNewCoins(const uint256 &txid);
 
     // Push the modifications applied to this cache to its base.
     // Failure to call this method before destruction will cause the changes to be forgotten.
+    // Unmodified entries stay cached; fully spent ones are dropped.
     bool Flush();
 
+    // Drop unmodified entries until the memory usage is at most nMaxUsage bytes
+    void Trim(size_t nMaxUsage);
+
+    // Load the entries for txids that are not cached yet, reading them from
+    // the base on the coins prefetch threads. The base must allow concurrent
+    // GetCoins calls.
+    void Prefetch(const std::vector<uint256> &vTxid);
+
     // Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize();
 
+    // Calculate the heap memory used by the cache, in bytes
+    size_t DynamicMemoryUsage() const;
+
+    // Lookups answered from the cache and lookups that went to the base,
+    // and the number of successful flushes
+    uint64 GetHits() const { return nHits; }
+    uint64 GetMisses() const { return nMisses; }
+    uint64 GetFlushes() const { return nFlushes; }
+
     /** Amount of bitcoins coming in to a transaction
         Note that lightweight clients may not know anything besides the hash of previous transactions,
         so may not be able to calculate this.
@@ -1266,7 +1520,9 @@ public:
     const CTxOut &GetOutputFor(const CTxIn& input);
 
 private:
-    std::map<uint256,CCoins>::iterator FetchCoins(const uint256 &txid);
+    CCoinsMap::iterator FetchCoins(const uint256 &txid);
+
+    friend class CCoinsModifier;
 };
 
 /** CCoinsView that brings transactions from a memorypool into view.
@@ -1282,12 +1538,61 @@ public:
     bool HaveCoins(const uint256 &txid);
 };
 
+/** CCoinsView that hands batches to a background thread which writes them
+    to its base, so flushing the coins cache does not stall block processing.
+    While a batch is being written its entries stay readable here. A second
+    BatchWrite waits for the previous one to finish. Each batch is written
+    together with its best block marker, so the base is always consistent. */
+class CCoinsViewAsyncFlush : public CCoinsViewBacked
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    CCoinsMap mapPending;        // batch being written (protected by mutex)
+    CBlockIndex *pindexPending;  // best block of that batch
+    size_t nPendingUsage;        // memory held by mapPending (protected by mutex)
+    bool fPending;               // whether the writer thread owns mapPending
+    bool fFailed;                // a background write failed
+    bool fStop;
+    boost::thread threadWriter;
+
+    void ThreadWriter();
+
+public:
+    CCoinsViewAsyncFlush(CCoinsView &baseIn);
+    ~CCoinsViewAsyncFlush();
+
+    bool GetCoins(const uint256 &txid, CCoins &coins);
+    bool HaveCoins(const uint256 &txid);
+    CBlockIndex *GetBestBlock();
+    bool SetBestBlock(CBlockIndex *pindex);
+    bool BatchWrite(const CCoinsMap &mapCoins, CBlockIndex *pindex);
+    bool GetStats(CCoinsStats &stats);
+
+    // Wait until the batch in flight (if any) is written. Returns false if
+    // any background write failed.
+    bool Sync();
+
+    // Heap memory held by the batch in flight, which is a copy of the dirty
+    // entries of the cache that was flushed
+    size_t DynamicMemoryUsage();
+};
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
+/** Global variable that points to the coin database below pcoinsTip (protected by cs_main) */
+extern CCoinsViewDB *pcoinsdbview;
+
+/** Global variable that points to the background writer between pcoinsTip and pcoinsdbview (protected by cs_main) */
+extern CCoinsViewAsyncFlush *pcoinsflush;
+
+/** Memory used by pcoinsTip, plus the batch it last flushed while that is still being written */
+size_t GetCoinsCacheUsage();
+
 struct CBlockTemplate
 {
     CBlock block;
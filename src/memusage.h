@@ -0,0 +1,52 @@
+// Copyright (c) 2013 The Trinity developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_MEMUSAGE_H
+#define BITCOIN_MEMUSAGE_H
+
+#include <stdlib.h>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+
+/** Estimates of the heap memory used by containers, including the
+ *  bookkeeping overhead of the allocator. These are approximations tuned
+ *  for glibc malloc; they only need to be close enough to size caches. */
+namespace memusage
+{
+
+/** Bytes really taken by a malloc of the given size */
+static inline size_t MallocUsage(size_t alloc)
+{
+    if (alloc == 0)
+        return 0;
+    // 8 bytes of header, rounded up to the 16 (64-bit) or 8 (32-bit) byte granularity
+    if (sizeof(void*) == 8)
+        return ((alloc + 31) >> 4) << 4;
+    return ((alloc + 15) >> 3) << 3;
+}
+
+template<typename X>
+static inline size_t DynamicUsage(const std::vector<X>& v)
+{
+    return MallocUsage(v.capacity() * sizeof(X));
+}
+
+// Layout of a boost::unordered_map node: the value plus the bucket chain link
+template<typename X>
+struct unordered_node : private X
+{
+private:
+    void* ptr;
+};
+
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z>& m)
+{
+    return MallocUsage(sizeof(unordered_node<std::pair<const X, Y> >)) * m.size() +
+           MallocUsage(sizeof(void*) * m.bucket_count());
+}
+
+}
+
+#endif
@@ -0,0 +1,125 @@
+// Copyright (c) 2013 The Trinity developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "powhash.h"
+#include "scrypt.h"
+#include "sha256.h"
+#include "util.h"
+
+#include <string.h>
+
+static inline uint32_t be32dec(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline void be32enc(unsigned char *p, uint32_t x)
+{
+    p[0] = (unsigned char)(x >> 24);
+    p[1] = (unsigned char)(x >> 16);
+    p[2] = (unsigned char)(x >> 8);
+    p[3] = (unsigned char)x;
+}
+
+// Nonce as the big-endian message word SHA-256 reads from its serialized bytes
+static inline uint32_t NonceWord(unsigned int nNonce)
+{
+    unsigned char vch[4];
+    le32enc(vch, nNonce);
+    return be32dec(vch);
+}
+
+// Final SHA-256 state to digest bytes
+static inline uint256 StateToHash(const uint32_t *state)
+{
+    uint256 hash;
+    for (int i = 0; i < 8; i++)
+        be32enc(hash.begin() + 4 * i, state[i]);
+    return hash;
+}
+
+CPoWHasher<ALGO_SHA256D>::CPoWHasher(const CBlockHeader& header)
+{
+    const unsigned char *p = (const unsigned char*)BEGIN(header.nVersion);
+    uint32_t block[16];
+    for (int i = 0; i < 16; i++)
+        block[i] = be32dec(p + 4 * i);
+    memcpy(midstate, sha256_init_state, sizeof(midstate));
+    sha256_transform(midstate, block);
+    for (int i = 0; i < 3; i++)
+        tail[i] = be32dec(p + 64 + 4 * i);
+}
+
+uint256 CPoWHasher<ALGO_SHA256D>::Hash(unsigned int nNonce) const
+{
+    // Second chunk of the 80-byte header, padded to a 640-bit message
+    uint32_t block[16];
+    block[0] = tail[0];
+    block[1] = tail[1];
+    block[2] = tail[2];
+    block[3] = NonceWord(nNonce);
+    block[4] = 0x80000000;
+    for (int i = 5; i < 15; i++)
+        block[i] = 0;
+    block[15] = 640;
+    uint32_t state[8];
+    memcpy(state, midstate, sizeof(state));
+    sha256_transform(state, block);
+
+    // Second SHA-256 over the 32-byte digest
+    for (int i = 0; i < 8; i++)
+        block[i] = state[i];
+    block[8] = 0x80000000;
+    for (int i = 9; i < 15; i++)
+        block[i] = 0;
+    block[15] = 256;
+    memcpy(state, sha256_init_state, sizeof(state));
+    sha256_transform(state, block);
+    return StateToHash(state);
+}
+
+CPoWHasher<ALGO_SCRYPT>::CPoWHasher(const CBlockHeader& header)
+{
+    memcpy(this->header, BEGIN(header.nVersion), sizeof(this->header));
+}
+
+uint256 CPoWHasher<ALGO_SCRYPT>::Hash(unsigned int nNonce) const
+{
+    char input[80];
+    memcpy(input, header, 76);
+    le32enc(input + 76, nNonce);
+    uint256 hash;
+    scrypt_1024_1_1_256(input, BEGIN(hash));
+    return hash;
+}
+
+CPoWHasher<ALGO_GROESTL>::CPoWHasher(const CBlockHeader& header)
+{
+    sph_groestl512_init(&ctx);
+    sph_groestl512(&ctx, BEGIN(header.nVersion), 76);
+}
+
+uint256 CPoWHasher<ALGO_GROESTL>::Hash(unsigned int nNonce) const
+{
+    unsigned char vchNonce[4];
+    le32enc(vchNonce, nNonce);
+    sph_groestl512_context ctxNonce = ctx;
+    sph_groestl512(&ctxNonce, vchNonce, sizeof(vchNonce));
+    unsigned char digest[64];
+    sph_groestl512_close(&ctxNonce, digest);
+
+    // SHA-256 of the 64-byte digest: one data block and one padding block
+    uint32_t block[16];
+    for (int i = 0; i < 16; i++)
+        block[i] = be32dec(digest + 4 * i);
+    uint32_t state[8];
+    memcpy(state, sha256_init_state, sizeof(state));
+    sha256_transform(state, block);
+    block[0] = 0x80000000;
+    for (int i = 1; i < 15; i++)
+        block[i] = 0;
+    block[15] = 512;
+    sha256_transform(state, block);
+    return StateToHash(state);
+}
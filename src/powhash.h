@@ -0,0 +1,56 @@
+// Copyright (c) 2013 The Trinity developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef TRINITY_POWHASH_H
+#define TRINITY_POWHASH_H
+
+#include "core.h"
+#include "sph_groestl.h"
+
+/** Proof-of-work hasher specialized per algo at compile time.
+ *
+ * The constructor absorbs everything in the 80-byte header up to the nonce,
+ * so Hash() only has to process the last 4 bytes plus the fixed finalization.
+ * Nothing is allocated, and a hasher may be reused for any number of nonces
+ * as long as the rest of the header is unchanged. Hash(pblock->nNonce) gives
+ * the same result as pblock->GetPoWHash(algo).
+ */
+template<int algo> class CPoWHasher;
+
+/** sha256d: the first 64 bytes are compressed once into a midstate. */
+template<> class CPoWHasher<ALGO_SHA256D>
+{
+private:
+    uint32_t midstate[8];
+    uint32_t tail[3]; // bytes 64..75 as big-endian words
+
+public:
+    explicit CPoWHasher(const CBlockHeader& header);
+    uint256 Hash(unsigned int nNonce) const;
+};
+
+/** scrypt: the PBKDF2 key is the whole header including the nonce, so there
+ *  is no prefix state to keep; only the header copy is reused. */
+template<> class CPoWHasher<ALGO_SCRYPT>
+{
+private:
+    unsigned char header[80];
+
+public:
+    explicit CPoWHasher(const CBlockHeader& header);
+    uint256 Hash(unsigned int nNonce) const;
+};
+
+/** groestl: Groestl-512 state after the first 76 bytes, followed by a
+ *  single SHA-256 of the 64-byte digest. */
+template<> class CPoWHasher<ALGO_GROESTL>
+{
+private:
+    sph_groestl512_context ctx;
+
+public:
+    explicit CPoWHasher(const CBlockHeader& header);
+    uint256 Hash(unsigned int nNonce) const;
+};
+
+#endif
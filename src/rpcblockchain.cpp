@@ -6,6 +6,7 @@
 #include "main.h"
 #include "bitcoinrpc.h"
 #include "core.h"
+#include "txdb.h"
 
 using namespace json_spirit;
 using namespace std;
@@ -185,9 +186,11 @@ Value getblock(const Array& params, bool fHelp)
     if (mapBlockIndex.count(hash) == 0)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
-    ReadBlockFromDisk(block, pblockindex);
+    boost::shared_ptr<const CBlock> pblock = ReadBlockFromDiskCached(pblockindex);
+    if (!pblock)
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Can't read block from disk");
+    const CBlock &block = *pblock;
 
     if (!fVerbose)
     {
@@ -202,26 +205,122 @@ Value getblock(const Array& params, bool fHelp)
 
 Value gettxoutsetinfo(const Array& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gettxoutsetinfo\n"
-            "Returns statistics about the unspent transaction output set.");
+            "gettxoutsetinfo [hash_serialized=true]\n"
+            "Returns statistics about the unspent transaction output set.\n"
+            "The result is kept until the next block is written to the coin database.\n"
+            "Computing hash_serialized requires a sequential scan; pass false to omit\n"
+            "it and scan the database on several threads instead.");
 
     Object ret;
 
     CCoinsStats stats;
+    if (params.size() > 0)
+        stats.fHashSerialized = params[0].get_bool();
     if (pcoinsTip->GetStats(stats)) {
         ret.push_back(Pair("height", (boost::int64_t)stats.nHeight));
         ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
         ret.push_back(Pair("transactions", (boost::int64_t)stats.nTransactions));
         ret.push_back(Pair("txouts", (boost::int64_t)stats.nTransactionOutputs));
         ret.push_back(Pair("bytes_serialized", (boost::int64_t)stats.nSerializedSize));
-        ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+        if (stats.fHashSerialized)
+            ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     }
     return ret;
 }
 
+// Internals of one LevelDB database; vRanges names the key types to size
+static Object DBStatsToJSON(CLevelDB &db, const std::vector<std::pair<std::string, char> > &vRanges)
+{
+    Object ret;
+    ret.push_back(Pair("options", db.GetDBOptions().ToString()));
+
+    Object sizes;
+    for (unsigned int i = 0; i < vRanges.size(); i++)
+        sizes.push_back(Pair(vRanges[i].first, (boost::int64_t)db.GetApproximateSize(std::string(1, vRanges[i].second), std::string(1, vRanges[i].second + 1))));
+    sizes.push_back(Pair("total", (boost::int64_t)db.GetApproximateSize(std::string(), std::string(1, '\xff'))));
+    ret.push_back(Pair("approximate_sizes", sizes));
+
+    Array files;
+    for (int nLevel = 0; ; nLevel++) {
+        std::string strFiles;
+        if (!db.GetProperty(strprintf("leveldb.num-files-at-level%d", nLevel), strFiles))
+            break;
+        files.push_back(atoi(strFiles));
+    }
+    ret.push_back(Pair("files_per_level", files));
+
+    std::string strStats;
+    if (db.GetProperty("leveldb.stats", strStats))
+        ret.push_back(Pair("stats", strStats));
+    return ret;
+}
+
+Value dbstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "dbstats\n"
+            "Returns LevelDB tuning, approximate sizes on disk, files per level and\n"
+            "compaction statistics of the coin database and the block index.");
+
+    std::vector<std::pair<std::string, char> > vRanges;
+    Object ret;
+    if (pcoinsdbview) {
+        vRanges.push_back(std::make_pair("coins", 'c'));
+        ret.push_back(Pair("chainstate", DBStatsToJSON(pcoinsdbview->GetDB(), vRanges)));
+    }
+    if (pblocktree) {
+        vRanges.clear();
+        vRanges.push_back(std::make_pair("blocks", 'b'));
+        vRanges.push_back(std::make_pair("files", 'f'));
+        vRanges.push_back(std::make_pair("txindex", 't'));
+        ret.push_back(Pair("blockindex", DBStatsToJSON(*pblocktree, vRanges)));
+    }
+    return ret;
+}
+
+Value getcoinscacheinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getcoinscacheinfo\n"
+            "Returns memory usage and effectiveness of the in-memory coins cache.");
+
+    Object ret;
+    uint64 nHits = pcoinsTip->GetHits();
+    uint64 nMisses = pcoinsTip->GetMisses();
+    ret.push_back(Pair("entries", (boost::int64_t)pcoinsTip->GetCacheSize()));
+    ret.push_back(Pair("usage", (boost::int64_t)GetCoinsCacheUsage()));
+    ret.push_back(Pair("pendingusage", (boost::int64_t)(pcoinsflush ? pcoinsflush->DynamicMemoryUsage() : 0)));
+    ret.push_back(Pair("limit", (boost::int64_t)nCoinCacheUsage));
+    ret.push_back(Pair("hits", (boost::int64_t)nHits));
+    ret.push_back(Pair("misses", (boost::int64_t)nMisses));
+    ret.push_back(Pair("hitrate", nHits + nMisses ? (double)nHits / (nHits + nMisses) : 0.0));
+    ret.push_back(Pair("flushes", (boost::int64_t)pcoinsTip->GetFlushes()));
+    return ret;
+}
+
+Value getsigcacheinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "Returns size and effectiveness of the valid signature cache.");
+
+    CSignatureCacheStats stats;
+    GetSignatureCacheStats(stats);
+    Object ret;
+    ret.push_back(Pair("entries", (boost::int64_t)stats.nEntries));
+    ret.push_back(Pair("limit", (boost::int64_t)stats.nMaxEntries));
+    ret.push_back(Pair("hits", (boost::int64_t)stats.nHits));
+    ret.push_back(Pair("misses", (boost::int64_t)stats.nMisses));
+    ret.push_back(Pair("hitrate", stats.nHits + stats.nMisses ? (double)stats.nHits / (stats.nHits + stats.nMisses) : 0.0));
+    return ret;
+}
+
 Value gettxout(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
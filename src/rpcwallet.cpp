@@ -84,6 +84,7 @@ Value getinfo(const Array& params, bool fHelp)
     obj.push_back(Pair("difficulty_sha256d", (double)GetDifficulty(NULL, ALGO_SHA256D)));
     obj.push_back(Pair("difficulty_scrypt",  (double)GetDifficulty(NULL, ALGO_SCRYPT)));
     obj.push_back(Pair("difficulty_groestl", (double)GetDifficulty(NULL, ALGO_GROESTL)));
+    obj.push_back(Pair("powcheckskipped",    (boost::uint64_t)GetPoWChecksSkipped()));
     obj.push_back(Pair("testnet",            TestNet()));
     obj.push_back(Pair("keypoololdest",      (boost::int64_t)pwalletMain->GetOldestKeyPoolTime()));
     obj.push_back(Pair("keypoolsize",        pwalletMain->GetKeyPoolSize()));
@@ -1192,10 +1193,7 @@ Value listsinceblock(const Array& params, bool fHelp)
     {
         int target_height = pindexBest->nHeight + 1 - target_confirms;
 
-        CBlockIndex *block;
-        for (block = pindexBest;
-             block && block->nHeight > target_height;
-             block = block->pprev)  { }
+        CBlockIndex *block = pindexBest->GetAncestor(target_height);
 
         lastblock = block ? block->GetBlockHash() : 0;
     }
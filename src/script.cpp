@@ -3,7 +3,8 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 #include <boost/foreach.hpp>
-#include <boost/tuple/tuple.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/unordered_set.hpp>
 
 using namespace std;
 using namespace boost;
@@ -16,30 +17,20 @@ using namespace boost;
 #include "sync.h"
 #include "util.h"
 
-bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubKey, const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, int flags);
+bool CheckSig(CStackElement vchSig, const CStackElement &vchPubKey, const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, int flags, const CSigHashContext *pcontext);
 
 
 
 typedef vector<unsigned char> valtype;
-static const valtype vchFalse(0);
-static const valtype vchZero(0);
-static const valtype vchTrue(1, 1);
-static const CBigNum bnZero(0);
-static const CBigNum bnOne(1);
-static const CBigNum bnFalse(0);
-static const CBigNum bnTrue(1);
-static const size_t nMaxNumSize = 4;
-
-
-CBigNum CastToBigNum(const valtype& vch)
-{
-    if (vch.size() > nMaxNumSize)
-        throw runtime_error("CastToBigNum() : overflow");
-    // Get rid of extra leading zeros
-    return CBigNum(CBigNum(vch).getvch());
-}
-
-bool CastToBool(const valtype& vch)
+static const unsigned char chTrue = 1;
+static const CStackElement vchFalse;
+static const CStackElement vchTrue(&chTrue, &chTrue + 1);
+static const CScriptNum bnZero(0);
+static const CScriptNum bnOne(1);
+static const CScriptNum bnFalse(0);
+static const CScriptNum bnTrue(1);
+
+static bool CastToBool(const CStackElement& vch)
 {
     for (unsigned int i = 0; i < vch.size(); i++)
     {
@@ -62,13 +53,36 @@ bool CastToBool(const valtype& vch)
 //
 #define stacktop(i)  (stack.at(stack.size()+(i)))
 #define altstacktop(i)  (altstack.at(altstack.size()+(i)))
-static inline void popstack(vector<valtype>& stack)
+static inline void popstack(CScriptStack& stack)
 {
     if (stack.empty())
         throw runtime_error("popstack() : stack empty");
     stack.pop_back();
 }
 
+/** Buffers reused by the interpreter, one set per thread. Their capacity is
+ *  kept between calls, so once they have grown to fit the scripts being
+ *  verified, checking an input does not allocate. */
+struct CScriptScratch
+{
+    CScriptStack stack;
+    CScriptStack stackCopy;
+    CScriptStack altstack;
+    vector<bool> vfExec;
+    valtype vchPushValue;
+    CScript scriptCode;
+    CScript scriptRedeem;
+};
+
+static boost::thread_specific_ptr<CScriptScratch> scriptScratch;
+
+static CScriptScratch &GetScriptScratch()
+{
+    if (scriptScratch.get() == NULL)
+        scriptScratch.reset(new CScriptScratch());
+    return *scriptScratch;
+}
+
 
 const char* GetTxnOutputType(txnouttype t)
 {
@@ -227,7 +241,8 @@ const char* GetOpName(opcodetype opcode)
     }
 }
 
-bool IsCanonicalPubKey(const valtype &vchPubKey) {
+template<typename T>
+static bool IsCanonicalPubKeyT(const T &vchPubKey) {
     if (vchPubKey.size() < 33)
         return error("Non-canonical public key: too short");
     if (vchPubKey[0] == 0x04) {
@@ -242,7 +257,16 @@ bool IsCanonicalPubKey(const valtype &vchPubKey) {
     return true;
 }
 
-bool IsCanonicalSignature(const valtype &vchSig) {
+bool IsCanonicalPubKey(const valtype &vchPubKey) {
+    return IsCanonicalPubKeyT(vchPubKey);
+}
+
+bool IsCanonicalPubKey(const CStackElement &vchPubKey) {
+    return IsCanonicalPubKeyT(vchPubKey);
+}
+
+template<typename T>
+static bool IsCanonicalSignatureT(const T &vchSig) {
     // See https://bitcointalk.org/index.php?topic=8392.msg127623#msg127623
     // A canonical signature exists of: <30> <total len> <02> <len R> <R> <02> <len S> <S> <hashtype>
     // Where R and S are not negative (their first byte has its highest bit not set), and not
@@ -289,16 +313,36 @@ bool IsCanonicalSignature(const valtype &vchSig) {
     return true;
 }
 
-bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType)
+bool IsCanonicalSignature(const valtype &vchSig) {
+    return IsCanonicalSignatureT(vchSig);
+}
+
+bool IsCanonicalSignature(const CStackElement &vchSig) {
+    return IsCanonicalSignatureT(vchSig);
+}
+
+// Drops pushes of vchSig from scriptCode. Signatures practically never appear
+// in the script they sign, so the push pattern is only built if the bytes are
+// there at all.
+static void DeleteSignature(CScript &scriptCode, const CStackElement &vchSig)
 {
-    CAutoBN_CTX pctx;
+    if (!vchSig.empty() && search(scriptCode.begin(), scriptCode.end(), vchSig.begin(), vchSig.end()) == scriptCode.end())
+        return;
+    scriptCode.FindAndDelete(CScript(vchSig.getvch()));
+}
+
+bool EvalScript(CScriptStack& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, const CSigHashContext *pcontext)
+{
+    CScriptScratch &scratch = GetScriptScratch();
     CScript::const_iterator pc = script.begin();
     CScript::const_iterator pend = script.end();
     CScript::const_iterator pbegincodehash = script.begin();
     opcodetype opcode;
-    valtype vchPushValue;
-    vector<bool> vfExec;
-    vector<valtype> altstack;
+    valtype &vchPushValue = scratch.vchPushValue;
+    vector<bool> &vfExec = scratch.vfExec;
+    CScriptStack &altstack = scratch.altstack;
+    vfExec.clear();
+    altstack.clear();
     if (script.size() > 10000)
         return false;
     int nOpCount = 0;
@@ -364,8 +408,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 case OP_16:
                 {
                     // ( -- value)
-                    CBigNum bn((int)opcode - (int)(OP_1 - 1));
-                    stack.push_back(bn.getvch());
+                    CScriptNum bn((int)opcode - (int)(OP_1 - 1));
+                    bn.getvch(stack.push_slot());
                 }
                 break;
 
@@ -387,7 +431,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     {
                         if (stack.size() < 1)
                             return false;
-                        valtype& vch = stacktop(-1);
+                        CStackElement& vch = stacktop(-1);
                         fValue = CastToBool(vch);
                         if (opcode == OP_NOTIF)
                             fValue = !fValue;
@@ -470,8 +514,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- x1 x2 x1 x2)
                     if (stack.size() < 2)
                         return false;
-                    valtype vch1 = stacktop(-2);
-                    valtype vch2 = stacktop(-1);
+                    CStackElement vch1 = stacktop(-2);
+                    CStackElement vch2 = stacktop(-1);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                 }
@@ -482,9 +526,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 x3 -- x1 x2 x3 x1 x2 x3)
                     if (stack.size() < 3)
                         return false;
-                    valtype vch1 = stacktop(-3);
-                    valtype vch2 = stacktop(-2);
-                    valtype vch3 = stacktop(-1);
+                    CStackElement vch1 = stacktop(-3);
+                    CStackElement vch2 = stacktop(-2);
+                    CStackElement vch3 = stacktop(-1);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                     stack.push_back(vch3);
@@ -496,8 +540,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 x3 x4 -- x1 x2 x3 x4 x1 x2)
                     if (stack.size() < 4)
                         return false;
-                    valtype vch1 = stacktop(-4);
-                    valtype vch2 = stacktop(-3);
+                    CStackElement vch1 = stacktop(-4);
+                    CStackElement vch2 = stacktop(-3);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                 }
@@ -508,8 +552,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 x3 x4 x5 x6 -- x3 x4 x5 x6 x1 x2)
                     if (stack.size() < 6)
                         return false;
-                    valtype vch1 = stacktop(-6);
-                    valtype vch2 = stacktop(-5);
+                    CStackElement vch1 = stacktop(-6);
+                    CStackElement vch2 = stacktop(-5);
                     stack.erase(stack.end()-6, stack.end()-4);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
@@ -531,7 +575,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x - 0 | x x)
                     if (stack.size() < 1)
                         return false;
-                    valtype vch = stacktop(-1);
+                    CStackElement vch = stacktop(-1);
                     if (CastToBool(vch))
                         stack.push_back(vch);
                 }
@@ -540,8 +584,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 case OP_DEPTH:
                 {
                     // -- stacksize
-                    CBigNum bn(stack.size());
-                    stack.push_back(bn.getvch());
+                    CScriptNum bn(stack.size());
+                    bn.getvch(stack.push_slot());
                 }
                 break;
 
@@ -559,7 +603,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x -- x x)
                     if (stack.size() < 1)
                         return false;
-                    valtype vch = stacktop(-1);
+                    CStackElement vch = stacktop(-1);
                     stack.push_back(vch);
                 }
                 break;
@@ -578,7 +622,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- x1 x2 x1)
                     if (stack.size() < 2)
                         return false;
-                    valtype vch = stacktop(-2);
+                    CStackElement vch = stacktop(-2);
                     stack.push_back(vch);
                 }
                 break;
@@ -590,11 +634,11 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (xn ... x2 x1 x0 n - ... x2 x1 x0 xn)
                     if (stack.size() < 2)
                         return false;
-                    int n = CastToBigNum(stacktop(-1)).getint();
+                    int n = CScriptNum(stacktop(-1)).getint();
                     popstack(stack);
                     if (n < 0 || n >= (int)stack.size())
                         return false;
-                    valtype vch = stacktop(-n-1);
+                    CStackElement vch = stacktop(-n-1);
                     if (opcode == OP_ROLL)
                         stack.erase(stack.end()-n-1);
                     stack.push_back(vch);
@@ -627,7 +671,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- x2 x1 x2)
                     if (stack.size() < 2)
                         return false;
-                    valtype vch = stacktop(-1);
+                    CStackElement vch = stacktop(-1);
                     stack.insert(stack.end()-2, vch);
                 }
                 break;
@@ -638,8 +682,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (in -- in size)
                     if (stack.size() < 1)
                         return false;
-                    CBigNum bn(stacktop(-1).size());
-                    stack.push_back(bn.getvch());
+                    CScriptNum bn(stacktop(-1).size());
+                    bn.getvch(stack.push_slot());
                 }
                 break;
 
@@ -654,8 +698,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 - bool)
                     if (stack.size() < 2)
                         return false;
-                    valtype& vch1 = stacktop(-2);
-                    valtype& vch2 = stacktop(-1);
+                    CStackElement& vch1 = stacktop(-2);
+                    CStackElement& vch2 = stacktop(-1);
                     bool fEqual = (vch1 == vch2);
                     // OP_NOTEQUAL is disabled because it would be too easy to say
                     // something like n != 1 and have some wiseguy pass in 1 with extra
@@ -689,7 +733,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (in -- out)
                     if (stack.size() < 1)
                         return false;
-                    CBigNum bn = CastToBigNum(stacktop(-1));
+                    CScriptNum bn(stacktop(-1));
                     switch (opcode)
                     {
                     case OP_1ADD:       bn += bnOne; break;
@@ -701,7 +745,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     default:            assert(!"invalid opcode"); break;
                     }
                     popstack(stack);
-                    stack.push_back(bn.getvch());
+                    bn.getvch(stack.push_slot());
                 }
                 break;
 
@@ -722,9 +766,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- out)
                     if (stack.size() < 2)
                         return false;
-                    CBigNum bn1 = CastToBigNum(stacktop(-2));
-                    CBigNum bn2 = CastToBigNum(stacktop(-1));
-                    CBigNum bn;
+                    CScriptNum bn1(stacktop(-2));
+                    CScriptNum bn2(stacktop(-1));
+                    CScriptNum bn(0);
                     switch (opcode)
                     {
                     case OP_ADD:
@@ -750,7 +794,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     }
                     popstack(stack);
                     popstack(stack);
-                    stack.push_back(bn.getvch());
+                    bn.getvch(stack.push_slot());
 
                     if (opcode == OP_NUMEQUALVERIFY)
                     {
@@ -767,9 +811,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x min max -- out)
                     if (stack.size() < 3)
                         return false;
-                    CBigNum bn1 = CastToBigNum(stacktop(-3));
-                    CBigNum bn2 = CastToBigNum(stacktop(-2));
-                    CBigNum bn3 = CastToBigNum(stacktop(-1));
+                    CScriptNum bn1(stacktop(-3));
+                    CScriptNum bn2(stacktop(-2));
+                    CScriptNum bn3(stacktop(-1));
                     bool fValue = (bn2 <= bn1 && bn1 < bn3);
                     popstack(stack);
                     popstack(stack);
@@ -791,26 +835,27 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (in -- hash)
                     if (stack.size() < 1)
                         return false;
-                    valtype& vch = stacktop(-1);
-                    valtype vchHash((opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32);
+                    CStackElement& vch = stacktop(-1);
+                    unsigned char vchHash[32];
+                    unsigned int nHashSize = (opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32;
                     if (opcode == OP_RIPEMD160)
-                        RIPEMD160(&vch[0], vch.size(), &vchHash[0]);
+                        RIPEMD160(vch.begin(), vch.size(), vchHash);
                     else if (opcode == OP_SHA1)
-                        SHA1(&vch[0], vch.size(), &vchHash[0]);
+                        SHA1(vch.begin(), vch.size(), vchHash);
                     else if (opcode == OP_SHA256)
-                        SHA256(&vch[0], vch.size(), &vchHash[0]);
+                        SHA256(vch.begin(), vch.size(), vchHash);
                     else if (opcode == OP_HASH160)
                     {
-                        uint160 hash160 = Hash160(vch);
-                        memcpy(&vchHash[0], &hash160, sizeof(hash160));
+                        uint160 hash160 = Hash160(vch.begin(), vch.end());
+                        memcpy(vchHash, &hash160, sizeof(hash160));
                     }
                     else if (opcode == OP_HASH256)
                     {
                         uint256 hash = Hash(vch.begin(), vch.end());
-                        memcpy(&vchHash[0], &hash, sizeof(hash));
+                        memcpy(vchHash, &hash, sizeof(hash));
                     }
-                    popstack(stack);
-                    stack.push_back(vchHash);
+                    // The hash replaces its input in place
+                    vch.assign(vchHash, vchHash + nHashSize);
                 }
                 break;
 
@@ -828,22 +873,23 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     if (stack.size() < 2)
                         return false;
 
-                    valtype& vchSig    = stacktop(-2);
-                    valtype& vchPubKey = stacktop(-1);
+                    CStackElement& vchSig    = stacktop(-2);
+                    CStackElement& vchPubKey = stacktop(-1);
 
                     ////// debug print
                     //PrintHex(vchSig.begin(), vchSig.end(), "sig: %s\n");
                     //PrintHex(vchPubKey.begin(), vchPubKey.end(), "pubkey: %s\n");
 
                     // Subset of script starting at the most recent codeseparator
-                    CScript scriptCode(pbegincodehash, pend);
+                    CScript &scriptCode = scratch.scriptCode;
+                    scriptCode.assign(pbegincodehash, pend);
 
                     // Drop the signature, since there's no way for a signature to sign itself
-                    scriptCode.FindAndDelete(CScript(vchSig));
+                    DeleteSignature(scriptCode, vchSig);
 
                     bool fSuccess = (!fStrictEncodings || (IsCanonicalSignature(vchSig) && IsCanonicalPubKey(vchPubKey)));
                     if (fSuccess)
-                        fSuccess = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags);
+                        fSuccess = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags, pcontext);
 
                     popstack(stack);
                     popstack(stack);
@@ -867,7 +913,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     if ((int)stack.size() < i)
                         return false;
 
-                    int nKeysCount = CastToBigNum(stacktop(-i)).getint();
+                    int nKeysCount = CScriptNum(stacktop(-i)).getint();
                     if (nKeysCount < 0 || nKeysCount > 20)
                         return false;
                     nOpCount += nKeysCount;
@@ -878,7 +924,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     if ((int)stack.size() < i)
                         return false;
 
-                    int nSigsCount = CastToBigNum(stacktop(-i)).getint();
+                    int nSigsCount = CScriptNum(stacktop(-i)).getint();
                     if (nSigsCount < 0 || nSigsCount > nKeysCount)
                         return false;
                     int isig = ++i;
@@ -887,25 +933,26 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                         return false;
 
                     // Subset of script starting at the most recent codeseparator
-                    CScript scriptCode(pbegincodehash, pend);
+                    CScript &scriptCode = scratch.scriptCode;
+                    scriptCode.assign(pbegincodehash, pend);
 
                     // Drop the signatures, since there's no way for a signature to sign itself
                     for (int k = 0; k < nSigsCount; k++)
                     {
-                        valtype& vchSig = stacktop(-isig-k);
-                        scriptCode.FindAndDelete(CScript(vchSig));
+                        CStackElement& vchSig = stacktop(-isig-k);
+                        DeleteSignature(scriptCode, vchSig);
                     }
 
                     bool fSuccess = true;
                     while (fSuccess && nSigsCount > 0)
                     {
-                        valtype& vchSig    = stacktop(-isig);
-                        valtype& vchPubKey = stacktop(-ikey);
+                        CStackElement& vchSig    = stacktop(-isig);
+                        CStackElement& vchPubKey = stacktop(-ikey);
 
                         // Check signature
                         bool fOk = (!fStrictEncodings || (IsCanonicalSignature(vchSig) && IsCanonicalPubKey(vchPubKey)));
                         if (fOk)
-                            fOk = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags);
+                            fOk = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags, pcontext);
 
                         if (fOk) {
                             isig++;
@@ -955,6 +1002,17 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
     return true;
 }
 
+bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, const CSigHashContext *pcontext)
+{
+    CScriptStack stackElements;
+    BOOST_FOREACH(const valtype& vch, stack)
+        stackElements.push_back(vch);
+    bool fResult = EvalScript(stackElements, script, txTo, nIn, flags, nHashType, pcontext);
+    stack.clear();
+    BOOST_FOREACH(const CStackElement& vch, stackElements)
+        stack.push_back(vch.getvch());
+    return fResult;
+}
 
 
 
@@ -963,67 +1021,138 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
 
 
 
-uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+
+CSigHashContext::CSigHashContext(const CTransaction& txTo)
+{
+    CBufferWriter ssInputs(vchInputs, SER_GETHASH, 0);
+    vchInputs.reserve(txTo.vin.size() * SIGHASH_INPUT_SIZE);
+    BOOST_FOREACH(const CTxIn& txin, txTo.vin)
+        ssInputs << txin.prevout << CScript() << txin.nSequence;
+    assert(vchInputs.size() == txTo.vin.size() * SIGHASH_INPUT_SIZE);
+
+    CBufferWriter ssOutputs(vchOutputs, SER_GETHASH, 0);
+    ssOutputs << txTo.vout;
+
+    vPrefix.reserve(txTo.vin.size());
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txTo.nVersion;
+    WriteCompactSize(ss, txTo.vin.size());
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+    {
+        vPrefix.push_back(ss);
+        ss.write(&vchInputs[i * SIGHASH_INPUT_SIZE], SIGHASH_INPUT_SIZE);
+    }
+}
+
+// In case concatenating two scripts ends up with two codeseparators,
+// or an extra one at the end, they are removed before hashing. Most
+// scripts have none, so only copy the script when there is one.
+static bool HasCodeSeparator(const CScript &script)
+{
+    CScript::const_iterator pc = script.begin();
+    opcodetype opcode;
+    while (pc < script.end() && script.GetOp(pc, opcode))
+        if (opcode == OP_CODESEPARATOR)
+            return true;
+    return false;
+}
+
+uint256 SignatureHash(const CScript &scriptCodeIn, const CTransaction& txTo, unsigned int nIn, int nHashType, const CSigHashContext *pcontext)
 {
     if (nIn >= txTo.vin.size())
     {
         printf("ERROR: SignatureHash() : nIn=%d out of range\n", nIn);
         return 1;
     }
-    CTransaction txTmp(txTo);
 
-    // In case concatenating two scripts ends up with two codeseparators,
-    // or an extra one at the end, this prevents all those possible incompatibilities.
-    scriptCode.FindAndDelete(CScript(OP_CODESEPARATOR));
+    const bool fAnyoneCanPay = (nHashType & SIGHASH_ANYONECANPAY) != 0;
+    const bool fNone = (nHashType & 0x1f) == SIGHASH_NONE;
+    const bool fSingle = (nHashType & 0x1f) == SIGHASH_SINGLE;
 
-    // Blank out other inputs' signatures
-    for (unsigned int i = 0; i < txTmp.vin.size(); i++)
-        txTmp.vin[i].scriptSig = CScript();
-    txTmp.vin[nIn].scriptSig = scriptCode;
-
-    // Blank out some of the outputs
-    if ((nHashType & 0x1f) == SIGHASH_NONE)
+    // Only lock-in the txout payee at same index as txin
+    if (fSingle && nIn >= txTo.vout.size())
     {
-        // Wildcard payee
-        txTmp.vout.clear();
+        printf("ERROR: SignatureHash() : nOut=%d out of range\n", nIn);
+        return 1;
+    }
 
-        // Let the others update at will
-        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
-            if (i != nIn)
-                txTmp.vin[i].nSequence = 0;
+    CScript scriptCodeTmp;
+    const CScript *pscriptCode = &scriptCodeIn;
+    if (HasCodeSeparator(scriptCodeIn))
+    {
+        scriptCodeTmp = scriptCodeIn;
+        scriptCodeTmp.FindAndDelete(CScript(OP_CODESEPARATOR));
+        pscriptCode = &scriptCodeTmp;
     }
-    else if ((nHashType & 0x1f) == SIGHASH_SINGLE)
+    const CScript &scriptCode = *pscriptCode;
+
+    if (pcontext && !fAnyoneCanPay && !fNone && !fSingle)
     {
-        // Only lock-in the txout payee at same index as txin
-        unsigned int nOut = nIn;
-        if (nOut >= txTmp.vout.size())
-        {
-            printf("ERROR: SignatureHash() : nOut=%d out of range\n", nOut);
-            return 1;
-        }
-        txTmp.vout.resize(nOut+1);
-        for (unsigned int i = 0; i < nOut; i++)
-            txTmp.vout[i].SetNull();
+        // SIGHASH_ALL: resume right before this input and only hash its
+        // script plus the precomputed bytes that follow it
+        assert(pcontext->vPrefix.size() == txTo.vin.size());
+        const unsigned int nSize = CSigHashContext::SIGHASH_INPUT_SIZE;
+        const char *pin = &pcontext->vchInputs[nIn * nSize];
+        CHashWriter ss(pcontext->vPrefix[nIn]);
+        ss.write(pin, 36);
+        ss << scriptCode;
+        ss.write(pin + 37, 4);
+        ss.write(pin + nSize, pcontext->vchInputs.size() - (nIn + 1) * nSize);
+        ss.write(&pcontext->vchOutputs[0], pcontext->vchOutputs.size());
+        ss << txTo.nLockTime << nHashType;
+        return ss.GetHash();
+    }
+
+    // Serialize the modified transaction straight into the hasher, without
+    // making a copy of it: other inputs' signatures are blanked out, and
+    // depending on the hash type other inputs, their sequence numbers and
+    // some of the outputs are left out too.
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txTo.nVersion;
 
+    unsigned int nInputs = fAnyoneCanPay ? 1 : txTo.vin.size();
+    WriteCompactSize(ss, nInputs);
+    for (unsigned int i = 0; i < nInputs; i++)
+    {
+        unsigned int nInput = fAnyoneCanPay ? nIn : i;
+        const CTxIn &txin = txTo.vin[nInput];
+        ss << txin.prevout;
+        if (nInput == nIn)
+            ss << scriptCode;
+        else
+            ss << CScript();
         // Let the others update at will
-        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
-            if (i != nIn)
-                txTmp.vin[i].nSequence = 0;
+        if (nInput != nIn && (fNone || fSingle))
+            ss << (unsigned int)0;
+        else
+            ss << txin.nSequence;
     }
 
-    // Blank out other inputs completely, not recommended for open transactions
-    if (nHashType & SIGHASH_ANYONECANPAY)
+    if (fNone)
+    {
+        // Wildcard payee
+        WriteCompactSize(ss, 0);
+    }
+    else if (fSingle)
     {
-        txTmp.vin[0] = txTmp.vin[nIn];
-        txTmp.vin.resize(1);
+        WriteCompactSize(ss, nIn + 1);
+        CTxOut txoutNull;
+        for (unsigned int i = 0; i < nIn; i++)
+            ss << txoutNull;
+        ss << txTo.vout[nIn];
     }
+    else
+        ss << txTo.vout;
 
-    // Serialize and hash
-    CHashWriter ss(SER_GETHASH, 0);
-    ss << txTmp << nHashType;
+    ss << txTo.nLockTime << nHashType;
     return ss.GetHash();
 }
 
+uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+{
+    return SignatureHash(scriptCode, txTo, nIn, nHashType, NULL);
+}
+
 
 // Valid signature cache, to avoid doing expensive ECDSA signature checking
 // twice for every transaction (once when accepted into memory pool, and
@@ -1032,61 +1161,133 @@ uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int
 class CSignatureCache
 {
 private:
-     // sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
+    // Entries are spread over independently locked stripes, so script check
+    // threads verifying different signatures rarely wait for each other.
+    static const unsigned int STRIPES = 32;
+
+    // Keys are salted digests of (signature hash, signature, public key); the
+    // salt keeps them unpredictable, so their bits can be used directly to
+    // pick the stripe and bucket.
+    struct CKeyHasher
+    {
+        size_t operator()(const uint256& key) const { return (size_t)key.Get64(0); }
+    };
+
+    struct CStripe
+    {
+        boost::mutex cs;
+        boost::unordered_set<uint256, CKeyHasher> setValid;
+        uint64 nHits;
+        uint64 nMisses;
+
+        CStripe() : nHits(0), nMisses(0) {}
+    };
+
+    uint256 salt;
+    size_t nMaxStripeSize;
+    CStripe stripes[STRIPES];
+
+    uint256 GetKey(const uint256 &hash, const CStackElement& vchSig, const CPubKey& pubKey) const
+    {
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << salt << hash;
+        WriteCompactSize(ss, vchSig.size());
+        ss.write((const char*)vchSig.begin(), vchSig.size());
+        ss << pubKey;
+        return ss.GetHash();
+    }
+
+    CStripe &GetStripe(const uint256 &key)
+    {
+        return stripes[key.Get64(1) % STRIPES];
+    }
 
 public:
+    CSignatureCache()
+    {
+        salt = GetRandHash();
+        // DoS prevention: limit the number of cached entries. An entry is a
+        // 32-byte key in a hash set node, so the default of 50,000 takes
+        // around 3MB. Since there are a maximum of 20,000 signature
+        // operations per block, 50,000 is a reasonable default.
+        int64 nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
+        nMaxStripeSize = nMaxCacheSize > 0 ? (size_t)((nMaxCacheSize + STRIPES - 1) / STRIPES) : 0;
+    }
+
     bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    Get(const uint256 &hash, const CStackElement& vchSig, const CPubKey& pubKey)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        uint256 key = GetKey(hash, vchSig, pubKey);
+        CStripe &stripe = GetStripe(key);
+        boost::unique_lock<boost::mutex> lock(stripe.cs);
 
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
+        if (stripe.setValid.count(key))
+        {
+            stripe.nHits++;
             return true;
+        }
+        stripe.nMisses++;
         return false;
     }
 
-    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    void Set(const uint256 &hash, const CStackElement& vchSig, const CPubKey& pubKey)
     {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64 nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
+        if (nMaxStripeSize == 0)
+            return;
 
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+        uint256 key = GetKey(hash, vchSig, pubKey);
+        CStripe &stripe = GetStripe(key);
+        boost::unique_lock<boost::mutex> lock(stripe.cs);
 
-        while (static_cast<int64>(setValid.size()) > nMaxCacheSize)
+        while (stripe.setValid.size() >= nMaxStripeSize)
         {
             // Evict a random entry. Random because that helps
             // foil would-be DoS attackers who might try to pre-generate
             // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
+            // than our cache size. The set is kept at a load factor of
+            // about one, so only a few buckets are looked at.
+            size_t nBuckets = stripe.setValid.bucket_count();
+            size_t nBucket = (size_t)(GetRand(nBuckets));
+            while (stripe.setValid.bucket_size(nBucket) == 0)
+                nBucket = (nBucket + 1) % nBuckets;
+            stripe.setValid.erase(*stripe.setValid.begin(nBucket));
         }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+        stripe.setValid.insert(key);
+    }
+
+    void GetStats(CSignatureCacheStats &stats)
+    {
+        stats = CSignatureCacheStats();
+        stats.nMaxEntries = nMaxStripeSize * STRIPES;
+        for (unsigned int i = 0; i < STRIPES; i++)
+        {
+            boost::unique_lock<boost::mutex> lock(stripes[i].cs);
+            stats.nEntries += stripes[i].setValid.size();
+            stats.nHits += stripes[i].nHits;
+            stats.nMisses += stripes[i].nMisses;
+        }
     }
 };
 
-bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubKey, const CScript &scriptCode,
-              const CTransaction& txTo, unsigned int nIn, int nHashType, int flags)
+// Constructed on first use, after -maxsigcachesize has been parsed
+static CSignatureCache &GetSignatureCache()
 {
     static CSignatureCache signatureCache;
+    return signatureCache;
+}
+
+void GetSignatureCacheStats(CSignatureCacheStats &stats)
+{
+    GetSignatureCache().GetStats(stats);
+}
+
+bool CheckSig(CStackElement vchSig, const CStackElement &vchPubKey, const CScript &scriptCode,
+              const CTransaction& txTo, unsigned int nIn, int nHashType, int flags, const CSigHashContext *pcontext)
+{
+    CSignatureCache &signatureCache = GetSignatureCache();
 
-    CPubKey pubkey(vchPubKey);
+    CPubKey pubkey(vchPubKey.begin(), vchPubKey.end());
     if (!pubkey.IsValid())
         return false;
 
@@ -1099,12 +1300,12 @@ bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubK
         return false;
     vchSig.pop_back();
 
-    uint256 sighash = SignatureHash(scriptCode, txTo, nIn, nHashType);
+    uint256 sighash = SignatureHash(scriptCode, txTo, nIn, nHashType, pcontext);
 
     if (signatureCache.Get(sighash, vchSig, pubkey))
         return true;
 
-    if (!pubkey.Verify(sighash, vchSig))
+    if (!pubkey.Verify(sighash, vchSig.getvch()))
         return false;
 
     if (!(flags & SCRIPT_VERIFY_NOCACHE))
@@ -1510,15 +1711,200 @@ void ExtractAffectedKeys(const CKeyStore &keystore, const CScript& scriptPubKey,
     CAffectedKeysVisitor(keystore, vKeys).Process(scriptPubKey);
 }
 
+//
+// Fast verification of the standard templates. Almost every input spends
+// pay-to-pubkey-hash, pay-to-pubkey or multisig, directly or through P2SH.
+// For those, VerifyScript checks the signatures straight away rather than
+// stepping through the opcodes. The checks below are exactly the ones the
+// interpreter would make for these scripts. Anything that is not in the
+// expected shape is left to the interpreter.
+//
+
+// Pushes the data of a scriptSig that is nothing but data pushes, as
+// evaluating it would. Returns false if the scriptSig is anything else.
+static bool PushScriptSig(CScriptStack &stack, const CScript &scriptSig, valtype &vchPushValue)
+{
+    stack.clear();
+    if (scriptSig.size() > 10000)
+        return false;
+    CScript::const_iterator pc = scriptSig.begin();
+    opcodetype opcode;
+    while (pc < scriptSig.end())
+    {
+        if (!scriptSig.GetOp(pc, opcode, vchPushValue) || opcode > OP_PUSHDATA4)
+            return false;
+        // No template takes more than OP_0, 16 signatures and a script
+        if (vchPushValue.size() > MAX_SCRIPT_ELEMENT_SIZE || stack.size() >= 18)
+            return false;
+        stack.push_back(vchPushValue);
+    }
+    return true;
+}
+
+// OP_DUP OP_HASH160 <20 byte hash> OP_EQUALVERIFY OP_CHECKSIG
+static bool MatchPayToPubKeyHash(const CScript &script)
+{
+    return script.size() == 25 && script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 &&
+           script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG;
+}
+
+// <33 or 65 byte pubkey> OP_CHECKSIG
+static bool MatchPayToPubKey(const CScript &script)
+{
+    return ((script.size() == 35 && script[0] == 33) || (script.size() == 67 && script[0] == 65)) &&
+           script.back() == OP_CHECKSIG;
+}
+
+// OP_m <pubkey> ... <pubkey> OP_n OP_CHECKMULTISIG, with 33 or 65 byte keys.
+// vKeyPos receives the offset of each key push.
+static bool MatchMultisig(const CScript &script, int &nRequired, int &nKeys, unsigned int vKeyPos[16])
+{
+    unsigned int nSize = script.size();
+    if (nSize < 3 || script[0] < OP_1 || script[0] > OP_16 || script[nSize - 1] != OP_CHECKMULTISIG)
+        return false;
+    nRequired = (int)script[0] - (int)(OP_1 - 1);
+    nKeys = 0;
+    unsigned int nPos = 1;
+    while (nPos < nSize - 2 && (script[nPos] == 33 || script[nPos] == 65))
+    {
+        if (nKeys == 16)
+            return false;
+        vKeyPos[nKeys++] = nPos;
+        nPos += 1 + script[nPos];
+    }
+    return nPos == nSize - 2 && nRequired <= nKeys && script[nPos] == (int)(OP_1 - 1) + nKeys;
+}
+
+// What OP_CHECKSIG does with a signature and key, scriptCode being the whole
+// script since none of the templates has an OP_CODESEPARATOR
+static bool CheckTemplateSig(const CStackElement &vchSig, const CStackElement &vchPubKey, const CScript &script, CScript &scriptCode,
+                             const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, const CSigHashContext *pcontext)
+{
+    scriptCode.assign(script.begin(), script.end());
+    DeleteSignature(scriptCode, vchSig);
+    if ((flags & SCRIPT_VERIFY_STRICTENC) && !(IsCanonicalSignature(vchSig) && IsCanonicalPubKey(vchPubKey)))
+        return false;
+    return CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags, pcontext);
+}
+
+// Evaluates script on the stack left by the scriptSig, if it is one of the
+// templates and the stack holds exactly what it consumes. Returns false if
+// not, otherwise fResult is set to whether the final stack top is true.
+static bool VerifyTemplate(const CScriptStack &stack, const CScript &script, CScript &scriptCode,
+                           const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, const CSigHashContext *pcontext,
+                           bool &fResult)
+{
+    int nRequired, nKeys;
+    unsigned int vKeyPos[16];
+    if (MatchPayToPubKeyHash(script))
+    {
+        // (sig pubkey -- bool)
+        if (stack.size() != 2)
+            return false;
+        const CStackElement &vchPubKey = stack.at(1);
+        uint160 hash = Hash160(vchPubKey.begin(), vchPubKey.end());
+        if (memcmp(&hash, &script[3], sizeof(hash)) != 0)
+            fResult = false;
+        else
+            fResult = CheckTemplateSig(stack.at(0), vchPubKey, script, scriptCode, txTo, nIn, flags, nHashType, pcontext);
+        return true;
+    }
+    if (MatchPayToPubKey(script))
+    {
+        // (sig -- bool)
+        if (stack.size() != 1)
+            return false;
+        CStackElement vchPubKey(&script[1], &script[0] + script.size() - 1);
+        fResult = CheckTemplateSig(stack.at(0), vchPubKey, script, scriptCode, txTo, nIn, flags, nHashType, pcontext);
+        return true;
+    }
+    if (MatchMultisig(script, nRequired, nKeys, vKeyPos))
+    {
+        // (dummy sig ... sig -- bool)
+        if ((int)stack.size() != nRequired + 1)
+            return false;
+        scriptCode.assign(script.begin(), script.end());
+        for (int k = nRequired; k > 0; k--)
+            DeleteSignature(scriptCode, stack.at(k));
+
+        // Signatures and keys are matched from the last one down, as
+        // OP_CHECKMULTISIG takes them off the top of the stack
+        bool fStrictEncodings = flags & SCRIPT_VERIFY_STRICTENC;
+        int isig = nRequired, ikey = nKeys - 1;
+        fResult = true;
+        while (fResult && isig > 0)
+        {
+            const CStackElement &vchSig = stack.at(isig);
+            unsigned int nPos = vKeyPos[ikey];
+            CStackElement vchPubKey(&script[nPos + 1], &script[nPos + 1] + script[nPos]);
+
+            bool fOk = (!fStrictEncodings || (IsCanonicalSignature(vchSig) && IsCanonicalPubKey(vchPubKey)));
+            if (fOk)
+                fOk = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags, pcontext);
+
+            if (fOk)
+                isig--;
+            ikey--;
+
+            // If there are more signatures left than keys left,
+            // then too many signatures have failed
+            if (isig > ikey + 1)
+                fResult = false;
+        }
+        return true;
+    }
+    return false;
+}
+
+// Verifies a spend of one of the templates, directly or through P2SH.
+// Returns false if the interpreter has to be used instead.
+static bool VerifyStandardScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
+                                 unsigned int flags, int nHashType, const CSigHashContext *pcontext, bool &fResult)
+{
+    CScriptScratch &scratch = GetScriptScratch();
+    CScriptStack &stack = scratch.stack;
+    if (!PushScriptSig(stack, scriptSig, scratch.vchPushValue))
+        return false;
+
+    if (!scriptPubKey.IsPayToScriptHash())
+        return VerifyTemplate(stack, scriptPubKey, scratch.scriptCode, txTo, nIn, flags, nHashType, pcontext, fResult);
+
+    // Without P2SH only the hash would be checked, which is left to the interpreter
+    if (!(flags & SCRIPT_VERIFY_P2SH) || stack.empty())
+        return false;
+    // A script that does not match the hash fails the OP_EQUAL of the
+    // scriptPubKey, whatever it is
+    const CStackElement &vchRedeem = stack.back();
+    uint160 hash = Hash160(vchRedeem.begin(), vchRedeem.end());
+    if (memcmp(&hash, &scriptPubKey[2], sizeof(hash)) != 0)
+    {
+        fResult = false;
+        return true;
+    }
+    CScript &scriptRedeem = scratch.scriptRedeem;
+    scriptRedeem.assign(vchRedeem.begin(), vchRedeem.end());
+    stack.pop_back();
+    return VerifyTemplate(stack, scriptRedeem, scratch.scriptCode, txTo, nIn, flags, nHashType, pcontext, fResult);
+}
+
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
-                  unsigned int flags, int nHashType)
+                  unsigned int flags, int nHashType, const CSigHashContext *pcontext)
 {
-    vector<vector<unsigned char> > stack, stackCopy;
-    if (!EvalScript(stack, scriptSig, txTo, nIn, flags, nHashType))
+    bool fResult;
+    if (!(flags & SCRIPT_VERIFY_NOTEMPLATE) &&
+        VerifyStandardScript(scriptSig, scriptPubKey, txTo, nIn, flags, nHashType, pcontext, fResult))
+        return fResult;
+
+    // The stacks are reused from the previous input verified on this thread
+    CScriptScratch &scratch = GetScriptScratch();
+    CScriptStack &stack = scratch.stack;
+    CScriptStack &stackCopy = scratch.stackCopy;
+    stack.clear();
+    if (!EvalScript(stack, scriptSig, txTo, nIn, flags, nHashType, pcontext))
         return false;
     if (flags & SCRIPT_VERIFY_P2SH)
         stackCopy = stack;
-    if (!EvalScript(stack, scriptPubKey, txTo, nIn, flags, nHashType))
+    if (!EvalScript(stack, scriptPubKey, txTo, nIn, flags, nHashType, pcontext))
         return false;
     if (stack.empty())
         return false;
@@ -1537,11 +1923,12 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
         // an empty stack and the EvalScript above would return false.
         assert(!stackCopy.empty());
 
-        const valtype& pubKeySerialized = stackCopy.back();
-        CScript pubKey2(pubKeySerialized.begin(), pubKeySerialized.end());
+        const CStackElement& pubKeySerialized = stackCopy.back();
+        CScript &pubKey2 = scratch.scriptRedeem;
+        pubKey2.assign(pubKeySerialized.begin(), pubKeySerialized.end());
         popstack(stackCopy);
 
-        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, flags, nHashType))
+        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, flags, nHashType, pcontext))
             return false;
         if (stackCopy.empty())
             return false;
@@ -1635,7 +2022,7 @@ static CScript CombineMultisig(CScript scriptPubKey, const CTransaction& txTo, u
             if (sigs.count(pubkey))
                 continue; // Already got a sig for this pubkey
 
-            if (CheckSig(sig, pubkey, scriptPubKey, txTo, nIn, 0, 0))
+            if (CheckSig(CStackElement(sig), CStackElement(pubkey), scriptPubKey, txTo, nIn, 0, 0, NULL))
             {
                 sigs[pubkey] = sig;
                 break;
@@ -5,6 +5,12 @@
 #ifndef H_BITCOIN_SCRIPT
 #define H_BITCOIN_SCRIPT
 
+#include <algorithm>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
 #include <string>
 #include <vector>
 
@@ -13,6 +19,7 @@
 
 #include "keystore.h"
 #include "bignum.h"
+#include "hash.h"
 
 class CCoins;
 class CTransaction;
@@ -35,6 +42,406 @@ enum
     SCRIPT_VERIFY_P2SH      = (1U << 0),
     SCRIPT_VERIFY_STRICTENC = (1U << 1),
     SCRIPT_VERIFY_NOCACHE   = (1U << 2),
+    SCRIPT_VERIFY_NOTEMPLATE = (1U << 3), // always run the generic interpreter
+};
+
+class scriptnum_error : public std::runtime_error
+{
+public:
+    explicit scriptnum_error(const std::string& str) : std::runtime_error(str) {}
+};
+
+/** Value on the script interpreter's stack.
+ *
+ * Values of up to INLINE_SIZE bytes, which covers signatures, public keys,
+ * hashes and numbers, are stored inside the object itself, so copying,
+ * pushing and swapping them does not touch the heap. Larger values (mostly
+ * serialized P2SH scripts) fall back to a heap buffer, which is kept when a
+ * smaller value is assigned later.
+ */
+class CStackElement
+{
+public:
+    static const unsigned int INLINE_SIZE = 80;
+
+    typedef unsigned char value_type;
+    typedef unsigned char* iterator;
+    typedef const unsigned char* const_iterator;
+
+private:
+    unsigned int nSize;
+    unsigned int nHeapCapacity; // 0 while the value is stored inline
+    union
+    {
+        unsigned char vchInline[INLINE_SIZE];
+        unsigned char *pchHeap;
+    };
+
+public:
+    CStackElement() : nSize(0), nHeapCapacity(0) {}
+
+    CStackElement(const unsigned char *pbegin, const unsigned char *pend) : nSize(0), nHeapCapacity(0)
+    {
+        assign(pbegin, pend);
+    }
+
+    explicit CStackElement(const std::vector<unsigned char>& vch) : nSize(0), nHeapCapacity(0)
+    {
+        assign(vch);
+    }
+
+    CStackElement(const CStackElement& other) : nSize(0), nHeapCapacity(0)
+    {
+        assign(other.begin(), other.end());
+    }
+
+    ~CStackElement()
+    {
+        if (nHeapCapacity)
+            free(pchHeap);
+    }
+
+    CStackElement& operator=(const CStackElement& other)
+    {
+        if (this != &other)
+            assign(other.begin(), other.end());
+        return *this;
+    }
+
+    void reserve(size_t n)
+    {
+        if (n <= capacity())
+            return;
+        unsigned char *pchNew = (unsigned char*)malloc(n);
+        if (pchNew == NULL)
+            throw std::bad_alloc();
+        memcpy(pchNew, begin(), nSize);
+        if (nHeapCapacity)
+            free(pchHeap);
+        pchHeap = pchNew;
+        nHeapCapacity = n;
+    }
+
+    void assign(const unsigned char *pbegin, const unsigned char *pend)
+    {
+        reserve(pend - pbegin);
+        nSize = pend - pbegin;
+        if (nSize)
+            memmove(begin(), pbegin, nSize);
+    }
+
+    void assign(const std::vector<unsigned char>& vch)
+    {
+        if (vch.empty())
+            clear();
+        else
+            assign(&vch[0], &vch[0] + vch.size());
+    }
+
+    std::vector<unsigned char> getvch() const { return std::vector<unsigned char>(begin(), end()); }
+
+    size_t capacity() const { return nHeapCapacity ? nHeapCapacity : INLINE_SIZE; }
+    size_t size() const     { return nSize; }
+    bool empty() const      { return nSize == 0; }
+    void clear()            { nSize = 0; }
+
+    unsigned char* begin()             { return nHeapCapacity ? pchHeap : vchInline; }
+    const unsigned char* begin() const { return nHeapCapacity ? pchHeap : vchInline; }
+    unsigned char* end()               { return begin() + nSize; }
+    const unsigned char* end() const   { return begin() + nSize; }
+
+    unsigned char& operator[](size_t pos)             { return begin()[pos]; }
+    const unsigned char& operator[](size_t pos) const { return begin()[pos]; }
+    unsigned char& back()             { return begin()[nSize - 1]; }
+    const unsigned char& back() const { return begin()[nSize - 1]; }
+
+    void push_back(unsigned char ch)
+    {
+        if (nSize == capacity())
+            reserve(2 * nSize);
+        begin()[nSize++] = ch;
+    }
+
+    void pop_back() { nSize--; }
+
+    // Nothing points into the object itself, so its bytes can simply be exchanged
+    void swap(CStackElement& other)
+    {
+        unsigned char tmp[sizeof(CStackElement)];
+        memcpy(tmp, (void*)this, sizeof(CStackElement));
+        memcpy((void*)this, (void*)&other, sizeof(CStackElement));
+        memcpy((void*)&other, tmp, sizeof(CStackElement));
+    }
+
+    friend bool operator==(const CStackElement& a, const CStackElement& b)
+    {
+        return a.nSize == b.nSize && memcmp(a.begin(), b.begin(), a.nSize) == 0;
+    }
+    friend bool operator!=(const CStackElement& a, const CStackElement& b)
+    {
+        return !(a == b);
+    }
+};
+
+namespace std
+{
+    template<> inline void swap(CStackElement& a, CStackElement& b) { a.swap(b); }
+}
+
+/** The script interpreter's stack.
+ *
+ * A vector of CStackElement with the interface EvalScript needs. Popped
+ * slots are not destroyed but kept for the next push, together with any heap
+ * buffer they own, so a stack that is reused across inputs stops allocating
+ * once it has grown to fit the scripts being verified. Elements are moved
+ * around by swapping, which never allocates either.
+ */
+class CScriptStack
+{
+private:
+    std::vector<CStackElement> vSlots;
+    size_t nSize;
+
+public:
+    typedef std::vector<CStackElement>::iterator iterator;
+    typedef std::vector<CStackElement>::const_iterator const_iterator;
+
+    CScriptStack() : nSize(0) {}
+
+    CScriptStack(const CScriptStack& other) : nSize(0)
+    {
+        *this = other;
+    }
+
+    CScriptStack& operator=(const CScriptStack& other)
+    {
+        if (this == &other)
+            return *this;
+        if (vSlots.size() < other.nSize)
+            vSlots.resize(other.nSize);
+        for (size_t i = 0; i < other.nSize; i++)
+            vSlots[i] = other.vSlots[i];
+        nSize = other.nSize;
+        return *this;
+    }
+
+    size_t size() const { return nSize; }
+    bool empty() const  { return nSize == 0; }
+    void clear()        { nSize = 0; }
+
+    iterator begin()             { return vSlots.begin(); }
+    const_iterator begin() const { return vSlots.begin(); }
+    iterator end()               { return vSlots.begin() + nSize; }
+    const_iterator end() const   { return vSlots.begin() + nSize; }
+
+    CStackElement& at(size_t pos)
+    {
+        if (pos >= nSize)
+            throw std::out_of_range("CScriptStack::at() : out of range");
+        return vSlots[pos];
+    }
+    const CStackElement& at(size_t pos) const
+    {
+        if (pos >= nSize)
+            throw std::out_of_range("CScriptStack::at() : out of range");
+        return vSlots[pos];
+    }
+
+    CStackElement& back()             { return vSlots[nSize - 1]; }
+    const CStackElement& back() const { return vSlots[nSize - 1]; }
+
+    // Makes room for one more element and returns it, with undefined contents
+    CStackElement& push_slot()
+    {
+        if (nSize == vSlots.size())
+            vSlots.push_back(CStackElement());
+        return vSlots[nSize++];
+    }
+
+    void push_back(const CStackElement& elem)
+    {
+        if (nSize == vSlots.size())
+        {
+            // elem may live in vSlots, which push_back could reallocate
+            CStackElement tmp(elem);
+            vSlots.push_back(CStackElement());
+            vSlots.back().swap(tmp);
+            nSize++;
+        }
+        else
+            vSlots[nSize++] = elem;
+    }
+
+    void push_back(const std::vector<unsigned char>& vch)
+    {
+        push_slot().assign(vch);
+    }
+
+    void pop_back() { nSize--; }
+
+    void erase(iterator first, iterator last)
+    {
+        std::rotate(first, last, end());
+        nSize -= last - first;
+    }
+
+    void erase(iterator pos)
+    {
+        erase(pos, pos + 1);
+    }
+
+    void insert(iterator pos, const CStackElement& elem)
+    {
+        size_t nPos = pos - begin();
+        push_back(elem);
+        std::rotate(begin() + nPos, end() - 1, end());
+    }
+};
+
+/** Numeric operand of the script interpreter.
+ *
+ * Stack elements are little-endian, sign-and-magnitude encoded numbers,
+ * with the sign in the top bit of the last byte; this is how CBigNum's
+ * getvch()/setvch() represent them. Operands are limited to nMaxNumSize
+ * bytes, so every operand and every result of the arithmetic opcodes fits in
+ * an int64 and the interpreter does not need OpenSSL BIGNUMs. Decoding
+ * accepts the same non-minimal encodings CBigNum does (negative zero, extra
+ * zero bytes) and encoding always produces the minimal form, exactly like
+ * CBigNum(vch).getvch().
+ */
+class CScriptNum
+{
+public:
+    static const size_t nMaxNumSize = 4;
+
+    explicit CScriptNum(const int64& n) : m_value(n) {}
+
+    explicit CScriptNum(const std::vector<unsigned char>& vch)
+    {
+        if (vch.size() > nMaxNumSize)
+            throw scriptnum_error("CScriptNum(const std::vector<unsigned char>&) : overflow");
+        m_value = set_vch(vch);
+    }
+
+    explicit CScriptNum(const CStackElement& vch)
+    {
+        if (vch.size() > nMaxNumSize)
+            throw scriptnum_error("CScriptNum(const CStackElement&) : overflow");
+        m_value = set_vch(vch);
+    }
+
+    inline bool operator==(const int64& rhs) const    { return m_value == rhs; }
+    inline bool operator!=(const int64& rhs) const    { return m_value != rhs; }
+    inline bool operator<=(const int64& rhs) const    { return m_value <= rhs; }
+    inline bool operator< (const int64& rhs) const    { return m_value <  rhs; }
+    inline bool operator>=(const int64& rhs) const    { return m_value >= rhs; }
+    inline bool operator> (const int64& rhs) const    { return m_value >  rhs; }
+
+    inline bool operator==(const CScriptNum& rhs) const { return operator==(rhs.m_value); }
+    inline bool operator!=(const CScriptNum& rhs) const { return operator!=(rhs.m_value); }
+    inline bool operator<=(const CScriptNum& rhs) const { return operator<=(rhs.m_value); }
+    inline bool operator< (const CScriptNum& rhs) const { return operator< (rhs.m_value); }
+    inline bool operator>=(const CScriptNum& rhs) const { return operator>=(rhs.m_value); }
+    inline bool operator> (const CScriptNum& rhs) const { return operator> (rhs.m_value); }
+
+    inline CScriptNum operator+(const int64& rhs) const    { return CScriptNum(m_value + rhs); }
+    inline CScriptNum operator-(const int64& rhs) const    { return CScriptNum(m_value - rhs); }
+    inline CScriptNum operator+(const CScriptNum& rhs) const { return operator+(rhs.m_value); }
+    inline CScriptNum operator-(const CScriptNum& rhs) const { return operator-(rhs.m_value); }
+
+    inline CScriptNum& operator+=(const CScriptNum& rhs)   { return operator+=(rhs.m_value); }
+    inline CScriptNum& operator-=(const CScriptNum& rhs)   { return operator-=(rhs.m_value); }
+
+    inline CScriptNum operator-() const { return CScriptNum(-m_value); }
+
+    inline CScriptNum& operator=(const int64& rhs)
+    {
+        m_value = rhs;
+        return *this;
+    }
+
+    inline CScriptNum& operator+=(const int64& rhs)
+    {
+        m_value += rhs;
+        return *this;
+    }
+
+    inline CScriptNum& operator-=(const int64& rhs)
+    {
+        m_value -= rhs;
+        return *this;
+    }
+
+    // Saturates like CBigNum::getint()
+    int getint() const
+    {
+        if (m_value > std::numeric_limits<int>::max())
+            return std::numeric_limits<int>::max();
+        else if (m_value < std::numeric_limits<int>::min())
+            return std::numeric_limits<int>::min();
+        return (int)m_value;
+    }
+
+    std::vector<unsigned char> getvch() const
+    {
+        return serialize(m_value);
+    }
+
+    void getvch(CStackElement& vch) const
+    {
+        serialize(m_value, vch);
+    }
+
+    static std::vector<unsigned char> serialize(const int64& value)
+    {
+        std::vector<unsigned char> result;
+        serialize(value, result);
+        return result;
+    }
+
+    template<typename T>
+    static void serialize(const int64& value, T& result)
+    {
+        result.clear();
+        if (value == 0)
+            return;
+
+        const bool neg = value < 0;
+        uint64 absvalue = neg ? ~(uint64)value + 1 : (uint64)value;
+        while (absvalue)
+        {
+            result.push_back(absvalue & 0xff);
+            absvalue >>= 8;
+        }
+
+        // The top bit of the last byte is the sign. If the magnitude already
+        // uses it, add a byte for the sign; otherwise set it for negatives.
+        if (result.back() & 0x80)
+            result.push_back(neg ? 0x80 : 0);
+        else if (neg)
+            result.back() |= 0x80;
+    }
+
+private:
+    template<typename T>
+    static int64 set_vch(const T& vch)
+    {
+        if (vch.empty())
+            return 0;
+
+        int64 result = 0;
+        for (size_t i = 0; i != vch.size(); ++i)
+            result |= (int64)vch[i] << 8*i;
+
+        // If the input's top bit is set, the result is negative: clear the
+        // sign bit and negate the magnitude.
+        if (vch.back() & 0x80)
+            return -(result & ~((int64)0x80 << (8 * (vch.size() - 1))));
+
+        return result;
+    }
+
+    int64 m_value;
 };
 
 enum txnouttype
@@ -216,7 +623,7 @@ const char* GetOpName(opcodetype opcode);
 inline std::string ValueString(const std::vector<unsigned char>& vch)
 {
     if (vch.size() <= 4)
-        return strprintf("%d", CBigNum(vch).getint());
+        return strprintf("%d", CScriptNum(vch).getint());
     else
         return HexStr(vch);
 }
@@ -252,8 +659,7 @@ protected:
         }
         else
         {
-            CBigNum bn(n);
-            *this << bn.getvch();
+            *this << CScriptNum::serialize(n);
         }
         return *this;
     }
@@ -360,6 +766,12 @@ public:
         return *this;
     }
 
+    CScript& operator<<(const CScriptNum& b)
+    {
+        *this << b.getvch();
+        return *this;
+    }
+
     CScript& operator<<(const std::vector<unsigned char>& b)
     {
         if (b.size() < OP_PUSHDATA1)
@@ -665,10 +1077,57 @@ public:
     }
 };
 
+/** Signature hash pieces shared by all inputs of one transaction.
+ *
+ * The legacy signature hash serializes the whole transaction once per input,
+ * so checking a transaction with N inputs hashes O(N^2) bytes and used to
+ * copy the transaction N times as well. For SIGHASH_ALL the only part that
+ * differs between inputs is the scriptCode of the input being signed, so the
+ * context keeps the SHA-256 state right before each input and the serialized
+ * inputs (with empty scripts) and outputs. SignatureHash() then resumes from
+ * the state of input nIn and only hashes what follows it. Other hash types
+ * fall back to the streaming path. The context must only be used with the
+ * transaction it was built from.
+ */
+class CSigHashContext
+{
+private:
+    std::vector<CHashWriter> vPrefix;  // state after version, input count and inputs [0, i)
+    std::vector<char> vchInputs;       // inputs with empty scriptSig, SIGHASH_INPUT_SIZE bytes each
+    std::vector<char> vchOutputs;      // output count and outputs
+
+public:
+    // prevout, empty script length and nSequence
+    static const unsigned int SIGHASH_INPUT_SIZE = 36 + 1 + 4;
+
+    explicit CSigHashContext(const CTransaction& txTo);
+
+    friend uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CSigHashContext *pcontext);
+};
+
+uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CSigHashContext *pcontext);
+uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+
+/** Statistics of the valid signature cache */
+struct CSignatureCacheStats
+{
+    uint64 nEntries;
+    uint64 nMaxEntries;
+    uint64 nHits;
+    uint64 nMisses;
+
+    CSignatureCacheStats() : nEntries(0), nMaxEntries(0), nHits(0), nMisses(0) {}
+};
+
+void GetSignatureCacheStats(CSignatureCacheStats &stats);
+
 bool IsCanonicalPubKey(const std::vector<unsigned char> &vchPubKey);
+bool IsCanonicalPubKey(const CStackElement &vchPubKey);
 bool IsCanonicalSignature(const std::vector<unsigned char> &vchSig);
+bool IsCanonicalSignature(const CStackElement &vchSig);
 
-bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+bool EvalScript(CScriptStack& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, const CSigHashContext *pcontext = NULL);
+bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, const CSigHashContext *pcontext = NULL);
 bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<std::vector<unsigned char> >& vSolutionsRet);
 int ScriptSigArgsExpected(txnouttype t, const std::vector<std::vector<unsigned char> >& vSolutions);
 bool IsStandard(const CScript& scriptPubKey);
@@ -679,7 +1138,7 @@ bool ExtractDestination(const CScript& scriptPubKey, CTxDestination& addressRet)
 bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<CTxDestination>& addressRet, int& nRequiredRet);
 bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
 bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
-bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, const CSigHashContext *pcontext = NULL);
 
 // Given two sets of signatures for scriptPubKey, possibly with OP_0 placeholders,
 // combine them intelligently and return the result.
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2009 Colin Percival, 2011 ArtForz, 2012-2013 pooler
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file was originally written by Colin Percival as part of the Tarsnap
+ * online backup system.
+ */
+
+/* This file must be compiled with -mavx2; it is only called after
+ * scrypt_detect() has checked that the CPU and OS support AVX2. */
+
+#include "scrypt.h"
+#include "scrypt-nway.h"
+
+#include <immintrin.h>
+
+/* Two lanes per 256-bit vector, one in each 128-bit half. */
+struct CScryptAVX2
+{
+	typedef __m256i vec;
+	static const int L = 2;
+	static inline vec add(vec a, vec b) { return _mm256_add_epi32(a, b); }
+	static inline vec xor_(vec a, vec b) { return _mm256_xor_si256(a, b); }
+	static inline vec shl(vec a, int n) { return _mm256_slli_epi32(a, n); }
+	static inline vec shr(vec a, int n) { return _mm256_srli_epi32(a, n); }
+	template<int imm> static inline vec shuffle(vec a) { return _mm256_shuffle_epi32(a, imm); }
+	static inline vec pack(const uint32_t *p)
+	{
+		__m128i lo = _mm_loadu_si128((const __m128i *)p);
+		__m128i hi = _mm_loadu_si128((const __m128i *)(p + 32));
+		return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+	}
+	static inline void unpack(vec a, uint32_t *p)
+	{
+		_mm_storeu_si128((__m128i *)p, _mm256_castsi256_si128(a));
+		_mm_storeu_si128((__m128i *)(p + 32), _mm256_extracti128_si256(a, 1));
+	}
+	static inline void index(vec a, uint32_t *j)
+	{
+		j[0] = (uint32_t)_mm_cvtsi128_si32(_mm256_castsi256_si128(a)) & 1023;
+		j[1] = (uint32_t)_mm_cvtsi128_si32(_mm256_extracti128_si256(a, 1)) & 1023;
+	}
+	static inline vec gather(const vec *V, const uint32_t *j, int stride, int off)
+	{
+		return _mm256_blend_epi32(V[j[0] * stride + off], V[j[1] * stride + off], 0xF0);
+	}
+};
+
+void scrypt_1024_1_1_256_sp_avx2_4way(const char *input, char *output, char *scratchpad)
+{
+	CScryptNWay<CScryptAVX2, 2>::Hash(input, output, scratchpad);
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2009 Colin Percival, 2011 ArtForz, 2012-2013 pooler
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file was originally written by Colin Percival as part of the Tarsnap
+ * online backup system.
+ */
+#ifndef SCRYPT_NWAY_H
+#define SCRYPT_NWAY_H
+
+#include "scrypt.h"
+#include <string.h>
+
+/*
+ * Interleaved scrypt core shared by the SSE2 and AVX2 kernels.
+ *
+ * Each lane keeps the row layout of scrypt_1024_1_1_256_sp_sse2 (the salsa
+ * state diagonals in one 128-bit row), so the salsa rounds only need
+ * per-128-bit shuffles.  Lanes describes one vector of L such lanes:
+ *   typedef ... vec;  static const int L;
+ *   add, xor_, shl, shr, shuffle<imm>, pack, unpack, index and gather.
+ * N vectors are processed in lockstep, which hides the latency of each
+ * salsa dependency chain behind the others.  The scratchpad holds
+ * N * L * 128 KiB, interleaved by iteration so the first loop writes
+ * sequentially.
+ */
+template<class Lanes, int N>
+struct CScryptNWay
+{
+    typedef typename Lanes::vec vec;
+    static const int WAYS = N * Lanes::L;
+
+    static inline void xor_salsa8(vec X[N][8], int b, int bx)
+    {
+        vec X0[N], X1[N], X2[N], X3[N], T[N];
+        int n, i;
+
+        for (n = 0; n < N; n++) {
+            X0[n] = X[n][b + 0] = Lanes::xor_(X[n][b + 0], X[n][bx + 0]);
+            X1[n] = X[n][b + 1] = Lanes::xor_(X[n][b + 1], X[n][bx + 1]);
+            X2[n] = X[n][b + 2] = Lanes::xor_(X[n][b + 2], X[n][bx + 2]);
+            X3[n] = X[n][b + 3] = Lanes::xor_(X[n][b + 3], X[n][bx + 3]);
+        }
+
+        for (i = 0; i < 8; i += 2) {
+            /* Operate on "columns". */
+            for (n = 0; n < N; n++) T[n] = Lanes::add(X0[n], X3[n]);
+            for (n = 0; n < N; n++) X1[n] = Lanes::xor_(Lanes::xor_(X1[n], Lanes::shl(T[n], 7)), Lanes::shr(T[n], 25));
+            for (n = 0; n < N; n++) T[n] = Lanes::add(X1[n], X0[n]);
+            for (n = 0; n < N; n++) X2[n] = Lanes::xor_(Lanes::xor_(X2[n], Lanes::shl(T[n], 9)), Lanes::shr(T[n], 23));
+            for (n = 0; n < N; n++) T[n] = Lanes::add(X2[n], X1[n]);
+            for (n = 0; n < N; n++) X3[n] = Lanes::xor_(Lanes::xor_(X3[n], Lanes::shl(T[n], 13)), Lanes::shr(T[n], 19));
+            for (n = 0; n < N; n++) T[n] = Lanes::add(X3[n], X2[n]);
+            for (n = 0; n < N; n++) X0[n] = Lanes::xor_(Lanes::xor_(X0[n], Lanes::shl(T[n], 18)), Lanes::shr(T[n], 14));
+
+            /* Rearrange data. */
+            for (n = 0; n < N; n++) {
+                X1[n] = Lanes::template shuffle<0x93>(X1[n]);
+                X2[n] = Lanes::template shuffle<0x4E>(X2[n]);
+                X3[n] = Lanes::template shuffle<0x39>(X3[n]);
+            }
+
+            /* Operate on "rows". */
+            for (n = 0; n < N; n++) T[n] = Lanes::add(X0[n], X1[n]);
+            for (n = 0; n < N; n++) X3[n] = Lanes::xor_(Lanes::xor_(X3[n], Lanes::shl(T[n], 7)), Lanes::shr(T[n], 25));
+            for (n = 0; n < N; n++) T[n] = Lanes::add(X3[n], X0[n]);
+            for (n = 0; n < N; n++) X2[n] = Lanes::xor_(Lanes::xor_(X2[n], Lanes::shl(T[n], 9)), Lanes::shr(T[n], 23));
+            for (n = 0; n < N; n++) T[n] = Lanes::add(X2[n], X3[n]);
+            for (n = 0; n < N; n++) X1[n] = Lanes::xor_(Lanes::xor_(X1[n], Lanes::shl(T[n], 13)), Lanes::shr(T[n], 19));
+            for (n = 0; n < N; n++) T[n] = Lanes::add(X1[n], X2[n]);
+            for (n = 0; n < N; n++) X0[n] = Lanes::xor_(Lanes::xor_(X0[n], Lanes::shl(T[n], 18)), Lanes::shr(T[n], 14));
+
+            /* Rearrange data. */
+            for (n = 0; n < N; n++) {
+                X1[n] = Lanes::template shuffle<0x39>(X1[n]);
+                X2[n] = Lanes::template shuffle<0x4E>(X2[n]);
+                X3[n] = Lanes::template shuffle<0x93>(X3[n]);
+            }
+        }
+
+        for (n = 0; n < N; n++) {
+            X[n][b + 0] = Lanes::add(X[n][b + 0], X0[n]);
+            X[n][b + 1] = Lanes::add(X[n][b + 1], X1[n]);
+            X[n][b + 2] = Lanes::add(X[n][b + 2], X2[n]);
+            X[n][b + 3] = Lanes::add(X[n][b + 3], X3[n]);
+        }
+    }
+
+    /* Hash WAYS consecutive 80-byte inputs into WAYS 32-byte outputs. */
+    static void Hash(const char *input, char *output, char *scratchpad)
+    {
+        uint8_t B[WAYS][128];
+        uint32_t W[WAYS][32];
+        vec X[N][8];
+        vec *V;
+        uint32_t j[Lanes::L];
+        int i, k, n, s;
+
+        V = (vec *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+
+        for (s = 0; s < WAYS; s++) {
+            const uint8_t *in = (const uint8_t *)input + 80 * s;
+            PBKDF2_SHA256(in, 80, in, 80, 1, B[s], 128);
+            for (k = 0; k < 2; k++)
+                for (i = 0; i < 16; i++)
+                    W[s][k * 16 + i] = le32dec(&B[s][(k * 16 + (i * 5 % 16)) * 4]);
+        }
+        for (n = 0; n < N; n++)
+            for (k = 0; k < 8; k++)
+                X[n][k] = Lanes::pack(&W[n * Lanes::L][k * 4]);
+
+        for (i = 0; i < 1024; i++) {
+            for (n = 0; n < N; n++)
+                for (k = 0; k < 8; k++)
+                    V[(i * N + n) * 8 + k] = X[n][k];
+            xor_salsa8(X, 0, 4);
+            xor_salsa8(X, 4, 0);
+        }
+        for (i = 0; i < 1024; i++) {
+            for (n = 0; n < N; n++) {
+                Lanes::index(X[n][4], j);
+                for (k = 0; k < 8; k++)
+                    X[n][k] = Lanes::xor_(X[n][k], Lanes::gather(V, j, N * 8, n * 8 + k));
+            }
+            xor_salsa8(X, 0, 4);
+            xor_salsa8(X, 4, 0);
+        }
+
+        for (n = 0; n < N; n++)
+            for (k = 0; k < 8; k++)
+                Lanes::unpack(X[n][k], &W[n * Lanes::L][k * 4]);
+        for (s = 0; s < WAYS; s++) {
+            for (k = 0; k < 2; k++)
+                for (i = 0; i < 16; i++)
+                    le32enc(&B[s][(k * 16 + (i * 5 % 16)) * 4], W[s][k * 16 + i]);
+            PBKDF2_SHA256((const uint8_t *)input + 80 * s, 80, B[s], 128, 1, (uint8_t *)output + 32 * s, 32);
+        }
+    }
+};
+
+#endif
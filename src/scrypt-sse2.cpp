@@ -134,3 +134,26 @@ void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchp
 
 	PBKDF2_SHA256((const uint8_t *)input, 80, B, 128, 1, (uint8_t *)output, 32);
 }
+
+#include "scrypt-nway.h"
+
+/* One lane per 128-bit vector. */
+struct CScryptSSE2
+{
+	typedef __m128i vec;
+	static const int L = 1;
+	static inline vec add(vec a, vec b) { return _mm_add_epi32(a, b); }
+	static inline vec xor_(vec a, vec b) { return _mm_xor_si128(a, b); }
+	static inline vec shl(vec a, int n) { return _mm_slli_epi32(a, n); }
+	static inline vec shr(vec a, int n) { return _mm_srli_epi32(a, n); }
+	template<int imm> static inline vec shuffle(vec a) { return _mm_shuffle_epi32(a, imm); }
+	static inline vec pack(const uint32_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+	static inline void unpack(vec a, uint32_t *p) { _mm_storeu_si128((__m128i *)p, a); }
+	static inline void index(vec a, uint32_t *j) { j[0] = (uint32_t)_mm_cvtsi128_si32(a) & 1023; }
+	static inline vec gather(const vec *V, const uint32_t *j, int stride, int off) { return V[j[0] * stride + off]; }
+};
+
+void scrypt_1024_1_1_256_sp_sse2_2way(const char *input, char *output, char *scratchpad)
+{
+	CScryptNWay<CScryptSSE2, 2>::Hash(input, output, scratchpad);
+}
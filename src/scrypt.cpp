@@ -303,9 +303,8 @@ void scrypt_detect_sse2(unsigned int cpuid_edx)
 #endif
 #endif
 
-void scrypt_1024_1_1_256(const char *input, char *output)
+static inline void scrypt_1024_1_1_256_sp_best(const char *input, char *output, char *scratchpad)
 {
-	char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
 #if defined(USE_SSE2)
         // Detection would work, but in cases where we KNOW it always has SSE2,
         // it is faster to use directly than to use a function pointer or conditional.
@@ -321,3 +320,52 @@ void scrypt_1024_1_1_256(const char *input, char *output)
         scrypt_1024_1_1_256_sp_generic(input, output, scratchpad);
 #endif
 }
+
+void scrypt_1024_1_1_256(const char *input, char *output)
+{
+	char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
+	scrypt_1024_1_1_256_sp_best(input, output, scratchpad);
+}
+
+/* Interleaved kernels picked by scrypt_detect(), NULL if unavailable */
+static void (*scrypt_1024_1_1_256_sp_4way)(const char *input, char *output, char *scratchpad) = NULL;
+static void (*scrypt_1024_1_1_256_sp_2way)(const char *input, char *output, char *scratchpad) = NULL;
+int scrypt_multi_ways = 1;
+
+void scrypt_1024_1_1_256_multi_sp(const char *input, char *output, int nCount, char *scratchpad)
+{
+	if (scrypt_1024_1_1_256_sp_4way) {
+		for (; nCount >= 4; nCount -= 4, input += 4 * 80, output += 4 * 32)
+			scrypt_1024_1_1_256_sp_4way(input, output, scratchpad);
+	}
+	if (scrypt_1024_1_1_256_sp_2way) {
+		for (; nCount >= 2; nCount -= 2, input += 2 * 80, output += 2 * 32)
+			scrypt_1024_1_1_256_sp_2way(input, output, scratchpad);
+	}
+	for (; nCount > 0; nCount--, input += 80, output += 32)
+		scrypt_1024_1_1_256_sp_best(input, output, scratchpad);
+}
+
+void scrypt_detect()
+{
+#if defined(USE_SSE2)
+#if !(defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64) || (defined(MAC_OSX) && defined(__i386__)))
+	scrypt_detect_sse2(CPUHasSSE2() ? 1<<26 : 0);
+#endif
+	if (CPUHasSSE2()) {
+		// Only 16 xmm registers: interleaving more than two lanes spills
+		scrypt_1024_1_1_256_sp_2way = &scrypt_1024_1_1_256_sp_sse2_2way;
+		scrypt_multi_ways = 2;
+	}
+#endif
+#if defined(USE_AVX2)
+	if (CPUHasAVX2()) {
+		scrypt_1024_1_1_256_sp_4way = &scrypt_1024_1_1_256_sp_avx2_4way;
+		scrypt_multi_ways = 4;
+		printf("scrypt: using %d-way avx2 kernel as detected.\n", scrypt_multi_ways);
+		return;
+	}
+#endif
+	if (scrypt_multi_ways > 1)
+		printf("scrypt: using %d-way sse2 kernel as detected.\n", scrypt_multi_ways);
+}
@@ -4,14 +4,31 @@
 #include <stdint.h>
 static const int SCRYPT_SCRATCHPAD_SIZE = 131072 + 63;
 
+/* Widest interleaved kernel, and the scratchpad slab it needs */
+static const int SCRYPT_MAX_WAYS = 4;
+static const int SCRYPT_MULTI_SCRATCHPAD_SIZE = 131072 * SCRYPT_MAX_WAYS + 63;
+
 void scrypt_1024_1_1_256(const char *input, char *output);
 void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad);
 
+/* Hash nCount consecutive 80-byte inputs into nCount consecutive 32-byte
+ * outputs, several at a time when an interleaved kernel is available.
+ * scratchpad must hold SCRYPT_MULTI_SCRATCHPAD_SIZE bytes. */
+void scrypt_1024_1_1_256_multi_sp(const char *input, char *output, int nCount, char *scratchpad);
+
+/* Number of inputs the kernel picked by scrypt_detect() hashes per pass */
+extern int scrypt_multi_ways;
+extern void scrypt_detect();
+
 #if defined(USE_SSE2)
 extern void scrypt_detect_sse2(unsigned int cpuid_edx);
 void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchpad);
+void scrypt_1024_1_1_256_sp_sse2_2way(const char *input, char *output, char *scratchpad);
 extern void (*scrypt_1024_1_1_256_sp)(const char *input, char *output, char *scratchpad);
 #endif
+#if defined(USE_AVX2)
+void scrypt_1024_1_1_256_sp_avx2_4way(const char *input, char *output, char *scratchpad);
+#endif
 
 void
 PBKDF2_SHA256(const uint8_t *passwd, size_t passwdlen, const uint8_t *salt,
@@ -1371,4 +1371,71 @@ public:
     }
 };
 
+/** Serializes into a std::vector<char> owned by the caller. The vector is
+ *  cleared but keeps its capacity, so one buffer can be reused for many
+ *  small records without allocating, and without the zeroing done by
+ *  CDataStream's allocator. */
+class CBufferWriter
+{
+private:
+    std::vector<char> &vch;
+
+public:
+    int nType;
+    int nVersion;
+
+    CBufferWriter(std::vector<char> &vchIn, int nTypeIn, int nVersionIn) : vch(vchIn), nType(nTypeIn), nVersion(nVersionIn) {
+        vch.clear();
+    }
+
+    CBufferWriter& write(const char *pch, size_t nSize) {
+        vch.insert(vch.end(), pch, pch + nSize);
+        return (*this);
+    }
+
+    const char *data() const { return vch.empty() ? NULL : &vch[0]; }
+    size_t size() const      { return vch.size(); }
+
+    template<typename T>
+    CBufferWriter& operator<<(const T& obj) {
+        // Serialize to this stream
+        ::Serialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+/** Deserializes directly from memory owned by someone else, such as a
+ *  leveldb::Slice, instead of copying it into a CDataStream first. The
+ *  memory must stay valid while the reader is in use. */
+class CBufferReader
+{
+private:
+    const char *pcur;
+    const char *pend;
+
+public:
+    int nType;
+    int nVersion;
+
+    CBufferReader(const char *pbegin, const char *pendIn, int nTypeIn, int nVersionIn) : pcur(pbegin), pend(pendIn), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    bool empty() const  { return pcur == pend; }
+    size_t size() const { return pend - pcur; }
+
+    CBufferReader& read(char *pch, size_t nSize) {
+        if (nSize > size())
+            throw std::ios_base::failure("CBufferReader::read() : end of data");
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+        return (*this);
+    }
+
+    template<typename T>
+    CBufferReader& operator>>(T& obj) {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
 #endif
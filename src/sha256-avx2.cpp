@@ -0,0 +1,31 @@
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// This file must be compiled with -mavx2; it is only called after
+// sha256_detect() has checked that the CPU and OS support AVX2.
+
+#include "sha256.h"
+#include "sha256-scan.h"
+
+#include <immintrin.h>
+
+struct CSHA256AVX2
+{
+    typedef __m256i vec;
+    static const int N = 8;
+    static inline vec set1(uint32_t x) { return _mm256_set1_epi32((int)x); }
+    static inline vec nonces(uint32_t nonce) { return _mm256_add_epi32(set1(nonce), _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0)); }
+    static inline vec add(vec a, vec b) { return _mm256_add_epi32(a, b); }
+    static inline vec xor_(vec a, vec b) { return _mm256_xor_si256(a, b); }
+    static inline vec and_(vec a, vec b) { return _mm256_and_si256(a, b); }
+    static inline vec or_(vec a, vec b) { return _mm256_or_si256(a, b); }
+    static inline vec shr(vec a, int n) { return _mm256_srli_epi32(a, n); }
+    static inline vec shl(vec a, int n) { return _mm256_slli_epi32(a, n); }
+    static inline void store(uint32_t *out, vec a) { _mm256_storeu_si256((__m256i *)out, a); }
+};
+
+int sha256d_scan_8way_avx2(const uint32_t *midstate, const uint32_t *data, uint32_t nonce, uint32_t *hash)
+{
+    return CSHA256Lanes<CSHA256AVX2>::Scan(midstate, data, nonce, hash);
+}
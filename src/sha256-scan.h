@@ -0,0 +1,115 @@
+#ifndef SHA256_SCAN_H
+#define SHA256_SCAN_H
+#include "sha256.h"
+
+/*
+ * Lane-generic sha256d nonce scanner shared by the scalar, SSE2 and AVX2
+ * kernels.  Lanes describes the vector type: it provides
+ *   typedef ... vec;  static const int N;
+ *   set1, nonces, add, xor_, and_, or_, shr, shl and store.
+ * Every lane runs the same message schedule except for word 3 (the nonce),
+ * so the first three rounds of the first hash are done once in scalar code.
+ */
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t sha256_rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+/* One scalar round, used for the lane-independent prefix of the first hash. */
+static inline void sha256_round(uint32_t *s, uint32_t k, uint32_t w)
+{
+    uint32_t t1 = s[7] + (sha256_rotr(s[4], 6) ^ sha256_rotr(s[4], 11) ^ sha256_rotr(s[4], 25)) +
+                  (s[6] ^ (s[4] & (s[5] ^ s[6]))) + k + w;
+    uint32_t t2 = (sha256_rotr(s[0], 2) ^ sha256_rotr(s[0], 13) ^ sha256_rotr(s[0], 22)) +
+                  ((s[0] & s[1]) | (s[2] & (s[0] | s[1])));
+    s[7] = s[6]; s[6] = s[5]; s[5] = s[4]; s[4] = s[3] + t1;
+    s[3] = s[2]; s[2] = s[1]; s[1] = s[0]; s[0] = t1 + t2;
+}
+
+template<class Lanes>
+struct CSHA256Lanes
+{
+    typedef typename Lanes::vec vec;
+
+    static inline vec rotr(vec x, int n) { return Lanes::or_(Lanes::shr(x, n), Lanes::shl(x, 32 - n)); }
+    static inline vec S0(vec x) { return Lanes::xor_(Lanes::xor_(rotr(x, 2), rotr(x, 13)), rotr(x, 22)); }
+    static inline vec S1(vec x) { return Lanes::xor_(Lanes::xor_(rotr(x, 6), rotr(x, 11)), rotr(x, 25)); }
+    static inline vec s0(vec x) { return Lanes::xor_(Lanes::xor_(rotr(x, 7), rotr(x, 18)), Lanes::shr(x, 3)); }
+    static inline vec s1(vec x) { return Lanes::xor_(Lanes::xor_(rotr(x, 17), rotr(x, 19)), Lanes::shr(x, 10)); }
+    static inline vec Ch(vec x, vec y, vec z) { return Lanes::xor_(z, Lanes::and_(x, Lanes::xor_(y, z))); }
+    static inline vec Maj(vec x, vec y, vec z) { return Lanes::or_(Lanes::and_(x, y), Lanes::and_(z, Lanes::or_(x, y))); }
+
+    // Run rounds nFirst..63 over s[8] with the message schedule w[64], whose
+    // words 0..15 are filled in by the caller.
+    static inline void Rounds(vec *s, vec *w, int nFirst)
+    {
+        for (int i = 16; i < 64; i++)
+            w[i] = Lanes::add(Lanes::add(s1(w[i - 2]), w[i - 7]), Lanes::add(s0(w[i - 15]), w[i - 16]));
+        vec a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+        for (int i = nFirst; i < 64; i++)
+        {
+            vec t1 = Lanes::add(Lanes::add(Lanes::add(h, S1(e)), Lanes::add(Ch(e, f, g), Lanes::set1(sha256_k[i]))), w[i]);
+            vec t2 = Lanes::add(S0(a), Maj(a, b, c));
+            h = g; g = f; f = e; e = Lanes::add(d, t1);
+            d = c; c = b; b = a; a = Lanes::add(t1, t2);
+        }
+        s[0] = a; s[1] = b; s[2] = c; s[3] = d; s[4] = e; s[5] = f; s[6] = g; s[7] = h;
+    }
+
+    static int Scan(const uint32_t *midstate, const uint32_t *data, uint32_t nonce, uint32_t *hash)
+    {
+        // First hash: the first three rounds don't depend on the nonce
+        uint32_t pre[8];
+        for (int i = 0; i < 8; i++)
+            pre[i] = midstate[i];
+        for (int i = 0; i < 3; i++)
+            sha256_round(pre, sha256_k[i], data[i]);
+
+        vec w[64];
+        vec s[8];
+        for (int i = 0; i < 16; i++)
+            w[i] = Lanes::set1(data[i]);
+        w[3] = Lanes::nonces(nonce);
+        for (int i = 0; i < 8; i++)
+            s[i] = Lanes::set1(pre[i]);
+        Rounds(s, w, 3);
+
+        // Second hash over the 32-byte first hash plus constant padding
+        for (int i = 0; i < 8; i++)
+            w[i] = Lanes::add(s[i], Lanes::set1(midstate[i]));
+        w[8] = Lanes::set1(0x80000000);
+        for (int i = 9; i < 15; i++)
+            w[i] = Lanes::set1(0);
+        w[15] = Lanes::set1(256);
+        for (int i = 0; i < 8; i++)
+            s[i] = Lanes::set1(sha256_init_state[i]);
+        Rounds(s, w, 0);
+
+        uint32_t h7[Lanes::N];
+        Lanes::store(h7, Lanes::add(s[7], Lanes::set1(sha256_init_state[7])));
+        for (int j = 0; j < Lanes::N; j++)
+        {
+            if ((h7[j] & 0xffff) != 0)
+                continue;
+            uint32_t lane[Lanes::N];
+            for (int i = 0; i < 8; i++)
+            {
+                Lanes::store(lane, Lanes::add(s[i], Lanes::set1(sha256_init_state[i])));
+                hash[i] = lane[j];
+            }
+            return j;
+        }
+        return -1;
+    }
+};
+
+#endif
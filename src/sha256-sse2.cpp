@@ -0,0 +1,28 @@
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sha256.h"
+#include "sha256-scan.h"
+
+#include <emmintrin.h>
+
+struct CSHA256SSE2
+{
+    typedef __m128i vec;
+    static const int N = 4;
+    static inline vec set1(uint32_t x) { return _mm_set1_epi32((int)x); }
+    static inline vec nonces(uint32_t nonce) { return _mm_add_epi32(set1(nonce), _mm_set_epi32(3, 2, 1, 0)); }
+    static inline vec add(vec a, vec b) { return _mm_add_epi32(a, b); }
+    static inline vec xor_(vec a, vec b) { return _mm_xor_si128(a, b); }
+    static inline vec and_(vec a, vec b) { return _mm_and_si128(a, b); }
+    static inline vec or_(vec a, vec b) { return _mm_or_si128(a, b); }
+    static inline vec shr(vec a, int n) { return _mm_srli_epi32(a, n); }
+    static inline vec shl(vec a, int n) { return _mm_slli_epi32(a, n); }
+    static inline void store(uint32_t *out, vec a) { _mm_storeu_si128((__m128i *)out, a); }
+};
+
+int sha256d_scan_4way_sse2(const uint32_t *midstate, const uint32_t *data, uint32_t nonce, uint32_t *hash)
+{
+    return CSHA256Lanes<CSHA256SSE2>::Scan(midstate, data, nonce, hash);
+}
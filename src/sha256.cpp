@@ -0,0 +1,78 @@
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sha256.h"
+#include "sha256-scan.h"
+#include "util.h"
+
+const uint32_t sha256_init_state[8] =
+{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+void sha256_transform(uint32_t *state, const uint32_t *block)
+{
+    uint32_t w[64];
+    uint32_t s[8];
+    for (int i = 0; i < 16; i++)
+        w[i] = block[i];
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = sha256_rotr(w[i - 15], 7) ^ sha256_rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = sha256_rotr(w[i - 2], 17) ^ sha256_rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    for (int i = 0; i < 8; i++)
+        s[i] = state[i];
+    for (int i = 0; i < 64; i++)
+        sha256_round(s, sha256_k[i], w[i]);
+    for (int i = 0; i < 8; i++)
+        state[i] += s[i];
+}
+
+struct CSHA256Scalar
+{
+    typedef uint32_t vec;
+    static const int N = 1;
+    static inline vec set1(uint32_t x) { return x; }
+    static inline vec nonces(uint32_t nonce) { return nonce; }
+    static inline vec add(vec a, vec b) { return a + b; }
+    static inline vec xor_(vec a, vec b) { return a ^ b; }
+    static inline vec and_(vec a, vec b) { return a & b; }
+    static inline vec or_(vec a, vec b) { return a | b; }
+    static inline vec shr(vec a, int n) { return a >> n; }
+    static inline vec shl(vec a, int n) { return a << n; }
+    static inline void store(uint32_t *out, vec a) { out[0] = a; }
+};
+
+int sha256d_scan_1way(const uint32_t *midstate, const uint32_t *data, uint32_t nonce, uint32_t *hash)
+{
+    return CSHA256Lanes<CSHA256Scalar>::Scan(midstate, data, nonce, hash);
+}
+
+int (*sha256d_scan)(const uint32_t *midstate, const uint32_t *data, uint32_t nonce, uint32_t *hash) = &sha256d_scan_1way;
+unsigned int sha256d_scan_lanes = 1;
+
+void sha256_detect()
+{
+#if defined(USE_AVX2)
+    if (CPUHasAVX2())
+    {
+        sha256d_scan = &sha256d_scan_8way_avx2;
+        sha256d_scan_lanes = 8;
+        printf("sha256d: using 8-way avx2 scanner as detected.\n");
+        return;
+    }
+#endif
+#if defined(USE_SSE2)
+    if (CPUHasSSE2())
+    {
+        sha256d_scan = &sha256d_scan_4way_sse2;
+        sha256d_scan_lanes = 4;
+        printf("sha256d: using 4-way sse2 scanner as detected.\n");
+        return;
+    }
+#endif
+    sha256d_scan = &sha256d_scan_1way;
+    sha256d_scan_lanes = 1;
+    printf("sha256d: using generic scanner.\n");
+}
@@ -0,0 +1,41 @@
+#ifndef SHA256_H
+#define SHA256_H
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+ * Native SHA-256 compression and multi-lane sha256d nonce scanning for the
+ * built-in sha256d miner.
+ *
+ * All buffers are in the layout produced by FormatHashBuffers: 32-bit words
+ * already converted to host order, so they can be fed to the message
+ * schedule without any further byte reversing.
+ */
+
+extern const uint32_t sha256_init_state[8];
+
+/* Run one SHA-256 compression of the 16-word block over the 8-word state. */
+void sha256_transform(uint32_t *state, const uint32_t *block);
+
+/*
+ * Hash the nonces nonce, nonce+1, ... nonce+lanes-1 of the second header
+ * chunk data[16] (whose word 3 is the nonce) starting from the precomputed
+ * midstate, followed by the second SHA-256 round of sha256d.
+ * Returns the index of the first lane whose final hash has its top 16 bits
+ * clear and stores that lane's final state in hash[8], or -1 if no lane did.
+ */
+int sha256d_scan_1way(const uint32_t *midstate, const uint32_t *data, uint32_t nonce, uint32_t *hash);
+
+#if defined(USE_SSE2)
+int sha256d_scan_4way_sse2(const uint32_t *midstate, const uint32_t *data, uint32_t nonce, uint32_t *hash);
+#endif
+#if defined(USE_AVX2)
+int sha256d_scan_8way_avx2(const uint32_t *midstate, const uint32_t *data, uint32_t nonce, uint32_t *hash);
+#endif
+
+/* Kernel picked by sha256_detect() and the number of nonces it hashes per call. */
+extern int (*sha256d_scan)(const uint32_t *midstate, const uint32_t *data, uint32_t nonce, uint32_t *hash);
+extern unsigned int sha256d_scan_lanes;
+
+extern void sha256_detect();
+#endif
@@ -0,0 +1,188 @@
+#include <boost/test/unit_test.hpp>
+
+#include "arith_uint256.h"
+#include "bignum.h"
+#include "util.h"
+
+#include <limits>
+
+BOOST_AUTO_TEST_SUITE(arith_uint256_tests)
+
+static arith_uint256 RandArith(unsigned int nBits)
+{
+    arith_uint256 r(GetRandHash());
+    if (nBits < 256)
+        r >>= 256 - nBits;
+    return r;
+}
+
+// The retarget arithmetic of GetNextWorkRequired, and what CBigNum gives
+static unsigned int RetargetArith(arith_uint256 target, int64 nTimespan, int64 nTargetTimespan, const arith_uint256 &limit)
+{
+    bool fOverflow;
+    target.MulDiv(nTimespan, nTargetTimespan, &fOverflow);
+    if (fOverflow || target > limit)
+        target = limit;
+    return target.GetCompact();
+}
+
+static unsigned int RetargetBigNum(CBigNum bnTarget, int64 nTimespan, int64 nTargetTimespan, const CBigNum &bnLimit)
+{
+    bnTarget *= nTimespan;
+    bnTarget /= nTargetTimespan;
+    if (bnTarget > bnLimit)
+        bnTarget = bnLimit;
+    return bnTarget.GetCompact();
+}
+
+BOOST_AUTO_TEST_CASE(arith_basics)
+{
+    arith_uint256 zero;
+    arith_uint256 one(1);
+    BOOST_CHECK(!zero);
+    BOOST_CHECK(!!one);
+    BOOST_CHECK(zero < one && one > zero && zero != one);
+    BOOST_CHECK((~zero + one) == zero);
+    BOOST_CHECK((zero - one) == ~zero);
+    BOOST_CHECK((one << 255 >> 255) == one);
+    BOOST_CHECK((one << 256) == zero);
+    BOOST_CHECK_EQUAL((one << 100).bits(), 101U);
+    BOOST_CHECK_EQUAL(zero.bits(), 0U);
+    BOOST_CHECK((arith_uint256(0x123456789abcdefULL) * 0x10000ULL).GetLow64() == 0x456789abcdef0000ULL);
+    BOOST_CHECK(arith_uint256(1000) / arith_uint256(7) == arith_uint256(142));
+    BOOST_CHECK(arith_uint256(1000) / arith_uint256(0) == zero);
+    BOOST_CHECK(arith_uint256(uint256(123)).getuint256() == uint256(123));
+    BOOST_CHECK(arith_uint256(~uint256(0) >> 20).getuint256() == (~uint256(0) >> 20));
+}
+
+BOOST_AUTO_TEST_CASE(arith_compact)
+{
+    bool fNegative, fOverflow;
+    arith_uint256 num;
+
+    num.SetCompact(0, &fNegative, &fOverflow);
+    BOOST_CHECK(!num && !fNegative && !fOverflow);
+    BOOST_CHECK_EQUAL(num.GetCompact(), 0U);
+
+    num.SetCompact(0x00123456, &fNegative, &fOverflow);
+    BOOST_CHECK(!num && !fNegative && !fOverflow);
+
+    num.SetCompact(0x01123456, &fNegative, &fOverflow);
+    BOOST_CHECK(num == arith_uint256(0x12));
+    BOOST_CHECK_EQUAL(num.GetCompact(), 0x01120000U);
+
+    // Make sure that we don't generate compacts with the 0x00800000 bit set
+    num = 0x80;
+    BOOST_CHECK_EQUAL(num.GetCompact(), 0x02008000U);
+
+    num.SetCompact(0x01fedcba, &fNegative, &fOverflow);
+    BOOST_CHECK(num == arith_uint256(0x7e));
+    BOOST_CHECK(fNegative);
+    BOOST_CHECK_EQUAL(num.GetCompact(true), 0x01fe0000U);
+
+    num.SetCompact(0x04923456, &fNegative, &fOverflow);
+    BOOST_CHECK(fNegative && !fOverflow);
+    BOOST_CHECK_EQUAL(num.GetCompact(true), 0x04923456U);
+
+    num.SetCompact(0x1d00ffff, &fNegative, &fOverflow);
+    BOOST_CHECK(!fNegative && !fOverflow);
+    BOOST_CHECK(num == (arith_uint256(0xffff) << 208));
+    BOOST_CHECK_EQUAL(num.GetCompact(), 0x1d00ffffU);
+
+    num.SetCompact(0xff123456, &fNegative, &fOverflow);
+    BOOST_CHECK(fOverflow);
+}
+
+// Everything below must give exactly the same results as the CBigNum code
+// it replaced in the difficulty and chain work calculations.
+BOOST_AUTO_TEST_CASE(arith_cbignum_crosscheck)
+{
+    for (int i = 0; i < 2000; i++)
+    {
+        arith_uint256 a = RandArith(1 + GetRand(256));
+        arith_uint256 b = RandArith(1 + GetRand(256));
+        uint64 n = GetRand(std::numeric_limits<uint64>::max());
+        unsigned int nShift = GetRand(256);
+        CBigNum bnA(a.getuint256());
+        CBigNum bnB(b.getuint256());
+
+        BOOST_CHECK_EQUAL(a < b, bnA < bnB);
+        BOOST_CHECK_EQUAL(a == b, bnA == bnB);
+        BOOST_CHECK_EQUAL(a.GetCompact(), bnA.GetCompact());
+        if (!!b)
+            BOOST_CHECK((a / b).getuint256() == (bnA / bnB).getuint256());
+        if (n != 0)
+            BOOST_CHECK((a / n).getuint256() == (bnA / CBigNum(n)).getuint256());
+        BOOST_CHECK((a >> nShift).getuint256() == (bnA >> nShift).getuint256());
+
+        // Products and sums that still fit in 256 bits
+        arith_uint256 c = RandArith(190);
+        CBigNum bnC(c.getuint256());
+        BOOST_CHECK((c * n).getuint256() == (bnC * CBigNum(n)).getuint256());
+        BOOST_CHECK((c + (a >> 1)).getuint256() == (bnC + (bnA >> 1)).getuint256());
+        BOOST_CHECK(((c << 60) >> nShift).getuint256() == ((bnC << 60) >> nShift).getuint256());
+
+        // Compact round trip, as used for nBits
+        unsigned int nBits = (3 + GetRand(30)) << 24 | (unsigned int)GetRand(0x800000);
+        bool fNegative, fOverflow;
+        arith_uint256 target;
+        target.SetCompact(nBits, &fNegative, &fOverflow);
+        CBigNum bnTarget;
+        bnTarget.SetCompact(nBits);
+        BOOST_CHECK(!fNegative && !fOverflow);
+        BOOST_CHECK(target.getuint256() == bnTarget.getuint256());
+        BOOST_CHECK_EQUAL(target.GetCompact(), bnTarget.GetCompact());
+
+        // Block work, see CBlockIndex::GetBlockWork
+        if (!!target)
+        {
+            arith_uint256 work = (~target / (target + 1)) + 1;
+            CBigNum bnWork = (CBigNum(1) << 256) / (bnTarget + 1);
+            BOOST_CHECK(work.getuint256() == bnWork.getuint256());
+        }
+
+        // Retarget step, see GetNextWorkRequired
+        int64 nTimespan = 1 + GetRand(1200);
+        BOOST_CHECK_EQUAL(RetargetArith(target, nTimespan, 600, ~arith_uint256()),
+                          RetargetBigNum(bnTarget, nTimespan, 600, CBigNum(~uint256(0))));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(arith_retarget_limit)
+{
+    // At regtest's limit the target times the timespan needs more than
+    // 256 bits, which must clamp to the limit rather than wrap
+    arith_uint256 limit = ~arith_uint256() >> 1;
+    CBigNum bnLimit(~uint256(0) >> 1);
+    const unsigned int nBitsLimits[] = { 0x207fffff, 0x1f7fffff, 0x1e0fffff, 0x1d00ffff };
+    for (unsigned int i = 0; i < sizeof(nBitsLimits) / sizeof(nBitsLimits[0]); i++)
+    {
+        arith_uint256 target;
+        target.SetCompact(nBitsLimits[i]);
+        CBigNum bnTarget;
+        bnTarget.SetCompact(nBitsLimits[i]);
+        for (int64 nTimespan = 1; nTimespan <= 1200; nTimespan += 7)
+        {
+            BOOST_CHECK_EQUAL(RetargetArith(target, nTimespan, 900, limit),
+                              RetargetBigNum(bnTarget, nTimespan, 900, bnLimit));
+            BOOST_CHECK_EQUAL(RetargetArith(target, nTimespan, 900, ~arith_uint256()),
+                              RetargetBigNum(bnTarget, nTimespan, 900, CBigNum(~uint256(0))));
+        }
+    }
+    arith_uint256 target;
+    target.SetCompact(0x207fffff);
+    BOOST_CHECK_EQUAL(RetargetArith(target, 1200, 900, limit), 0x207fffffU);
+    BOOST_CHECK_EQUAL(RetargetArith(target, 450, 900, limit), 0x203fffffU);
+
+    // Overflow is reported exactly when the result needs 257 bits
+    bool fOverflow;
+    arith_uint256 max = ~arith_uint256();
+    BOOST_CHECK(arith_uint256(max).MulDiv(3, 3, &fOverflow) == max && !fOverflow);
+    arith_uint256(max).MulDiv(4, 3, &fOverflow);
+    BOOST_CHECK(fOverflow);
+    arith_uint256(limit + 1).MulDiv(2, 1, &fOverflow);
+    BOOST_CHECK(fOverflow);
+    BOOST_CHECK(arith_uint256(limit).MulDiv(2, 1, &fOverflow) == max - 1 && !fOverflow);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
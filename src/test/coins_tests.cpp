@@ -0,0 +1,333 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "util.h"
+
+#include <map>
+
+BOOST_AUTO_TEST_SUITE(coins_tests)
+
+// In-memory stand-in for CCoinsViewDB that records what reaches it
+class CCoinsViewTest : public CCoinsView
+{
+public:
+    std::map<uint256, CCoins> mapCoins;
+    unsigned int nReads;
+    unsigned int nWrites;
+
+    CCoinsViewTest() : nReads(0), nWrites(0) {}
+
+    bool GetCoins(const uint256 &txid, CCoins &coins)
+    {
+        nReads++;
+        std::map<uint256, CCoins>::iterator it = mapCoins.find(txid);
+        if (it == mapCoins.end())
+            return false;
+        coins = it->second;
+        return true;
+    }
+
+    bool HaveCoins(const uint256 &txid)
+    {
+        CCoins coins;
+        return GetCoins(txid, coins);
+    }
+
+    bool BatchWrite(const CCoinsMap &mapWrite, CBlockIndex *pindex)
+    {
+        for (CCoinsMap::const_iterator it = mapWrite.begin(); it != mapWrite.end(); it++)
+        {
+            if (!(it->second.flags & CCoinsCacheEntry::DIRTY))
+                continue;
+            BOOST_CHECK(!((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) ||
+                        mapCoins.count(it->first) == 0);
+            nWrites++;
+            if (it->second.coins.IsPruned())
+                mapCoins.erase(it->first);
+            else
+                mapCoins[it->first] = it->second.coins;
+        }
+        return true;
+    }
+};
+
+// Checks the incremental memory accounting against a full recount
+class CCoinsViewCacheTest : public CCoinsViewCache
+{
+public:
+    CCoinsViewCacheTest(CCoinsView &baseIn) : CCoinsViewCache(baseIn) {}
+
+    void SelfTest() const
+    {
+        size_t nUsage = 0;
+        for (CCoinsMap::const_iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++)
+            nUsage += it->second.coins.DynamicMemoryUsage();
+        BOOST_CHECK_EQUAL(nCachedCoinsUsage, nUsage);
+        BOOST_CHECK_EQUAL(DynamicMemoryUsage(), memusage::DynamicUsage(cacheCoins) + nUsage);
+    }
+};
+
+static CCoins RandomCoins()
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = GetRandHash();
+    tx.vout.resize(2);
+    tx.vout[0].nValue = GetRand(COIN);
+    tx.vout[1].nValue = GetRand(COIN);
+    return CCoins(tx, 1);
+}
+
+static void SpendAll(CCoins &coins)
+{
+    CTxInUndo undo;
+    for (unsigned int n = 0; n < coins.vout.size(); n++)
+        coins.Spend(COutPoint(0, n), undo);
+}
+
+BOOST_AUTO_TEST_CASE(coins_fresh_never_written)
+{
+    CCoinsViewTest base;
+    CCoinsViewCache cache(base);
+
+    uint256 txid = GetRandHash();
+    *cache.ModifyCoins(txid) = RandomCoins();
+    SpendAll(*cache.ModifyCoins(txid));
+    BOOST_CHECK(!cache.HaveCoins(txid));
+
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(base.nWrites, 0U);
+    BOOST_CHECK(base.mapCoins.empty());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(coins_only_dirty_written)
+{
+    CCoinsViewTest base;
+    uint256 txidRead = GetRandHash(), txidModified = GetRandHash();
+    base.mapCoins[txidRead] = RandomCoins();
+    base.mapCoins[txidModified] = RandomCoins();
+
+    CCoinsViewCache cache(base);
+    BOOST_CHECK(cache.HaveCoins(txidRead));
+    CTxInUndo undo;
+    BOOST_CHECK(cache.ModifyCoins(txidModified)->Spend(COutPoint(txidModified, 0), undo));
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(base.nWrites, 1U);
+    BOOST_CHECK(!base.mapCoins[txidModified].IsAvailable(0));
+
+    // Both entries survive the flush, so reading them again is a cache hit
+    unsigned int nReads = base.nReads;
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 2U);
+    BOOST_CHECK(cache.HaveCoins(txidRead) && cache.HaveCoins(txidModified));
+    BOOST_CHECK_EQUAL(base.nReads, nReads);
+
+    // A second flush without changes writes nothing
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(base.nWrites, 1U);
+
+    // Spending an entry the base has must erase it there
+    SpendAll(*cache.ModifyCoins(txidRead));
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(base.nWrites, 2U);
+    BOOST_CHECK(base.mapCoins.count(txidRead) == 0);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1U);
+}
+
+// What ConnectBlock does for each transaction: the BIP30 lookup misses, then
+// the outputs are added without asking the base again
+BOOST_AUTO_TEST_CASE(coins_new_not_read)
+{
+    CCoinsViewTest base;
+    CCoinsViewCache cache(base);
+
+    uint256 txid = GetRandHash(), txidSpent = GetRandHash();
+    BOOST_CHECK(!cache.HaveCoins(txid));
+    BOOST_CHECK(!cache.HaveCoins(txidSpent));
+    BOOST_CHECK_EQUAL(base.nReads, 2U);
+    *cache.ModifyNewCoins(txid) = RandomCoins();
+    *cache.ModifyNewCoins(txidSpent) = RandomCoins();
+    BOOST_CHECK_EQUAL(base.nReads, 2U);
+    BOOST_CHECK_EQUAL(cache.GetMisses(), 2U);
+
+    // A new entry spent in the same view never reaches the base
+    SpendAll(*cache.ModifyCoins(txidSpent));
+    BOOST_CHECK_EQUAL(base.nReads, 2U);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(base.nWrites, 1U);
+    BOOST_CHECK(base.mapCoins.count(txid) == 1);
+    BOOST_CHECK(base.mapCoins.count(txidSpent) == 0);
+}
+
+// The layout used by SetBestChain: a per-block view on top of pcoinsTip
+BOOST_AUTO_TEST_CASE(coins_two_level)
+{
+    CCoinsViewTest base;
+    CCoinsViewCache tip(base);
+
+    std::vector<uint256> vTxid;
+    for (int i = 0; i < 20; i++)
+    {
+        CCoinsViewCache view(tip, true);
+        uint256 txid = GetRandHash();
+        *view.ModifyCoins(txid) = RandomCoins();
+        vTxid.push_back(txid);
+        // Every other block spends the output created by the previous one
+        if (i % 2 == 1)
+            SpendAll(*view.ModifyCoins(vTxid[i - 1]));
+        BOOST_CHECK(view.Flush());
+    }
+    BOOST_CHECK_EQUAL(tip.GetCacheSize(), 10U);
+    BOOST_CHECK(tip.Flush());
+    BOOST_CHECK_EQUAL(base.nWrites, 10U);
+    for (int i = 0; i < 20; i++)
+        BOOST_CHECK_EQUAL(base.mapCoins.count(vTxid[i]), (size_t)(i % 2));
+}
+
+BOOST_AUTO_TEST_CASE(coins_memory_usage)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(base);
+    size_t nEmpty = cache.DynamicMemoryUsage();
+
+    std::vector<uint256> vTxid;
+    size_t nCoinsUsage = 0;
+    for (int i = 0; i < 100; i++)
+    {
+        CCoins coins = RandomCoins();
+        coins.vout[0].scriptPubKey = CScript() << std::vector<unsigned char>(20 + i, 0x01) << OP_CHECKSIG;
+        coins.Cleanup();
+        nCoinsUsage += coins.DynamicMemoryUsage();
+        vTxid.push_back(GetRandHash());
+        *cache.ModifyCoins(vTxid.back()) = coins;
+    }
+    // Scripts and output vectors are counted, on top of the map itself
+    BOOST_CHECK(cache.DynamicMemoryUsage() >= nEmpty + nCoinsUsage + 100 * sizeof(CCoinsCacheEntry));
+    cache.SelfTest();
+
+    // Flushing keeps the entries and their usage
+    BOOST_CHECK(cache.Flush());
+    size_t nFlushed = cache.DynamicMemoryUsage();
+    BOOST_CHECK(nFlushed >= nCoinsUsage);
+    BOOST_CHECK_EQUAL(cache.GetFlushes(), 1U);
+    cache.SelfTest();
+
+    // Trimming drops clean entries until the usage fits
+    cache.Trim(nFlushed / 2);
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= nFlushed / 2);
+    BOOST_CHECK(cache.GetCacheSize() < 100U);
+    cache.SelfTest();
+
+    // Spending everything leaves only the map itself
+    for (int i = 0; i < 100; i++)
+        if (cache.HaveCoins(vTxid[i]))
+            SpendAll(*cache.ModifyCoins(vTxid[i]));
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    BOOST_CHECK(base.mapCoins.empty());
+    cache.SelfTest();
+}
+
+BOOST_AUTO_TEST_CASE(coins_prefetch)
+{
+    CCoinsViewTest base;
+    std::vector<uint256> vTxid;
+    for (int i = 0; i < 3; i++)
+    {
+        vTxid.push_back(GetRandHash());
+        base.mapCoins[vTxid.back()] = RandomCoins();
+    }
+    CCoinsViewCacheTest cache(base);
+    BOOST_CHECK(cache.HaveCoins(vTxid[0]));
+    unsigned int nReads = base.nReads;
+
+    // Already cached and duplicate txids are looked up once at most
+    vTxid.push_back(GetRandHash());
+    vTxid.push_back(vTxid[1]);
+    int nThreads = nCoinsFetchThreads;
+    nCoinsFetchThreads = 2;
+    cache.Prefetch(vTxid);
+    nCoinsFetchThreads = nThreads;
+    BOOST_CHECK_EQUAL(base.nReads, nReads + 3);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 3U);
+    cache.SelfTest();
+
+    // Prefetched entries are clean and served from the cache
+    for (int i = 0; i < 3; i++)
+        BOOST_CHECK(cache.GetCoins(vTxid[i]) == base.mapCoins[vTxid[i]]);
+    BOOST_CHECK_EQUAL(base.nReads, nReads + 3);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(base.nWrites, 0U);
+}
+
+// Backend whose writes can be held back, to observe a batch in flight
+class CCoinsViewGated : public CCoinsView
+{
+public:
+    boost::mutex gate;
+    std::map<uint256, CCoins> mapCoins;
+
+    bool GetCoins(const uint256 &txid, CCoins &coins)
+    {
+        std::map<uint256, CCoins>::iterator it = mapCoins.find(txid);
+        if (it == mapCoins.end())
+            return false;
+        coins = it->second;
+        return true;
+    }
+
+    bool HaveCoins(const uint256 &txid)
+    {
+        return mapCoins.count(txid) > 0;
+    }
+
+    bool BatchWrite(const CCoinsMap &mapWrite, CBlockIndex *pindex)
+    {
+        boost::unique_lock<boost::mutex> lock(gate);
+        for (CCoinsMap::const_iterator it = mapWrite.begin(); it != mapWrite.end(); it++)
+        {
+            if (it->second.coins.IsPruned())
+                mapCoins.erase(it->first);
+            else
+                mapCoins[it->first] = it->second.coins;
+        }
+        return true;
+    }
+};
+
+BOOST_AUTO_TEST_CASE(coins_async_flush)
+{
+    CCoinsViewGated base;
+    uint256 txidSpent = GetRandHash(), txidNew = GetRandHash();
+    base.mapCoins[txidSpent] = RandomCoins();
+
+    CCoinsViewAsyncFlush flusher(base);
+    CCoinsViewCache tip(flusher);
+    SpendAll(*tip.ModifyCoins(txidSpent));
+    CCoins coinsNew = RandomCoins();
+    *tip.ModifyCoins(txidNew) = coinsNew;
+
+    {
+        // Hold the writer back: the batch is in flight, not yet in the base
+        boost::unique_lock<boost::mutex> lock(base.gate);
+        BOOST_CHECK_EQUAL(flusher.DynamicMemoryUsage(), 0U);
+        BOOST_CHECK(tip.Flush());
+        BOOST_CHECK(flusher.DynamicMemoryUsage() >= coinsNew.DynamicMemoryUsage());
+        tip.Trim(0);
+        BOOST_CHECK_EQUAL(tip.GetCacheSize(), 0U);
+
+        CCoins coins;
+        BOOST_CHECK(tip.GetCoins(txidNew, coins) && coins == coinsNew);
+        BOOST_CHECK(!tip.HaveCoins(txidSpent));
+        BOOST_CHECK(base.mapCoins.count(txidNew) == 0);
+    }
+
+    BOOST_CHECK(flusher.Sync());
+    BOOST_CHECK_EQUAL(flusher.DynamicMemoryUsage(), 0U);
+    BOOST_CHECK(base.mapCoins.count(txidNew) == 1);
+    BOOST_CHECK(base.mapCoins.count(txidSpent) == 0);
+    CCoins coins;
+    BOOST_CHECK(tip.GetCoins(txidNew, coins) && coins == coinsNew);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,70 @@
+#include <boost/test/unit_test.hpp>
+
+#include "powhash.h"
+#include "hash.h"
+#include "hashgroestl.h"
+#include "scrypt.h"
+#include "util.h"
+
+BOOST_AUTO_TEST_SUITE(powhash_tests)
+
+static CBlockHeader RandomHeader()
+{
+    CBlockHeader header;
+    header.nVersion = (int)GetRand(0x7fffffff);
+    header.hashPrevBlock = GetRandHash();
+    header.hashMerkleRoot = GetRandHash();
+    header.nTime = (unsigned int)GetRand(0xffffffff);
+    header.nBits = (unsigned int)GetRand(0xffffffff);
+    header.nNonce = (unsigned int)GetRand(0xffffffff);
+    return header;
+}
+
+BOOST_AUTO_TEST_CASE(powhash_sha256d)
+{
+    for (int i = 0; i < 100; i++)
+    {
+        CBlockHeader header = RandomHeader();
+        CPoWHasher<ALGO_SHA256D> hasher(header);
+        for (int j = 0; j < 10; j++)
+        {
+            header.nNonce += (unsigned int)GetRand(1000);
+            BOOST_CHECK(hasher.Hash(header.nNonce) == Hash(BEGIN(header.nVersion), END(header.nNonce)));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(powhash_groestl)
+{
+    for (int i = 0; i < 100; i++)
+    {
+        CBlockHeader header = RandomHeader();
+        CPoWHasher<ALGO_GROESTL> hasher(header);
+        for (int j = 0; j < 10; j++)
+        {
+            header.nNonce += (unsigned int)GetRand(1000);
+            uint256 hash = hasher.Hash(header.nNonce);
+            BOOST_CHECK(hash == HashGroestl(BEGIN(header.nVersion), END(header.nNonce)));
+            BOOST_CHECK(hash == header.GetPoWHash(ALGO_GROESTL));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(powhash_scrypt)
+{
+    for (int i = 0; i < 5; i++)
+    {
+        CBlockHeader header = RandomHeader();
+        CPoWHasher<ALGO_SCRYPT> hasher(header);
+        for (int j = 0; j < 2; j++)
+        {
+            header.nNonce += (unsigned int)GetRand(1000);
+            uint256 hash;
+            scrypt_1024_1_1_256(BEGIN(header.nVersion), BEGIN(hash));
+            BOOST_CHECK(hasher.Hash(header.nNonce) == hash);
+            BOOST_CHECK(header.GetPoWHash(ALGO_SCRYPT) == hash);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
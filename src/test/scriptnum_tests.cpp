@@ -0,0 +1,173 @@
+#include <boost/test/unit_test.hpp>
+
+#include "bignum.h"
+#include "core.h"
+#include "script.h"
+#include "util.h"
+
+BOOST_AUTO_TEST_SUITE(scriptnum_tests)
+
+typedef std::vector<unsigned char> valtype;
+
+// What the interpreter used to do with a stack element before CScriptNum
+static CBigNum CastToBigNum(const valtype& vch)
+{
+    return CBigNum(CBigNum(vch).getvch());
+}
+
+static void CheckDecode(const valtype& vch)
+{
+    CBigNum bn = CastToBigNum(vch);
+    CScriptNum num(vch);
+    BOOST_CHECK(num.getvch() == bn.getvch());
+    BOOST_CHECK_EQUAL(num.getint(), bn.getint());
+}
+
+static valtype RandomEncoding(unsigned int nSize)
+{
+    valtype vch(nSize);
+    for (unsigned int i = 0; i < nSize; i++)
+        vch[i] = (unsigned char)GetRand(256);
+    // Favour the interesting top bytes: zero, sign only, and near the limits
+    static const unsigned char vTop[] = {0x00, 0x80, 0x7f, 0xff, 0x01, 0x81};
+    if (nSize > 0 && GetRand(2))
+        vch[nSize - 1] = vTop[GetRand(sizeof(vTop))];
+    return vch;
+}
+
+BOOST_AUTO_TEST_CASE(scriptnum_decode)
+{
+    // Every encoding of up to two bytes, including negative zero and
+    // non-minimal ones
+    CheckDecode(valtype());
+    for (unsigned int n = 0; n < 0x100; n++)
+        CheckDecode(valtype(1, (unsigned char)n));
+    for (unsigned int n = 0; n < 0x10000; n++)
+    {
+        valtype vch(2);
+        vch[0] = n & 0xff;
+        vch[1] = n >> 8;
+        CheckDecode(vch);
+    }
+    for (int i = 0; i < 20000; i++)
+    {
+        CheckDecode(RandomEncoding(3));
+        CheckDecode(RandomEncoding(4));
+    }
+
+    // Operands longer than four bytes are rejected
+    BOOST_CHECK_THROW(CScriptNum(valtype(5, 0)), scriptnum_error);
+    BOOST_CHECK_THROW(CScriptNum(valtype(5, 0)), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(scriptnum_encode)
+{
+    static const int64 values[] = {
+        0, 1, -1, 2, -2, 127, -127, 128, -128, 255, -255, 256, -256,
+        32767, -32767, 32768, -32768, 65535, -65535, 65536, -65536,
+        8388607, -8388607, 8388608, -8388608,
+        2147483647, -2147483647, 2147483648LL, -2147483648LL,
+        4294967294LL, -4294967294LL, 4294967295LL, -4294967295LL,
+        549755813887LL, -549755813887LL, 549755813888LL, -549755813888LL,
+        std::numeric_limits<int64>::max(), std::numeric_limits<int64>::min() + 1
+    };
+    for (unsigned int i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    {
+        CBigNum bn(values[i]);
+        BOOST_CHECK(CScriptNum(values[i]).getvch() == bn.getvch());
+        BOOST_CHECK(CScriptNum::serialize(values[i]) == bn.getvch());
+        BOOST_CHECK_EQUAL(CScriptNum(values[i]).getint(), bn.getint());
+    }
+    for (int i = 0; i < 10000; i++)
+    {
+        int64 n = (int64)(GetRand(std::numeric_limits<uint64>::max()) >> (1 + GetRand(63)));
+        if (GetRand(2))
+            n = -n;
+        BOOST_CHECK(CScriptNum::serialize(n) == CBigNum(n).getvch());
+    }
+}
+
+// Operands on both sides of every byte boundary up to the 4-byte limit
+static std::vector<valtype> BoundaryOperands()
+{
+    std::vector<valtype> vOperands;
+    vOperands.push_back(valtype());
+    vOperands.push_back(valtype(1, 0x80));
+    valtype vchZeros(4, 0);
+    vOperands.push_back(vchZeros);
+    static const int64 values[] = {1, 2, 16, 17, 127, 128, 255, 256, 32767, 32768, 65535, 65536, 8388607, 8388608, 2147483647};
+    for (unsigned int i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    {
+        vOperands.push_back(CBigNum(values[i]).getvch());
+        vOperands.push_back(CBigNum(-values[i]).getvch());
+    }
+    return vOperands;
+}
+
+BOOST_AUTO_TEST_CASE(scriptnum_arithmetic)
+{
+    std::vector<valtype> vOperands = BoundaryOperands();
+    for (unsigned int i = 0; i < vOperands.size(); i++)
+    {
+        CBigNum bn1 = CastToBigNum(vOperands[i]);
+        CScriptNum num1(vOperands[i]);
+
+        BOOST_CHECK((num1 + 1).getvch() == (bn1 + 1).getvch());
+        BOOST_CHECK((num1 - 1).getvch() == (bn1 - 1).getvch());
+        BOOST_CHECK((-num1).getvch() == (-bn1).getvch());
+
+        for (unsigned int j = 0; j < vOperands.size(); j++)
+        {
+            CBigNum bn2 = CastToBigNum(vOperands[j]);
+            CScriptNum num2(vOperands[j]);
+
+            BOOST_CHECK((num1 + num2).getvch() == (bn1 + bn2).getvch());
+            BOOST_CHECK((num1 - num2).getvch() == (bn1 - bn2).getvch());
+            BOOST_CHECK((num1 == num2) == (bn1 == bn2));
+            BOOST_CHECK((num1 != num2) == (bn1 != bn2));
+            BOOST_CHECK((num1 < num2) == (bn1 < bn2));
+            BOOST_CHECK((num1 > num2) == (bn1 > bn2));
+            BOOST_CHECK((num1 <= num2) == (bn1 <= bn2));
+            BOOST_CHECK((num1 >= num2) == (bn1 >= bn2));
+        }
+    }
+}
+
+// Runs the numeric opcodes through the interpreter and compares the results
+// with the same operations done on CBigNum
+BOOST_AUTO_TEST_CASE(scriptnum_interpreter)
+{
+    std::vector<valtype> vOperands = BoundaryOperands();
+    CTransaction txTo;
+    for (unsigned int i = 0; i < vOperands.size(); i++)
+    {
+        CBigNum bn1 = CastToBigNum(vOperands[i]);
+        for (unsigned int j = 0; j < vOperands.size(); j++)
+        {
+            CBigNum bn2 = CastToBigNum(vOperands[j]);
+            CBigNum vExpected[] = {
+                bn1 + bn2, bn1 - bn2, bn1 < bn2 ? bn1 : bn2, bn1 > bn2 ? bn1 : bn2,
+                CBigNum(bn1 < bn2), CBigNum(bn1 != 0 && bn2 != 0)
+            };
+            opcodetype vOpcodes[] = {OP_ADD, OP_SUB, OP_MIN, OP_MAX, OP_LESSTHAN, OP_BOOLAND};
+            for (unsigned int k = 0; k < sizeof(vOpcodes) / sizeof(vOpcodes[0]); k++)
+            {
+                std::vector<valtype> stack;
+                CScript script = CScript() << vOperands[i] << vOperands[j] << vOpcodes[k];
+                BOOST_CHECK(EvalScript(stack, script, txTo, 0, SCRIPT_VERIFY_NONE, 0));
+                BOOST_CHECK(stack.size() == 1 && stack[0] == vExpected[k].getvch());
+            }
+        }
+    }
+
+    // Results of up to five bytes may be pushed, but cannot be used again
+    std::vector<valtype> stack;
+    CScript script = CScript() << CBigNum(2147483647).getvch() << OP_DUP << OP_ADD;
+    BOOST_CHECK(EvalScript(stack, script, txTo, 0, SCRIPT_VERIFY_NONE, 0));
+    BOOST_CHECK(stack.size() == 1 && stack[0] == CBigNum(4294967294LL).getvch());
+    stack.clear();
+    script << OP_1ADD;
+    BOOST_CHECK(!EvalScript(stack, script, txTo, 0, SCRIPT_VERIFY_NONE, 0));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
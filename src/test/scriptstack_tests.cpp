@@ -0,0 +1,167 @@
+#include <boost/test/unit_test.hpp>
+
+#include "script.h"
+#include "util.h"
+
+BOOST_AUTO_TEST_SUITE(scriptstack_tests)
+
+typedef std::vector<unsigned char> valtype;
+
+static valtype RandomValue()
+{
+    // Mostly inline sizes, sometimes past the inline limit
+    unsigned int nSize = GetRand(4) ? GetRand(CStackElement::INLINE_SIZE + 1) : GetRand(MAX_SCRIPT_ELEMENT_SIZE + 1);
+    valtype vch(nSize);
+    for (unsigned int i = 0; i < nSize; i++)
+        vch[i] = (unsigned char)GetRand(256);
+    return vch;
+}
+
+static bool Equal(const CScriptStack& stack, const std::vector<valtype>& vModel)
+{
+    if (stack.size() != vModel.size())
+        return false;
+    for (unsigned int i = 0; i < vModel.size(); i++)
+        if (stack.at(i).getvch() != vModel[i])
+            return false;
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE(stackelement_storage)
+{
+    for (int i = 0; i < 1000; i++)
+    {
+        valtype vch1 = RandomValue(), vch2 = RandomValue();
+        CStackElement elem1(vch1), elem2(vch2);
+        BOOST_CHECK(elem1.getvch() == vch1);
+        BOOST_CHECK(elem1.capacity() >= vch1.size());
+        BOOST_CHECK((elem1 == elem2) == (vch1 == vch2));
+
+        // Copies and assignments in both directions between inline and heap
+        CStackElement elem3(elem1);
+        BOOST_CHECK(elem3 == elem1);
+        elem3 = elem2;
+        BOOST_CHECK(elem3.getvch() == vch2);
+        elem3 = elem3;
+        BOOST_CHECK(elem3.getvch() == vch2);
+
+        // Swapping exchanges the values, wherever they are stored
+        std::swap(elem1, elem2);
+        BOOST_CHECK(elem1.getvch() == vch2);
+        BOOST_CHECK(elem2.getvch() == vch1);
+
+        elem1.push_back(0x42);
+        vch2.push_back(0x42);
+        BOOST_CHECK(elem1.getvch() == vch2);
+        elem1.pop_back();
+        vch2.pop_back();
+        BOOST_CHECK(elem1.getvch() == vch2);
+    }
+
+    // A heap buffer is kept for later values
+    CStackElement elem(valtype(200, 0x01));
+    elem.assign(valtype(3, 0x02));
+    BOOST_CHECK(elem.capacity() >= 200);
+    BOOST_CHECK(elem.getvch() == valtype(3, 0x02));
+    elem.clear();
+    BOOST_CHECK(elem.empty());
+    BOOST_CHECK(elem.begin() == elem.end());
+}
+
+BOOST_AUTO_TEST_CASE(scriptstack_operations)
+{
+    CScriptStack stack;
+    std::vector<valtype> vModel;
+    for (int i = 0; i < 5000; i++)
+    {
+        switch (GetRand(vModel.size() > 100 ? 4 : 6))
+        {
+        case 0:
+            if (!vModel.empty())
+            {
+                stack.pop_back();
+                vModel.pop_back();
+            }
+            break;
+        case 1:
+            if (!vModel.empty())
+            {
+                unsigned int nPos = GetRand(vModel.size());
+                stack.erase(stack.begin() + nPos);
+                vModel.erase(vModel.begin() + nPos);
+            }
+            break;
+        case 2:
+            if (vModel.size() >= 2)
+            {
+                unsigned int nFirst = GetRand(vModel.size() - 1);
+                unsigned int nLast = nFirst + 1 + GetRand(vModel.size() - nFirst - 1);
+                stack.erase(stack.begin() + nFirst, stack.begin() + nLast);
+                vModel.erase(vModel.begin() + nFirst, vModel.begin() + nLast);
+            }
+            break;
+        case 3:
+            if (!vModel.empty())
+            {
+                // Duplicate an element already on the stack
+                unsigned int nPos = GetRand(vModel.size());
+                stack.push_back(stack.at(nPos));
+                vModel.push_back(valtype(vModel[nPos]));
+            }
+            break;
+        case 4:
+            {
+                valtype vch = RandomValue();
+                unsigned int nPos = GetRand(vModel.size() + 1);
+                stack.insert(stack.begin() + nPos, CStackElement(vch));
+                vModel.insert(vModel.begin() + nPos, vch);
+            }
+            break;
+        default:
+            {
+                valtype vch = RandomValue();
+                stack.push_back(vch);
+                vModel.push_back(vch);
+            }
+            break;
+        }
+        BOOST_CHECK(Equal(stack, vModel));
+    }
+
+    CScriptStack stackCopy;
+    stackCopy = stack;
+    BOOST_CHECK(Equal(stackCopy, vModel));
+    stack.clear();
+    BOOST_CHECK(stack.empty());
+    BOOST_CHECK(Equal(stackCopy, vModel));
+    BOOST_CHECK_THROW(stack.at(0), std::out_of_range);
+}
+
+// Stack manipulation opcodes give the same result through both EvalScript
+// entry points
+BOOST_AUTO_TEST_CASE(scriptstack_eval)
+{
+    static const opcodetype ops[] = {
+        OP_DUP, OP_2DUP, OP_3DUP, OP_OVER, OP_2OVER, OP_ROT, OP_2ROT, OP_SWAP, OP_2SWAP,
+        OP_TUCK, OP_NIP, OP_DROP, OP_2DROP, OP_PICK, OP_ROLL, OP_DEPTH, OP_SIZE,
+        OP_TOALTSTACK, OP_FROMALTSTACK, OP_HASH160, OP_SHA256, OP_EQUAL, OP_1ADD
+    };
+    CTransaction txTo;
+    for (int i = 0; i < 2000; i++)
+    {
+        CScript script;
+        for (int j = 0; j < 8; j++)
+            script << RandomValue();
+        script << OP_3;
+        for (int j = 0; j < 10; j++)
+            script << ops[GetRand(sizeof(ops) / sizeof(ops[0]))];
+
+        std::vector<valtype> vStack;
+        CScriptStack stack;
+        bool fResult = EvalScript(vStack, script, txTo, 0, SCRIPT_VERIFY_NONE, 0);
+        BOOST_CHECK_EQUAL(EvalScript(stack, script, txTo, 0, SCRIPT_VERIFY_NONE, 0), fResult);
+        BOOST_CHECK(Equal(stack, vStack));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,231 @@
+#include <boost/test/unit_test.hpp>
+
+#include "core.h"
+#include "key.h"
+#include "keystore.h"
+#include "script.h"
+#include "util.h"
+
+BOOST_AUTO_TEST_SUITE(scripttemplate_tests)
+
+typedef std::vector<unsigned char> valtype;
+
+static const unsigned int flagSets[] = {
+    SCRIPT_VERIFY_NONE, SCRIPT_VERIFY_P2SH, SCRIPT_VERIFY_STRICTENC,
+    SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC,
+    SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC | SCRIPT_VERIFY_NOCACHE
+};
+
+struct CTemplateSpend
+{
+    CTransaction tx;
+    CScript scriptPubKey;
+};
+
+// A two input transaction with its first input spending scriptPubKey
+static CTemplateSpend SignedSpend(const CKeyStore &keystore, const CScript &scriptPubKey)
+{
+    CTemplateSpend spend;
+    spend.scriptPubKey = scriptPubKey;
+    spend.tx.vin.resize(2);
+    spend.tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    spend.tx.vin[1].prevout = COutPoint(GetRandHash(), 1);
+    spend.tx.vout.resize(1);
+    spend.tx.vout[0].nValue = GetRand(COIN);
+    BOOST_CHECK(SignSignature(keystore, scriptPubKey, spend.tx, 0));
+    return spend;
+}
+
+// Both paths must agree, whatever the scripts and flags
+static bool CheckBothPaths(const CScript &scriptSig, const CScript &scriptPubKey, const CTransaction &tx, unsigned int nIn)
+{
+    bool fAnyValid = false;
+    for (unsigned int i = 0; i < sizeof(flagSets) / sizeof(flagSets[0]); i++)
+    {
+        bool fResult = VerifyScript(scriptSig, scriptPubKey, tx, nIn, flagSets[i], 0);
+        BOOST_CHECK_EQUAL(VerifyScript(scriptSig, scriptPubKey, tx, nIn, flagSets[i] | SCRIPT_VERIFY_NOTEMPLATE, 0), fResult);
+        fAnyValid |= fResult;
+    }
+    return fAnyValid;
+}
+
+static std::vector<valtype> PushedValues(const CScript &script)
+{
+    std::vector<valtype> vValues;
+    CScript::const_iterator pc = script.begin();
+    opcodetype opcode;
+    valtype vch;
+    while (script.GetOp(pc, opcode, vch))
+        vValues.push_back(vch);
+    return vValues;
+}
+
+static CScript PushValues(const std::vector<valtype> &vValues)
+{
+    CScript script;
+    for (unsigned int i = 0; i < vValues.size(); i++)
+        script << vValues[i];
+    return script;
+}
+
+// A random change to a valid scriptSig, from bit flips to restructuring
+static CScript Mutate(const CScript &scriptSig)
+{
+    std::vector<valtype> vValues = PushedValues(scriptSig);
+    unsigned int n = vValues.size();
+    if (n == 0)
+        return CScript() << valtype(GetRand(3), (unsigned char)GetRand(0x100));
+    switch (GetRand(9))
+    {
+    case 0:
+        {
+            // Flip a bit anywhere in the raw script
+            CScript script = scriptSig;
+            script[GetRand(script.size())] ^= (unsigned char)(1 << GetRand(8));
+            return script;
+        }
+    case 1:
+        {
+            // Flip a bit in one pushed value, keeping the structure
+            valtype &vch = vValues[GetRand(n)];
+            if (!vch.empty())
+                vch[GetRand(vch.size())] ^= (unsigned char)(1 << GetRand(8));
+            break;
+        }
+    case 2:
+        // Change the hash type
+        if (!vValues[0].empty())
+            vValues[0].back() = (unsigned char)GetRand(0x100);
+        else if (n > 1 && !vValues[1].empty())
+            vValues[1].back() = (unsigned char)GetRand(0x100);
+        break;
+    case 3:
+        vValues.erase(vValues.begin() + GetRand(n));
+        break;
+    case 4:
+        vValues.insert(vValues.begin() + GetRand(n + 1), valtype(GetRand(3), (unsigned char)GetRand(0x100)));
+        break;
+    case 5:
+        std::swap(vValues[GetRand(n)], vValues[GetRand(n)]);
+        break;
+    case 6:
+        {
+            // Non-push opcodes, and pushes the interpreter treats specially
+            static const opcodetype ops[] = {OP_NOP, OP_1, OP_1NEGATE, OP_DUP, OP_CODESEPARATOR, OP_0};
+            CScript script = scriptSig;
+            script.insert(GetRand(2) ? script.begin() : script.end(), (unsigned char)ops[GetRand(sizeof(ops) / sizeof(ops[0]))]);
+            return script;
+        }
+    case 7:
+        // Truncate the script in the middle of a push
+        return CScript(scriptSig.begin(), scriptSig.begin() + GetRand(scriptSig.size()));
+    default:
+        // A signature pushed with a non-minimal push opcode
+        {
+            CScript script;
+            for (unsigned int i = 0; i < n; i++)
+            {
+                if (i == 0 && vValues[i].size() < 0x100)
+                {
+                    script.insert(script.end(), (unsigned char)OP_PUSHDATA1);
+                    script.insert(script.end(), (unsigned char)vValues[i].size());
+                    script.insert(script.end(), vValues[i].begin(), vValues[i].end());
+                }
+                else
+                    script << vValues[i];
+            }
+            return script;
+        }
+    }
+    return PushValues(vValues);
+}
+
+BOOST_AUTO_TEST_CASE(scripttemplate_differential)
+{
+    CBasicKeyStore keystore;
+    std::vector<CPubKey> vPubKeys;
+    for (int i = 0; i < 4; i++)
+    {
+        CKey key;
+        key.MakeNewKey(i % 2 == 0);
+        keystore.AddKey(key);
+        vPubKeys.push_back(key.GetPubKey());
+    }
+
+    std::vector<CScript> vScripts;
+    CScript script;
+    script.SetDestination(vPubKeys[0].GetID());
+    vScripts.push_back(script);
+    vScripts.push_back(CScript() << vPubKeys[0] << OP_CHECKSIG);
+    vScripts.push_back(CScript() << vPubKeys[1] << OP_CHECKSIG);
+    script.SetMultisig(1, vPubKeys);
+    vScripts.push_back(script);
+    script.SetMultisig(2, std::vector<CPubKey>(vPubKeys.begin(), vPubKeys.begin() + 3));
+    vScripts.push_back(script);
+
+    // The same templates through P2SH
+    unsigned int nBare = vScripts.size();
+    for (unsigned int i = 0; i < nBare; i++)
+    {
+        keystore.AddCScript(vScripts[i]);
+        script.SetDestination(vScripts[i].GetID());
+        vScripts.push_back(script);
+    }
+
+    for (unsigned int i = 0; i < vScripts.size(); i++)
+    {
+        CTemplateSpend spend = SignedSpend(keystore, vScripts[i]);
+        const CScript &scriptSig = spend.tx.vin[0].scriptSig;
+        BOOST_CHECK(VerifyScript(scriptSig, spend.scriptPubKey, spend.tx, 0, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC, 0));
+        BOOST_CHECK(CheckBothPaths(scriptSig, spend.scriptPubKey, spend.tx, 0));
+
+        // Signed for another input, or for another script
+        CheckBothPaths(scriptSig, spend.scriptPubKey, spend.tx, 1);
+        BOOST_CHECK(!VerifyScript(scriptSig, spend.scriptPubKey, spend.tx, 1, SCRIPT_VERIFY_P2SH, 0));
+        CheckBothPaths(scriptSig, vScripts[(i + 1) % vScripts.size()], spend.tx, 0);
+
+        for (int j = 0; j < 100; j++)
+        {
+            CScript scriptMutated = Mutate(scriptSig);
+            CheckBothPaths(scriptMutated, spend.scriptPubKey, spend.tx, 0);
+            CheckBothPaths(Mutate(scriptMutated), spend.scriptPubKey, spend.tx, 0);
+        }
+    }
+}
+
+// Scripts that look like the templates but are not quite them
+BOOST_AUTO_TEST_CASE(scripttemplate_near_misses)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    CBasicKeyStore keystore;
+    keystore.AddKey(key);
+
+    CScript scriptValid = CScript() << pubkey << OP_CHECKSIG;
+    CTemplateSpend spend = SignedSpend(keystore, scriptValid);
+    const CScript &scriptSig = spend.tx.vin[0].scriptSig;
+
+    std::vector<CScript> vScripts;
+    vScripts.push_back(CScript() << pubkey << OP_CHECKSIGVERIFY);
+    vScripts.push_back(CScript() << OP_CODESEPARATOR << pubkey << OP_CHECKSIG);
+    vScripts.push_back(CScript() << OP_1 << pubkey << OP_1 << OP_CHECKMULTISIG);
+    vScripts.push_back(CScript() << OP_1 << pubkey << OP_2 << OP_CHECKMULTISIG);
+    vScripts.push_back(CScript() << OP_2 << pubkey << OP_1 << OP_CHECKMULTISIG);
+    vScripts.push_back(CScript() << OP_0 << pubkey << OP_1 << OP_CHECKMULTISIG);
+    vScripts.push_back(CScript() << OP_1 << pubkey << pubkey << OP_2 << OP_CHECKMULTISIG);
+    vScripts.push_back(CScript() << OP_DUP << OP_HASH160 << pubkey.GetID() << OP_EQUAL << OP_CHECKSIG);
+    vScripts.push_back(CScript() << valtype(pubkey.begin(), pubkey.end() - 1) << OP_CHECKSIG);
+    vScripts.push_back(CScript() << OP_1 << OP_CHECKSIG);
+
+    CScript scriptSigDummy = CScript() << OP_0;
+    scriptSigDummy.insert(scriptSigDummy.end(), scriptSig.begin(), scriptSig.end());
+    for (unsigned int i = 0; i < vScripts.size(); i++)
+    {
+        CheckBothPaths(scriptSig, vScripts[i], spend.tx, 0);
+        CheckBothPaths(scriptSigDummy, vScripts[i], spend.tx, 0);
+        CheckBothPaths(CScript(), vScripts[i], spend.tx, 0);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
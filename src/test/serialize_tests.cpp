@@ -42,4 +42,28 @@ BOOST_AUTO_TEST_CASE(varints)
 
 }
 
+BOOST_AUTO_TEST_CASE(buffer_streams)
+{
+    vector<char> vch;
+    CDataStream ss(SER_DISK, 0);
+    for (int n = 0; n < 3; n++) {
+        // Same bytes as CDataStream, and the buffer is reset on each use
+        CBufferWriter writer(vch, SER_DISK, 0);
+        string str(n * 100, 'x');
+        writer << make_pair('c', str) << VARINT(n * 1000);
+        ss.clear();
+        ss << make_pair('c', str) << VARINT(n * 1000);
+        BOOST_CHECK(writer.size() == ss.size());
+        BOOST_CHECK(vector<char>(ss.begin(), ss.end()) == vch);
+
+        CBufferReader reader(writer.data(), writer.data() + writer.size(), SER_DISK, 0);
+        pair<char, string> p;
+        int i = -1;
+        reader >> p >> VARINT(i);
+        BOOST_CHECK(p.first == 'c' && p.second == str && i == n * 1000);
+        BOOST_CHECK(reader.empty());
+        BOOST_CHECK_THROW(reader >> i, std::ios_base::failure);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,83 @@
+#include <boost/test/unit_test.hpp>
+
+#include "hash.h"
+#include "util.h"
+#include "sha256.h"
+
+BOOST_AUTO_TEST_SUITE(sha256_tests)
+
+typedef int (*ScanFn)(const uint32_t *midstate, const uint32_t *data, uint32_t nonce, uint32_t *hash);
+
+// Check every candidate a scanner reports against a plain double-SHA256 of
+// the header, and that it finds the same candidates as the scalar scanner.
+static int CheckScanner(ScanFn scan, unsigned int nLanes, unsigned int nCount)
+{
+    unsigned char header[80];
+    for (int i = 0; i < 80; i++)
+        header[i] = (unsigned char)(i * 7 + 3);
+
+    // Same padded, word-swapped layout as FormatHashBuffers
+    unsigned char buf[128];
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, header, 80);
+    buf[80] = 0x80;
+    buf[126] = 0x02;
+    buf[127] = 0x80;
+    uint32_t data[32];
+    for (int i = 0; i < 32; i++)
+        data[i] = ByteReverse(((uint32_t*)buf)[i]);
+    uint32_t midstate[8];
+    memcpy(midstate, sha256_init_state, sizeof(midstate));
+    sha256_transform(midstate, data);
+
+    int nFound = 0;
+    unsigned int nNonce = 0;
+    while (nNonce < nCount)
+    {
+        uint32_t hash[8];
+        int nLane = scan(midstate, data + 16, nNonce, hash);
+        if (nLane < 0)
+        {
+            nNonce += nLanes;
+            continue;
+        }
+        unsigned int nFoundNonce = nNonce + nLane;
+        if (nFoundNonce >= nCount)
+            break;
+        nFound++;
+        uint32_t nLE = ByteReverse(nFoundNonce);
+        memcpy(header + 76, &nLE, 4);
+        uint256 expected = Hash(BEGIN(header), END(header));
+        for (int i = 0; i < 8; i++)
+            hash[i] = ByteReverse(hash[i]);
+        BOOST_CHECK(memcmp(hash, expected.begin(), 32) == 0);
+        nNonce = nFoundNonce + 1;
+    }
+    return nFound;
+}
+
+BOOST_AUTO_TEST_CASE(sha256_transform_test)
+{
+    // SHA256("abc"), single padded block
+    uint32_t block[16] = { 0x61626380 };
+    block[15] = 24;
+    uint32_t state[8];
+    memcpy(state, sha256_init_state, sizeof(state));
+    sha256_transform(state, block);
+    const uint32_t expected[8] = { 0xba7816bf, 0x8f01cfea, 0x414140de, 0x5dae2223,
+                                   0xb00361a3, 0x96177a9c, 0xb410ff61, 0xf20015ad };
+    BOOST_CHECK(memcmp(state, expected, sizeof(state)) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(sha256d_scan_test)
+{
+    int nFound = CheckScanner(&sha256d_scan_1way, 1, 200000);
+    BOOST_CHECK(nFound > 0);
+#if defined(USE_SSE2)
+    BOOST_CHECK_EQUAL(CheckScanner(&sha256d_scan_4way_sse2, 4, 200000), nFound);
+#endif
+    sha256_detect();
+    BOOST_CHECK_EQUAL(CheckScanner(sha256d_scan, sha256d_scan_lanes, 200000), nFound);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
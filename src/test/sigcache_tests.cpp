@@ -0,0 +1,105 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include "core.h"
+#include "key.h"
+#include "script.h"
+#include "util.h"
+
+BOOST_AUTO_TEST_SUITE(sigcache_tests)
+
+struct CSignedSpend
+{
+    CTransaction tx;
+    CScript scriptPubKey;
+};
+
+static CSignedSpend SignedSpend(const CKey &key)
+{
+    CSignedSpend spend;
+    spend.scriptPubKey << key.GetPubKey() << OP_CHECKSIG;
+    spend.tx.vin.resize(1);
+    spend.tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    spend.tx.vout.resize(1);
+    spend.tx.vout[0].nValue = GetRand(COIN);
+
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(SignatureHash(spend.scriptPubKey, spend.tx, 0, SIGHASH_ALL), vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.tx.vin[0].scriptSig << vchSig;
+    return spend;
+}
+
+static bool Verify(const CSignedSpend &spend, unsigned int flags)
+{
+    return VerifyScript(spend.tx.vin[0].scriptSig, spend.scriptPubKey, spend.tx, 0, flags, 0);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_hits)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CSignedSpend spend = SignedSpend(key);
+
+    CSignatureCacheStats before, after;
+    GetSignatureCacheStats(before);
+
+    // Without caching, every check misses and nothing is stored
+    BOOST_CHECK(Verify(spend, SCRIPT_VERIFY_NOCACHE));
+    BOOST_CHECK(Verify(spend, SCRIPT_VERIFY_NOCACHE));
+    GetSignatureCacheStats(after);
+    BOOST_CHECK_EQUAL(after.nMisses, before.nMisses + 2);
+    BOOST_CHECK_EQUAL(after.nHits, before.nHits);
+    BOOST_CHECK_EQUAL(after.nEntries, before.nEntries);
+
+    // The first cached check stores the signature, the second finds it
+    BOOST_CHECK(Verify(spend, SCRIPT_VERIFY_NONE));
+    BOOST_CHECK(Verify(spend, SCRIPT_VERIFY_NONE));
+    GetSignatureCacheStats(after);
+    BOOST_CHECK_EQUAL(after.nMisses, before.nMisses + 3);
+    BOOST_CHECK_EQUAL(after.nHits, before.nHits + 1);
+    BOOST_CHECK_EQUAL(after.nEntries, before.nEntries + 1);
+    BOOST_CHECK(after.nEntries <= after.nMaxEntries);
+
+    // A different transaction signed by the same key is not a hit
+    CSignedSpend spend2 = SignedSpend(key);
+    spend2.tx.vin[0].scriptSig = spend.tx.vin[0].scriptSig;
+    BOOST_CHECK(!Verify(spend2, SCRIPT_VERIFY_NONE));
+    GetSignatureCacheStats(after);
+    BOOST_CHECK_EQUAL(after.nHits, before.nHits + 1);
+}
+
+static void VerifyRepeatedly(const std::vector<CSignedSpend> *pspends, bool *pfOk)
+{
+    for (int i = 0; i < 20; i++)
+        for (unsigned int j = 0; j < pspends->size(); j++)
+            if (!Verify((*pspends)[j], SCRIPT_VERIFY_NONE))
+                *pfOk = false;
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_threads)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    std::vector<CSignedSpend> vSpends;
+    for (int i = 0; i < 8; i++)
+        vSpends.push_back(SignedSpend(key));
+
+    CSignatureCacheStats before, after;
+    GetSignatureCacheStats(before);
+
+    bool vfOk[4] = {true, true, true, true};
+    boost::thread_group threads;
+    for (int i = 0; i < 4; i++)
+        threads.create_thread(boost::bind(&VerifyRepeatedly, &vSpends, &vfOk[i]));
+    threads.join_all();
+
+    for (int i = 0; i < 4; i++)
+        BOOST_CHECK(vfOk[i]);
+    GetSignatureCacheStats(after);
+    BOOST_CHECK_EQUAL(after.nHits + after.nMisses, before.nHits + before.nMisses + 4 * 20 * 8);
+    BOOST_CHECK(after.nHits >= before.nHits + 4 * 20 * 8 - 4 * 8);
+    BOOST_CHECK_EQUAL(after.nEntries, before.nEntries + 8);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,119 @@
+#include <boost/test/unit_test.hpp>
+
+#include "core.h"
+#include "script.h"
+#include "util.h"
+
+BOOST_AUTO_TEST_SUITE(sighash_tests)
+
+// The original implementation, which copies the transaction and edits it
+static uint256 SignatureHashOld(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+{
+    if (nIn >= txTo.vin.size())
+        return 1;
+    CTransaction txTmp(txTo);
+
+    scriptCode.FindAndDelete(CScript(OP_CODESEPARATOR));
+
+    for (unsigned int i = 0; i < txTmp.vin.size(); i++)
+        txTmp.vin[i].scriptSig = CScript();
+    txTmp.vin[nIn].scriptSig = scriptCode;
+
+    if ((nHashType & 0x1f) == SIGHASH_NONE)
+    {
+        txTmp.vout.clear();
+        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
+            if (i != nIn)
+                txTmp.vin[i].nSequence = 0;
+    }
+    else if ((nHashType & 0x1f) == SIGHASH_SINGLE)
+    {
+        unsigned int nOut = nIn;
+        if (nOut >= txTmp.vout.size())
+            return 1;
+        txTmp.vout.resize(nOut+1);
+        for (unsigned int i = 0; i < nOut; i++)
+            txTmp.vout[i].SetNull();
+        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
+            if (i != nIn)
+                txTmp.vin[i].nSequence = 0;
+    }
+
+    if (nHashType & SIGHASH_ANYONECANPAY)
+    {
+        txTmp.vin[0] = txTmp.vin[nIn];
+        txTmp.vin.resize(1);
+    }
+
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txTmp << nHashType;
+    return ss.GetHash();
+}
+
+static CScript RandomScript()
+{
+    static const opcodetype ops[] = {OP_FALSE, OP_1, OP_2, OP_3, OP_CHECKSIG, OP_IF, OP_VERIF, OP_RETURN, OP_CODESEPARATOR};
+    CScript script;
+    int nOps = GetRand(10);
+    for (int i = 0; i < nOps; i++)
+    {
+        if (GetRand(3) == 0)
+            script << std::vector<unsigned char>(GetRand(80), (unsigned char)GetRand(256));
+        else
+            script << ops[GetRand(sizeof(ops) / sizeof(ops[0]))];
+    }
+    return script;
+}
+
+static CTransaction RandomTransaction(int nInputs, int nOutputs)
+{
+    CTransaction tx;
+    tx.nVersion = (int)GetRand(3);
+    tx.nLockTime = GetRand(2) ? 0 : (unsigned int)GetRand(500000000);
+    tx.vin.resize(nInputs);
+    for (int i = 0; i < nInputs; i++)
+    {
+        tx.vin[i].prevout = COutPoint(GetRandHash(), (unsigned int)GetRand(4));
+        tx.vin[i].scriptSig = RandomScript();
+        tx.vin[i].nSequence = GetRand(2) ? std::numeric_limits<unsigned int>::max() : (unsigned int)GetRand(1000);
+    }
+    tx.vout.resize(nOutputs);
+    for (int i = 0; i < nOutputs; i++)
+    {
+        tx.vout[i].nValue = GetRand(100 * COIN);
+        tx.vout[i].scriptPubKey = RandomScript();
+    }
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(sighash_matches_copy)
+{
+    static const int hashTypes[] = {
+        0, SIGHASH_ALL, SIGHASH_NONE, SIGHASH_SINGLE, 4,
+        SIGHASH_ALL | SIGHASH_ANYONECANPAY, SIGHASH_NONE | SIGHASH_ANYONECANPAY,
+        SIGHASH_SINGLE | SIGHASH_ANYONECANPAY, 0x41, (int)0xffffff83
+    };
+    for (int i = 0; i < 200; i++)
+    {
+        CTransaction tx = RandomTransaction(1 + GetRand(8), GetRand(6));
+        CSigHashContext context(tx);
+        for (unsigned int nIn = 0; nIn < tx.vin.size(); nIn++)
+        {
+            CScript scriptCode = RandomScript();
+            for (unsigned int j = 0; j < sizeof(hashTypes) / sizeof(hashTypes[0]); j++)
+            {
+                uint256 hash = SignatureHashOld(scriptCode, tx, nIn, hashTypes[j]);
+                BOOST_CHECK(SignatureHash(scriptCode, tx, nIn, hashTypes[j]) == hash);
+                BOOST_CHECK(SignatureHash(scriptCode, tx, nIn, hashTypes[j], &context) == hash);
+            }
+        }
+    }
+
+    // Out of range inputs still hash to one
+    CTransaction tx = RandomTransaction(2, 1);
+    CSigHashContext context(tx);
+    BOOST_CHECK(SignatureHash(CScript(), tx, 2, SIGHASH_ALL, &context) == 1);
+    BOOST_CHECK(SignatureHash(CScript(), tx, 1, SIGHASH_SINGLE, &context) == 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
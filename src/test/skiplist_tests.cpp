@@ -0,0 +1,71 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "util.h"
+
+#include <vector>
+
+#define SKIPLIST_LENGTH 300000
+
+BOOST_AUTO_TEST_SUITE(skiplist_tests)
+
+BOOST_AUTO_TEST_CASE(skiplist_test)
+{
+    std::vector<CBlockIndex> vIndex(SKIPLIST_LENGTH);
+
+    for (int i=0; i<SKIPLIST_LENGTH; i++) {
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = (i == 0) ? NULL : &vIndex[i - 1];
+        vIndex[i].BuildSkip();
+    }
+
+    for (int i=0; i<SKIPLIST_LENGTH; i++) {
+        if (i > 0) {
+            BOOST_CHECK(vIndex[i].pskip == &vIndex[vIndex[i].pskip->nHeight]);
+            BOOST_CHECK(vIndex[i].pskip->nHeight < i);
+        } else {
+            BOOST_CHECK(vIndex[i].pskip == NULL);
+        }
+    }
+
+    for (int i=0; i < 1000; i++) {
+        int from = GetRand(SKIPLIST_LENGTH - 1);
+        int to = GetRand(from + 1);
+
+        BOOST_CHECK(vIndex[SKIPLIST_LENGTH - 1].GetAncestor(from) == &vIndex[from]);
+        BOOST_CHECK(vIndex[from].GetAncestor(to) == &vIndex[to]);
+        BOOST_CHECK(vIndex[from].GetAncestor(0) == &vIndex[0]);
+    }
+    BOOST_CHECK(vIndex[10].GetAncestor(11) == NULL);
+    BOOST_CHECK(vIndex[10].GetAncestor(-1) == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(lastcommonancestor_test)
+{
+    // Two branches forking off a shared trunk at height 4999
+    std::vector<CBlockIndex> vTrunk(5000), vBranchA(3000), vBranchB(7000);
+    for (unsigned int i=0; i<vTrunk.size(); i++) {
+        vTrunk[i].nHeight = i;
+        vTrunk[i].pprev = (i == 0) ? NULL : &vTrunk[i - 1];
+        vTrunk[i].BuildSkip();
+    }
+    for (unsigned int i=0; i<vBranchA.size(); i++) {
+        vBranchA[i].nHeight = vTrunk.size() + i;
+        vBranchA[i].pprev = (i == 0) ? &vTrunk.back() : &vBranchA[i - 1];
+        vBranchA[i].BuildSkip();
+    }
+    for (unsigned int i=0; i<vBranchB.size(); i++) {
+        vBranchB[i].nHeight = vTrunk.size() + i;
+        vBranchB[i].pprev = (i == 0) ? &vTrunk.back() : &vBranchB[i - 1];
+        vBranchB[i].BuildSkip();
+    }
+
+    BOOST_CHECK(LastCommonAncestor(&vBranchA.back(), &vBranchB.back()) == &vTrunk.back());
+    BOOST_CHECK(LastCommonAncestor(&vBranchB[100], &vBranchA.back()) == &vTrunk.back());
+    BOOST_CHECK(LastCommonAncestor(&vBranchA.back(), &vTrunk[1234]) == &vTrunk[1234]);
+    BOOST_CHECK(LastCommonAncestor(&vBranchB[42], &vBranchB[4200]) == &vBranchB[42]);
+    BOOST_CHECK(vBranchB.back().GetAncestor(vTrunk.size() + 10) == &vBranchB[10]);
+    BOOST_CHECK(vBranchA.back().GetAncestor(2500) == &vTrunk[2500]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -291,4 +291,30 @@ BOOST_AUTO_TEST_CASE(util_seed_insecure_rand)
     }
 }
 
+BOOST_AUTO_TEST_CASE(util_MappedFile)
+{
+    boost::filesystem::path path = GetDataDir() / "mappedfile_test.dat";
+    std::vector<char> vch(100000);
+    for (unsigned int i = 0; i < vch.size(); i++)
+        vch[i] = (char)insecure_rand();
+    FILE *file = fopen(path.string().c_str(), "wb");
+    BOOST_REQUIRE(file != NULL);
+    BOOST_CHECK(fwrite(&vch[0], 1, vch.size(), file) == vch.size());
+    fclose(file);
+
+    {
+        CMappedFile mapped(path);
+        BOOST_REQUIRE(mapped.IsValid());
+        BOOST_CHECK_EQUAL(mapped.size(), vch.size());
+        BOOST_CHECK(memcmp(mapped.data(), &vch[0], vch.size()) == 0);
+    }
+
+    // Empty and missing files cannot be mapped
+    file = fopen(path.string().c_str(), "wb");
+    fclose(file);
+    BOOST_CHECK(!CMappedFile(path).IsValid());
+    boost::filesystem::remove(path);
+    BOOST_CHECK(!CMappedFile(path).IsValid());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,7 @@
 #include "main.h"
 #include "hash.h"
 #include "chainparams.h"
+#include "init.h"
 
 using namespace std;
 
@@ -21,7 +22,13 @@ void static BatchWriteHashBestChain(CLevelDBBatch &batch, const uint256 &hash) {
     batch.Write('B', hash);
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe) {
+static CLevelDBOptions ChainstateOptions(size_t nCacheSize) {
+    CLevelDBOptions dbopts = CLevelDBOptions::Chainstate(nCacheSize);
+    dbopts.ApplyArgs("coindb");
+    return dbopts;
+}
+
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", ChainstateOptions(nCacheSize), fMemory, fWipe) {
 }
 
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) { 
@@ -42,7 +49,7 @@ CBlockIndex *CCoinsViewDB::GetBestBlock() {
     uint256 hashBestChain;
     if (!db.Read('B', hashBestChain))
         return NULL;
-    std::map<uint256, CBlockIndex*>::iterator it = mapBlockIndex.find(hashBestChain);
+    BlockMap::iterator it = mapBlockIndex.find(hashBestChain);
     if (it == mapBlockIndex.end())
         return NULL;
     return it->second;
@@ -54,19 +61,35 @@ bool CCoinsViewDB::SetBestBlock(CBlockIndex *pindex) {
     return db.WriteBatch(batch);
 }
 
-bool CCoinsViewDB::BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex) {
-    printf("Committing %u changed transactions to coin database...\n", (unsigned int)mapCoins.size());
-
+bool CCoinsViewDB::BatchWrite(const CCoinsMap &mapCoins, CBlockIndex *pindex) {
     CLevelDBBatch batch;
-    for (std::map<uint256, CCoins>::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++)
-        BatchWriteCoins(batch, it->first, it->second);
+    unsigned int nWritten = 0, nSkipped = 0;
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY))
+            continue;
+        // Created and spent since the last flush: not in the database
+        if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
+            nSkipped++;
+            continue;
+        }
+        BatchWriteCoins(batch, it->first, it->second.coins);
+        nWritten++;
+    }
     if (pindex)
         BatchWriteHashBestChain(batch, pindex->GetBlockHash());
 
+    printf("Committing %u changed transactions (out of %u, %u never stored) to coin database...\n",
+           nWritten, (unsigned int)mapCoins.size(), nSkipped);
     return db.WriteBatch(batch);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDB(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+static CLevelDBOptions BlockIndexOptions(size_t nCacheSize) {
+    CLevelDBOptions dbopts = CLevelDBOptions::BlockIndex(nCacheSize);
+    dbopts.ApplyArgs("blockdb");
+    return dbopts;
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDB(GetDataDir() / "blocks" / "index", BlockIndexOptions(nCacheSize), fMemory, fWipe) {
 }
 
 bool CBlockTreeDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
@@ -112,54 +135,122 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read('l', nFile);
 }
 
-bool CCoinsViewDB::GetStats(CCoinsStats &stats) {
-    leveldb::Iterator *pcursor = db.NewIterator();
-    pcursor->SeekToFirst();
-
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = GetBestBlock()->GetBlockHash();
-    ss << stats.hashBlock;
-    int64 nTotalAmount = 0;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        try {
+// Adds up the coins in a snapshot whose txid starts with a byte in
+// [nBegin, nEnd), and feeds them to pss if given. The key order is the
+// order hashSerialized is defined over, so only a single range covering
+// everything can produce it.
+static void GetStatsRange(CLevelDB *pdb, const leveldb::Snapshot *snapshot, unsigned int nBegin, unsigned int nEnd,
+                          CCoinsStats *pstats, CHashWriter *pss, bool *pfOk) {
+    *pfOk = false;
+    leveldb::Iterator *pcursor = pdb->NewIterator(snapshot);
+    try {
+        char chKeyBegin[2] = {'c', (char)nBegin};
+        for (pcursor->Seek(leveldb::Slice(chKeyBegin, sizeof(chKeyBegin))); pcursor->Valid(); pcursor->Next()) {
+            if (ShutdownRequested())
+                break;
             leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            if (slKey.size() < 2 || slKey[0] != 'c' || (unsigned char)slKey[1] >= nEnd)
+                break;
+            CBufferReader ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
-            ssKey >> chType;
-            if (chType == 'c') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
-                ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n'); 
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
+            uint256 txhash;
+            ssKey >> chType >> txhash;
+            leveldb::Slice slValue = pcursor->value();
+            CBufferReader ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            CCoins coins;
+            ssValue >> coins;
+            if (pss) {
+                *pss << txhash;
+                *pss << VARINT(coins.nVersion);
+                *pss << (coins.fCoinBase ? 'c' : 'n');
+                *pss << VARINT(coins.nHeight);
+            }
+            pstats->nTransactions++;
+            for (unsigned int i=0; i<coins.vout.size(); i++) {
+                const CTxOut &out = coins.vout[i];
+                if (!out.IsNull()) {
+                    pstats->nTransactionOutputs++;
+                    if (pss) {
+                        *pss << VARINT(i+1);
+                        *pss << out;
                     }
+                    pstats->nTotalAmount += out.nValue;
                 }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
             }
-            pcursor->Next();
-        } catch (std::exception &e) {
-            return error("%s() : deserialize error", __PRETTY_FUNCTION__);
+            pstats->nSerializedSize += 32 + slValue.size();
+            if (pss)
+                *pss << VARINT(0);
         }
+        *pfOk = !ShutdownRequested();
+    } catch (std::exception &e) {
+        printf("%s() : deserialize error\n", __PRETTY_FUNCTION__);
     }
     delete pcursor;
-    stats.nHeight = GetBestBlock()->nHeight;
-    stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
+}
+
+bool CCoinsViewDB::GetStats(CCoinsStats &stats) {
+    LOCK(cs_stats);
+
+    // Everything below reads from the snapshot, so block connection can
+    // carry on writing to the database meanwhile. The best block hash is
+    // written in the same batch as the coins, so the two always match.
+    const leveldb::Snapshot *snapshot = db.GetSnapshot();
+    uint256 hashBestChain;
+    if (!db.Read('B', hashBestChain, snapshot)) {
+        db.ReleaseSnapshot(snapshot);
+        return false;
+    }
+    if (statsCached.hashBlock == hashBestChain && (statsCached.fHashSerialized || !stats.fHashSerialized)) {
+        db.ReleaseSnapshot(snapshot);
+        stats = statsCached;
+        return true;
+    }
+
+    CCoinsStats statsNew;
+    statsNew.hashBlock = hashBestChain;
+    statsNew.fHashSerialized = stats.fHashSerialized;
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(hashBestChain);
+        if (mi != mapBlockIndex.end())
+            statsNew.nHeight = mi->second->nHeight;
+    }
+
+    bool fOk = true;
+    if (statsNew.fHashSerialized) {
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        ss << hashBestChain;
+        GetStatsRange(&db, snapshot, 0, 256, &statsNew, &ss, &fOk);
+        statsNew.hashSerialized = ss.GetHash();
+    } else {
+        // txids are uniformly distributed, so equal ranges of their first
+        // byte give each thread about the same amount of work
+        int nThreads = std::min(std::max((int)boost::thread::hardware_concurrency(), 1), 16);
+        std::vector<CCoinsStats> vStats(nThreads);
+        bool vOk[16];
+        {
+            // The workers use the snapshot: do not leave while they run
+            boost::this_thread::disable_interruption di;
+            boost::thread_group threads;
+            for (int i = 0; i < nThreads; i++)
+                threads.create_thread(boost::bind(&GetStatsRange, &db, snapshot, 256 * i / nThreads, 256 * (i + 1) / nThreads,
+                                                  &vStats[i], (CHashWriter*)NULL, &vOk[i]));
+            threads.join_all();
+        }
+        for (int i = 0; i < nThreads; i++) {
+            fOk = fOk && vOk[i];
+            statsNew.nTransactions += vStats[i].nTransactions;
+            statsNew.nTransactionOutputs += vStats[i].nTransactionOutputs;
+            statsNew.nSerializedSize += vStats[i].nSerializedSize;
+            statsNew.nTotalAmount += vStats[i].nTotalAmount;
+        }
+    }
+    db.ReleaseSnapshot(snapshot);
+    if (!fOk)
+        return error("%s() : scan of the coin database failed", __PRETTY_FUNCTION__);
+
+    statsCached = statsNew;
+    stats = statsNew;
     return true;
 }
 
@@ -190,21 +281,22 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
 {
     leveldb::Iterator *pcursor = NewIterator();
 
-    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    std::vector<char> vchKeySet;
+    CBufferWriter ssKeySet(vchKeySet, SER_DISK, CLIENT_VERSION);
     ssKeySet << make_pair('b', uint256(0));
-    pcursor->Seek(ssKeySet.str());
+    pcursor->Seek(leveldb::Slice(ssKeySet.data(), ssKeySet.size()));
 
     // Load mapBlockIndex
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         try {
             leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            CBufferReader ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
             ssKey >> chType;
             if (chType == 'b') {
                 leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+                CBufferReader ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
                 CDiskBlockIndex diskindex;
                 ssValue >> diskindex;
 
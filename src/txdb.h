@@ -13,6 +13,10 @@ class CCoinsViewDB : public CCoinsView
 {
 protected:
     CLevelDB db;
+
+    // last GetStats result, reused while the best block stays the same
+    CCriticalSection cs_stats;
+    CCoinsStats statsCached;
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
@@ -21,8 +25,10 @@ public:
     bool HaveCoins(const uint256 &txid);
     CBlockIndex *GetBestBlock();
     bool SetBestBlock(CBlockIndex *pindex);
-    bool BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex);
+    bool BatchWrite(const CCoinsMap &mapCoins, CBlockIndex *pindex);
     bool GetStats(CCoinsStats &stats);
+
+    CLevelDB &GetDB() { return db; }
 };
 
 /** Access to the block database (blocks/index/) */
@@ -9,6 +9,7 @@
 #define _POSIX_C_SOURCE 200112L
 #endif
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/resource.h>
 #endif
@@ -42,6 +43,11 @@ namespace boost {
 #include <openssl/rand.h>
 #include <stdarg.h>
 
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <cpuid.h>
+#define HAVE_CPUID 1
+#endif
+
 #ifdef WIN32
 #ifdef _MSC_VER
 #pragma warning(disable:4786)
@@ -75,6 +81,7 @@ bool fDebug = false;
 bool fDebugNet = false;
 bool fPrintToConsole = false;
 bool fPrintToDebugger = false;
+bool fPrintToDebugLog = true;
 bool fDaemon = false;
 bool fServer = false;
 bool fCommandLine = false;
@@ -244,7 +251,7 @@ int OutputDebugStringF(const char* pszFormat, ...)
         ret += vprintf(pszFormat, arg_ptr);
         va_end(arg_ptr);
     }
-    else if (!fPrintToDebugger)
+    else if (!fPrintToDebugger && fPrintToDebugLog)
     {
         static bool fStartedNewLine = true;
         boost::call_once(&DebugPrintInit, debugPrintInitFlag);
@@ -1236,6 +1243,48 @@ void AllocateFileRange(FILE *file, unsigned int offset, unsigned int length) {
 #endif
 }
 
+CMappedFile::CMappedFile(const boost::filesystem::path &path) : pdata(NULL), nSize(0) {
+#ifdef WIN32
+    HANDLE hFile = CreateFileA(path.string().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return;
+    LARGE_INTEGER nFileSize;
+    if (GetFileSizeEx(hFile, &nFileSize) && nFileSize.QuadPart > 0 && (uint64)nFileSize.QuadPart <= (size_t)-1) {
+        HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (hMapping != NULL) {
+            pdata = (const char*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+            nSize = pdata ? (size_t)nFileSize.QuadPart : 0;
+            CloseHandle(hMapping); // the view keeps the mapping alive
+        }
+    }
+    CloseHandle(hFile);
+#else
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0 && (uint64)st.st_size <= (size_t)-1) {
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            pdata = (const char*)p;
+            nSize = st.st_size;
+        }
+    }
+    close(fd); // the mapping stays valid
+#endif
+}
+
+CMappedFile::~CMappedFile() {
+    if (pdata == NULL)
+        return;
+#ifdef WIN32
+    UnmapViewOfFile(pdata);
+#else
+    munmap((void*)pdata, nSize);
+#endif
+}
+
 void ShrinkDebugFile()
 {
     // Scroll debug.log if it's getting too big
@@ -1511,6 +1560,40 @@ void RenameThread(const char* name)
 #endif
 }
 
+bool CPUHasSSE2()
+{
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64)
+    return true;
+#elif defined(HAVE_CPUID)
+    unsigned int eax, ebx, ecx, edx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (edx & (1 << 26));
+#else
+    return false;
+#endif
+}
+
+bool CPUHasAVX2()
+{
+#if defined(HAVE_CPUID)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+    // The OS has to save the ymm registers for us (OSXSAVE + AVX, XCR0 bits 1 and 2)
+    if ((ecx & (1 << 27)) == 0 || (ecx & (1 << 28)) == 0)
+        return false;
+    unsigned int xcr0_lo, xcr0_hi;
+    __asm__ ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 6) != 6)
+        return false;
+    if (__get_cpuid_max(0, NULL) < 7)
+        return false;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & (1 << 5)) != 0;
+#else
+    return false;
+#endif
+}
+
 bool NewThread(void(*pfn)(void*), void* parg)
 {
     try
@@ -138,6 +138,7 @@ extern bool fDebug;
 extern bool fDebugNet;
 extern bool fPrintToConsole;
 extern bool fPrintToDebugger;
+extern bool fPrintToDebugLog;
 extern bool fDaemon;
 extern bool fServer;
 extern bool fCommandLine;
@@ -202,6 +203,26 @@ int GetFilesize(FILE* file);
 bool TruncateFile(FILE *file, unsigned int length);
 int RaiseFileDescriptorLimit(int nMinFD);
 void AllocateFileRange(FILE *file, unsigned int offset, unsigned int length);
+
+/** Read-only memory mapping of a whole file, unmapped when destroyed.
+ *  The file must not shrink while it is mapped. */
+class CMappedFile
+{
+private:
+    const char *pdata;
+    size_t nSize;
+
+    CMappedFile(const CMappedFile&);
+    void operator=(const CMappedFile&);
+
+public:
+    explicit CMappedFile(const boost::filesystem::path &path);
+    ~CMappedFile();
+
+    bool IsValid() const     { return pdata != NULL; }
+    const char *data() const { return pdata; }
+    size_t size() const      { return nSize; }
+};
 bool RenameOver(boost::filesystem::path src, boost::filesystem::path dest);
 boost::filesystem::path GetDefaultDataDir();
 const boost::filesystem::path &GetDataDir(bool fNetSpecific = true);
@@ -518,6 +539,10 @@ inline void SetThreadPriority(int nPriority)
 
 void RenameThread(const char* name);
 
+/** Whether the CPU supports SSE2, and AVX2 with the ymm state saved by the OS. */
+bool CPUHasSSE2();
+bool CPUHasAVX2();
+
 inline uint32_t ByteReverse(uint32_t value)
 {
     value = ((value & 0xFF00FF00) >> 8) | ((value & 0x00FF00FF) << 8);
@@ -167,8 +167,11 @@ HEADERS += src/qt/bitcoingui.h \
     src/util.h \
     src/hash.h \
     src/uint256.h \
+    src/arith_uint256.h \
     src/serialize.h \
     src/core.h \
+    src/memusage.h \
+    src/powhash.h \
     src/main.h \
     src/net.h \
     src/key.h \
@@ -230,6 +233,8 @@ HEADERS += src/qt/bitcoingui.h \
     src/qt/splashscreen.h \
     src/qt/intro.h \
     src/scrypt.h \
+    src/sha256.h \
+    src/sha256-scan.h \
     src/sph_blake.h \
     src/sph_groestl.h \
     src/sph_keccak.h \
@@ -264,6 +269,7 @@ SOURCES += src/qt/bitcoin.cpp \
     src/key.cpp \
     src/script.cpp \
     src/core.cpp \
+    src/powhash.cpp \
     src/main.cpp \
     src/init.cpp \
     src/net.cpp \
@@ -314,6 +320,7 @@ SOURCES += src/qt/bitcoin.cpp \
     src/qt/splashscreen.cpp \
     src/qt/intro.cpp \
     src/scrypt.cpp \
+    src/sha256.cpp \
     src/blake.c \
     src/bmw.c \
     src/groestl.c \